@@ -74,6 +74,14 @@ void vpi_config_save()
     sprintf(buf, "%i", vpi_config.region);
     xmlTextWriterWriteElement(writer, BAD_CAST "region", BAD_CAST buf);
 
+    sprintf(buf, "%i", vpi_config.present_mode);
+    xmlTextWriterWriteElement(writer, BAD_CAST "presentmode", BAD_CAST buf);
+
+    sprintf(buf, "%i", vpi_config.audio_latency);
+    xmlTextWriterWriteElement(writer, BAD_CAST "audiolatency", BAD_CAST buf);
+
+    xmlTextWriterWriteElement(writer, BAD_CAST "decoder", BAD_CAST vpi_config.decoder);
+
     xmlTextWriterEndElement(writer); // vanilla
     
     xmlTextWriterEndDocument(writer);
@@ -144,6 +152,14 @@ void vpi_config_init()
                         vpi_config.connection_setup = atoi((const char *) child->children->content);
                     } else if (!strcmp((const char *) child->name, "region")) {
                         vpi_config.region = atoi((const char *) child->children->content);
+                    } else if (!strcmp((const char *) child->name, "presentmode")) {
+                        vpi_config.present_mode = atoi((const char *) child->children->content);
+                    } else if (!strcmp((const char *) child->name, "audiolatency")) {
+                        vpi_config.audio_latency = atoi((const char *) child->children->content);
+                    } else if (!strcmp((const char *) child->name, "decoder")) {
+                        if (child->children) {
+                            vui_strncpy(vpi_config.decoder, (const char *) child->children->content, sizeof(vpi_config.decoder));
+                        }
                     }
                 }
                 child = child->next;
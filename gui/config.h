@@ -19,6 +19,9 @@ typedef struct {
     char wireless_interface[VPI_CONSOLE_MAX_NAME];
     int connection_setup;
     int region;
+    int present_mode;
+    int audio_latency; // ms, 0 for the default
+    char decoder[VPI_CONSOLE_MAX_NAME];
 } vpi_config_t;
 
 extern vpi_config_t vpi_config;
@@ -0,0 +1,195 @@
+#include "decode.h"
+
+#include <dirent.h>
+#include <libavutil/hwcontext.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vanilla.h>
+
+#include "platform.h"
+#include "ui/ui_util.h"
+
+static atomic_int vpi_decoder_benchmark_pending = 0;
+
+static enum AVPixelFormat vaapi_get_format(struct AVCodecContext *s, const enum AVPixelFormat *fmt)
+{
+	while (*fmt != AV_PIX_FMT_NONE) {
+        if (*fmt == AV_PIX_FMT_VAAPI) {
+            return *fmt;
+		}
+        fmt++;
+    }
+
+    return AV_PIX_FMT_NONE;
+}
+
+static enum AVPixelFormat drm_get_format(struct AVCodecContext *s, const enum AVPixelFormat *fmt)
+{
+	while (*fmt != AV_PIX_FMT_NONE) {
+        if (*fmt == AV_PIX_FMT_DRM_PRIME) {
+            return *fmt;
+		}
+        fmt++;
+    }
+
+    return AV_PIX_FMT_NONE;
+}
+
+static int compare_node_names(const void *a, const void *b)
+{
+    return strcmp((const char *) a, (const char *) b);
+}
+
+// Lists /dev/dri nodes starting with `prefix`, sorted so the order is the same every run
+static int list_dri_nodes(const char *prefix, char nodes[][VPI_DECODER_MAX_NAME], int max)
+{
+    DIR *dir = opendir("/dev/dri");
+    if (!dir) {
+        return 0;
+    }
+
+    int count = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) && count < max) {
+        if (!strncmp(ent->d_name, prefix, strlen(prefix))) {
+            snprintf(nodes[count], VPI_DECODER_MAX_NAME, "/dev/dri/%s", ent->d_name);
+            count++;
+        }
+    }
+
+    closedir(dir);
+
+    qsort(nodes, count, VPI_DECODER_MAX_NAME, compare_node_names);
+
+    return count;
+}
+
+static void add_backend(vpi_decoder_backend_t *backends, int *count, int max, int type, const char *prefix, const char *device)
+{
+    if (*count == max) {
+        return;
+    }
+
+    vpi_decoder_backend_t *b = &backends[*count];
+    b->type = type;
+    vui_strncpy(b->device, device, sizeof(b->device));
+    if (device[0]) {
+        snprintf(b->name, sizeof(b->name), "%s:%s", prefix, device);
+    } else {
+        vui_strncpy(b->name, prefix, sizeof(b->name));
+    }
+
+    (*count)++;
+}
+
+int vpi_decoder_enumerate(vpi_decoder_backend_t *backends, int max)
+{
+    int count = 0;
+    char nodes[VPI_DECODER_MAX_BACKENDS][VPI_DECODER_MAX_NAME];
+
+    // VAAPI can be backed by any GPU, so offer each render node separately
+    int node_count = list_dri_nodes("renderD", nodes, VPI_DECODER_MAX_BACKENDS);
+    for (int i = 0; i < node_count; i++) {
+        add_backend(backends, &count, max, VPI_DECODER_VAAPI, "vaapi", nodes[i]);
+    }
+
+    // V4L2 mem2mem (e.g. Raspberry Pi) only needs a DRM device for its output frames
+    if (avcodec_find_decoder_by_name("h264_v4l2m2m")) {
+        node_count = list_dri_nodes("card", nodes, VPI_DECODER_MAX_BACKENDS);
+        if (node_count > 0) {
+            add_backend(backends, &count, max, VPI_DECODER_V4L2M2M, "v4l2m2m", nodes[0]);
+        }
+    }
+
+    // Software always works, so it's always a candidate
+    add_backend(backends, &count, max, VPI_DECODER_SOFTWARE, "software", "");
+
+    return count;
+}
+
+int vpi_decoder_find(const vpi_decoder_backend_t *backends, int count, const char *name)
+{
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(backends[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int vpi_decoder_create(const vpi_decoder_backend_t *backend, const AVCodec **codec, AVCodecContext **codec_ctx, AVBufferRef **hw_device_ctx)
+{
+    int ffmpeg_err;
+    enum AVPixelFormat (*get_format)(struct AVCodecContext *s, const enum AVPixelFormat * fmt) = 0;
+
+    *codec = 0;
+
+    switch (backend->type) {
+    case VPI_DECODER_VAAPI:
+        if ((ffmpeg_err = av_hwdevice_ctx_create(hw_device_ctx, AV_HWDEVICE_TYPE_VAAPI, backend->device, 0, 0)) >= 0) {
+            *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+            get_format = vaapi_get_format;
+        }
+        break;
+    case VPI_DECODER_V4L2M2M:
+        if ((ffmpeg_err = av_hwdevice_ctx_create(hw_device_ctx, AV_HWDEVICE_TYPE_DRM, backend->device, 0, 0)) >= 0) {
+            *codec = avcodec_find_decoder_by_name("h264_v4l2m2m");
+            get_format = drm_get_format;
+        }
+        break;
+    case VPI_DECODER_SOFTWARE:
+        *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+        break;
+    }
+
+    if (!*codec) {
+        vpilog("Decoder %s is unavailable\n", backend->name);
+        goto fail;
+    }
+
+    *codec_ctx = avcodec_alloc_context3(*codec);
+	if (!*codec_ctx) {
+		vpilog("Failed to allocate codec context\n");
+        goto fail;
+	}
+
+    if (*hw_device_ctx) {
+        (*codec_ctx)->hw_device_ctx = av_buffer_ref(*hw_device_ctx);
+    }
+
+    if (get_format) {
+        (*codec_ctx)->get_format = get_format;
+    }
+
+    // Low latency profile: hand out every frame as soon as it's decoded
+    (*codec_ctx)->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    if (backend->type == VPI_DECODER_SOFTWARE) {
+        // Frame threading costs a frame of delay per thread, slice threading costs none
+        (*codec_ctx)->thread_type = FF_THREAD_SLICE;
+        (*codec_ctx)->thread_count = 0;
+    } else {
+        (*codec_ctx)->thread_count = 1;
+    }
+
+    vpilog("Decoding: %s\n", backend->name);
+
+    return VANILLA_SUCCESS;
+
+fail:
+    if (*hw_device_ctx) {
+        av_buffer_unref(hw_device_ctx);
+    }
+    return VANILLA_ERR_GENERIC;
+}
+
+void vpi_decoder_request_benchmark()
+{
+    atomic_store(&vpi_decoder_benchmark_pending, 1);
+}
+
+int vpi_decoder_take_benchmark_request()
+{
+    return atomic_exchange(&vpi_decoder_benchmark_pending, 0);
+}
@@ -0,0 +1,36 @@
+#ifndef VANILLA_PI_DECODE_H
+#define VANILLA_PI_DECODE_H
+
+#include <libavcodec/avcodec.h>
+#include <stdint.h>
+
+#include "decode_bench.h"
+
+#define VPI_DECODER_MAX_NAME 64
+#define VPI_DECODER_MAX_BACKENDS 8
+
+enum VpiDecoderType
+{
+    VPI_DECODER_VAAPI,
+    VPI_DECODER_V4L2M2M,
+    VPI_DECODER_SOFTWARE,
+};
+
+typedef struct {
+    int type;
+    char device[VPI_DECODER_MAX_NAME];
+
+    // Stable identifier stored in the config, e.g. "vaapi:/dev/dri/renderD128"
+    char name[VPI_DECODER_MAX_NAME];
+} vpi_decoder_backend_t;
+
+int vpi_decoder_enumerate(vpi_decoder_backend_t *backends, int max);
+int vpi_decoder_find(const vpi_decoder_backend_t *backends, int count, const char *name);
+
+// Allocates and configures, but doesn't open, a decoder for `backend`
+int vpi_decoder_create(const vpi_decoder_backend_t *backend, const AVCodec **codec, AVCodecContext **codec_ctx, AVBufferRef **hw_device_ctx);
+
+void vpi_decoder_request_benchmark();
+int vpi_decoder_take_benchmark_request();
+
+#endif // VANILLA_PI_DECODE_H
@@ -0,0 +1,90 @@
+#include "decode_bench.h"
+
+#include <string.h>
+#include <time.h>
+
+static int64_t get_wall_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t get_cpu_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void vpi_decoder_bench_start(vpi_decoder_bench_t *bench)
+{
+    memset(bench, 0, sizeof(vpi_decoder_bench_t));
+    bench->latency_ms = -1;
+}
+
+int vpi_decoder_bench_packet(vpi_decoder_bench_t *bench, int error)
+{
+    bench->packets++;
+    if (error) {
+        bench->errors++;
+    }
+
+    // Returns whether this backend should be given up on
+    return (bench->frames == 0 && bench->packets >= VPI_DECODER_BENCH_MAX_PACKETS)
+        || bench->errors > VPI_DECODER_BENCH_MAX_PACKETS / 4;
+}
+
+int vpi_decoder_bench_frame(vpi_decoder_bench_t *bench, int64_t latency)
+{
+    bench->frames++;
+
+    if (bench->frames == VPI_DECODER_BENCH_WARMUP) {
+        // CPU time covers the whole process, but everything apart from the
+        // decoder does the same work whichever backend is being measured
+        bench->wall_start = get_wall_time_us();
+        bench->cpu_start = get_cpu_time_us();
+    } else if (bench->frames > VPI_DECODER_BENCH_WARMUP) {
+        bench->latency_sum += latency;
+    }
+
+    // Returns whether enough frames have been measured
+    return bench->frames >= VPI_DECODER_BENCH_WARMUP + VPI_DECODER_BENCH_FRAMES;
+}
+
+void vpi_decoder_bench_finish(vpi_decoder_bench_t *bench)
+{
+    int measured = bench->frames - VPI_DECODER_BENCH_WARMUP;
+    if (measured <= 0) {
+        bench->latency_ms = -1;
+        return;
+    }
+
+    int64_t wall = get_wall_time_us() - bench->wall_start;
+    int64_t cpu = get_cpu_time_us() - bench->cpu_start;
+
+    bench->latency_ms = bench->latency_sum / measured / 1000.0f;
+    bench->cpu_percent = wall > 0 ? cpu * 100.0f / wall : 0;
+}
+
+int vpi_decoder_bench_pick(const vpi_decoder_bench_t *bench, int count)
+{
+    // Lowest latency wins, but within a millisecond the cheaper backend is preferred
+    const float LATENCY_TOLERANCE_MS = 1.0f;
+
+    int best = -1;
+    for (int i = 0; i < count; i++) {
+        if (bench[i].latency_ms < 0) {
+            continue;
+        }
+
+        if (best == -1 || bench[i].latency_ms < bench[best].latency_ms - LATENCY_TOLERANCE_MS) {
+            best = i;
+        } else if (bench[i].latency_ms <= bench[best].latency_ms + LATENCY_TOLERANCE_MS
+                   && bench[i].cpu_percent < bench[best].cpu_percent) {
+            best = i;
+        }
+    }
+
+    return best;
+}
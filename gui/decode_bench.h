@@ -0,0 +1,33 @@
+#ifndef VANILLA_PI_DECODE_BENCH_H
+#define VANILLA_PI_DECODE_BENCH_H
+
+#include <stdint.h>
+
+// Measurements for one backend, gathered while decoding the live stream
+typedef struct {
+    int packets;
+    int frames;
+    int errors;
+    int64_t latency_sum;
+    int64_t wall_start;
+    int64_t cpu_start;
+    float latency_ms;
+    float cpu_percent;
+} vpi_decoder_bench_t;
+
+// Frames decoded before measuring starts, so one-off setup costs aren't counted
+#define VPI_DECODER_BENCH_WARMUP 10
+
+// Frames measured per backend, about 1.5 seconds of video
+#define VPI_DECODER_BENCH_FRAMES 90
+
+// A backend that hasn't produced a frame by now is considered broken
+#define VPI_DECODER_BENCH_MAX_PACKETS 180
+
+void vpi_decoder_bench_start(vpi_decoder_bench_t *bench);
+int vpi_decoder_bench_packet(vpi_decoder_bench_t *bench, int error);
+int vpi_decoder_bench_frame(vpi_decoder_bench_t *bench, int64_t latency);
+void vpi_decoder_bench_finish(vpi_decoder_bench_t *bench);
+int vpi_decoder_bench_pick(const vpi_decoder_bench_t *bench, int count);
+
+#endif // VANILLA_PI_DECODE_BENCH_H
@@ -0,0 +1,13 @@
+#include "decode_frame.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+void vpi_decoder_frame_layout(vpi_decoder_frame_layout_t *layout, int width, int height)
+{
+    // Align twice as much so the chroma stride stays aligned after halving
+    layout->stride = ALIGN_UP(width, VPI_FRAME_ALIGN * 2);
+    layout->height = ALIGN_UP(height, 2);
+    layout->luma_size = (size_t) layout->stride * layout->height;
+    layout->chroma_size = (size_t) (layout->stride / 2) * (layout->height / 2);
+    layout->size = layout->luma_size + layout->chroma_size * 2 + VPI_FRAME_PADDING;
+}
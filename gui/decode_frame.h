@@ -0,0 +1,23 @@
+#ifndef VANILLA_PI_DECODE_FRAME_H
+#define VANILLA_PI_DECODE_FRAME_H
+
+#include <stddef.h>
+
+// Software frames are laid out so the renderer can upload each plane with a
+// single copy. The chroma stride is exactly half the luma stride, which is
+// also the pitch an IYUV texture of that width expects.
+#define VPI_FRAME_ALIGN 64
+#define VPI_FRAME_PADDING (16 + VPI_FRAME_ALIGN - 1)
+
+typedef struct {
+    int stride;         // Luma, chroma planes use half of it
+    int height;         // Luma, chroma planes have half of it
+    size_t luma_size;
+    size_t chroma_size; // Per chroma plane
+    size_t size;        // Whole buffer, including padding for decoders that read past the end
+} vpi_decoder_frame_layout_t;
+
+// Plane layout for a YUV420P frame of the given size, as already aligned by the decoder
+void vpi_decoder_frame_layout(vpi_decoder_frame_layout_t *layout, int width, int height);
+
+#endif // VANILLA_PI_DECODE_FRAME_H
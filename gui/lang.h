@@ -53,6 +53,8 @@ typedef enum {
 	VPI_LANG_AUTH_WARNING_ACKNOWLEDGE,
 	VPI_LANG_ENABLE_PASSWORD_SKIP,
 	VPI_LANG_DISABLE_PASSWORD_SKIP,
+	VPI_LANG_REPLAY_SAVED,
+	VPI_LANG_REPLAY_ERROR,
     __VPI_LANG_T_COUNT
 } vpi_lang_t;
 
@@ -1,8 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <vanilla.h>
 
 #include "config.h"
+#include "decode.h"
 #include "menu/menu.h"
 #include "platform.h"
 #include "ui/ui.h"
@@ -23,12 +25,36 @@ int SDL_main(int argc, const char **argv)
 {
     // Default to full screen unless "-w" is specified
     int fs = 1;
+    int present_mode = -1;
+    int audio_latency = -1;
 	for (int i = 1, consumed; i < argc; i += consumed) {
 		consumed = -1;
 		 if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--window")) {
 			fs = 0;
 			consumed = 1;
 		}
+		else if ((!strcmp(argv[i], "-p") || !strcmp(argv[i], "--present")) && i + 1 < argc) {
+			if (!strcmp(argv[i + 1], "adaptive")) {
+				present_mode = VUI_PRESENT_MODE_ADAPTIVE;
+			} else if (!strcmp(argv[i + 1], "low-latency")) {
+				present_mode = VUI_PRESENT_MODE_LOW_LATENCY;
+			} else if (!strcmp(argv[i + 1], "smooth")) {
+				present_mode = VUI_PRESENT_MODE_SMOOTH;
+			}
+			consumed = (present_mode == -1) ? -1 : 2;
+		}
+		else if ((!strcmp(argv[i], "-a") || !strcmp(argv[i], "--audio-latency")) && i + 1 < argc) {
+			char *end;
+			long ms = strtol(argv[i + 1], &end, 10);
+			if (*argv[i + 1] && !*end && ms >= 0 && ms <= 1000) {
+				audio_latency = ms;
+			}
+			consumed = (audio_latency == -1) ? -1 : 2;
+		}
+		else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--benchmark-decoders")) {
+			vpi_decoder_request_benchmark();
+			consumed = 1;
+		}
 		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			display_cli_help(argv);
 			return 0;
@@ -55,6 +81,23 @@ int SDL_main(int argc, const char **argv)
         goto exit;
     }
 
+    // Command line overrides the configured presentation mode for this session
+    if (present_mode == -1) {
+        present_mode = vpi_config.present_mode;
+    }
+    if (present_mode < 0 || present_mode >= VUI_PRESENT_MODE_COUNT) {
+        present_mode = VUI_PRESENT_MODE_ADAPTIVE;
+    }
+    vui_sdl_set_present_mode(vui, present_mode);
+
+    if (audio_latency == -1) {
+        audio_latency = vpi_config.audio_latency;
+    }
+    if (audio_latency < 0) {
+        audio_latency = 0;
+    }
+    vui_sdl_set_audio_latency(vui, audio_latency);
+
     vpi_menu_init(vui);
 
     while (vui_update_sdl(vui)) {
@@ -79,5 +122,8 @@ void display_cli_help(const char **argv) {
 	vpilog("Usage: %s [options]\n\n", argv[0]);
 	vpilog("Options:\n");
 	vpilog("	-w, --window	Run Vanilla in a window\n");
+	vpilog("	-p, --present <mode>	Frame presentation: adaptive (default), low-latency or smooth\n");
+	vpilog("	-a, --audio-latency <ms>	Audio to keep buffered, smaller values also shrink the device buffer (default: 0, automatic)\n");
+	vpilog("	-b, --benchmark-decoders	Measure every available decoder again and keep the fastest\n");
 	vpilog("	-h, --help	Show this help message\n");
 }
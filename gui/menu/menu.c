@@ -59,6 +59,16 @@ void vpi_menu_action(vui_context_t *vui, vpi_extra_action_t action)
         }
         break;
     }
+    case VPI_ACTION_SAVE_REPLAY:
+    {
+        char replay_fn[4096];
+        get_valid_filename("Replay-%04i.mp4", replay_fn, sizeof(replay_fn));
+        vpi_decode_save_replay(replay_fn);
+        break;
+    }
+    case VPI_ACTION_TOGGLE_PERF_HUD:
+        vui_perf_hud_set(vui, !vui_perf_hud_get(vui));
+        break;
     case VPI_ACTION_DISCONNECT:
     {
         if (vui_game_mode_get(vui)) {
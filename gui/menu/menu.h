@@ -8,6 +8,8 @@ typedef enum {
     VPI_ACTION_SCREENSHOT,
     VPI_ACTION_TOGGLE_RECORDING,
     VPI_ACTION_DISCONNECT,
+    VPI_ACTION_SAVE_REPLAY,
+    VPI_ACTION_TOGGLE_PERF_HUD,
 } vpi_extra_action_t;
 
 void vpi_menu_init(vui_context_t *vui);
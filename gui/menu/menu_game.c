@@ -5,16 +5,26 @@
 #include <libavcodec/avcodec.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
+#include <libavutil/time.h>
 #include <libswscale/swscale.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <vanilla.h>
 
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "config.h"
+#include "decode.h"
+#include "decode_frame.h"
 #include "lang.h"
 #include "menu_common.h"
 #include "menu_main.h"
+#include "replay.h"
 #include "ui/ui_anim.h"
 #include "ui/ui_util.h"
 
@@ -22,15 +32,117 @@ static char vpi_toast_string[VPI_TOAST_MAX_LEN];
 static struct timeval vpi_toast_expiry;
 static int vpi_toast_number = 0;
 
-AVFrame *vpi_present_frame = 0;
-pthread_mutex_t vpi_present_frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Latest-wins triple buffer between the decoder and the renderer. Each side
+// owns one slot, and the third is swapped atomically so neither ever waits.
+#define VPI_PRESENT_FRESH 0x4
+static AVFrame *vpi_present_slots[3] = {0};
+static atomic_uint vpi_present_middle = 1;
+static unsigned int vpi_present_write_idx = 0;
+static unsigned int vpi_present_read_idx = 2;
+static atomic_uint_fast64_t vpi_present_count_presented = 0;
+static atomic_uint_fast64_t vpi_present_count_skipped = 0;
+static atomic_uint_fast64_t vpi_present_count_repeated = 0;
+static int64_t vpi_present_slot_time[3] = {0};
+
+// FIFO used instead of the triple buffer when the renderer wants every frame
+// in order (smooth presentation). Single producer, single consumer.
+#define VPI_PRESENT_QUEUE_SIZE 4
+static AVFrame *vpi_present_queue[VPI_PRESENT_QUEUE_SIZE] = {0};
+static int64_t vpi_present_queue_time[VPI_PRESENT_QUEUE_SIZE] = {0};
+static AVFrame *vpi_present_queue_out = 0; // Owned by the renderer
+static atomic_size_t vpi_present_queue_write = 0;
+static atomic_size_t vpi_present_queue_read = 0;
+static atomic_int vpi_present_queue_depth = 0;
+
+// Only used to wake up a renderer that's waiting for a frame, never held while
+// touching frames
+static pthread_mutex_t vpi_present_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_present_wait_cond = PTHREAD_COND_INITIALIZER;
+
+// Software decoding steps down through cheaper settings when it can't keep up
+// with the console, and back up once there's headroom again
+#define VPI_DECODE_BUDGET_US 16667
+#define VPI_DECODE_WINDOW 30
+#define VPI_DECODE_HEADROOM_WINDOWS 4
+enum VpiDegradeLevel
+{
+    VPI_DEGRADE_NONE,
+    VPI_DEGRADE_SKIP_NONREF_LOOP_FILTER,
+    VPI_DEGRADE_FAST,
+    VPI_DEGRADE_SKIP_LOOP_FILTER,
+    VPI_DEGRADE_COUNT
+};
+static const char *vpi_degrade_names[VPI_DEGRADE_COUNT] = {
+    "full quality",
+    "no loop filter on non-reference frames",
+    "fast decoding",
+    "no loop filter",
+};
+static atomic_int vpi_decode_degrade_level = VPI_DEGRADE_NONE;
+static atomic_uint_fast64_t vpi_decode_degrade_transitions = 0;
+
+static atomic_uint_fast64_t vpi_decode_count_frames = 0;
+
+// Benchmark winner handed from the decode thread to the UI thread, which owns
+// vpi_config. The name is only written while the flag is clear.
+static char vpi_decode_chosen_backend[VPI_DECODER_MAX_NAME];
+static atomic_int vpi_decode_chosen_backend_ready = 0;
+static atomic_uint_fast64_t vpi_decode_time_hist[VPI_DECODE_HIST_BUCKETS] = {0};
 
 static AVFormatContext *recording_fmt_ctx = 0;
+static pthread_mutex_t recording_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes starting and stopping
 static AVStream *recording_vstr;
 static AVStream *recording_astr;
 static struct timeval recording_start;
 static char screenshot_buf[4096] = {0};
 
+// Screenshots are converted and encoded on their own thread, the decoder only
+// hands over a reference to the frame
+static AVFrame *vpi_screenshot_frame = 0;
+static char vpi_screenshot_filename[4096] = {0};
+static int vpi_screenshot_pending = 0;
+static int vpi_screenshot_active = 0;
+static pthread_mutex_t vpi_screenshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_screenshot_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t vpi_screenshot_thread;
+
+// Packets waiting for the recording writer thread, so file I/O never stalls
+// decoding. Slots are allocated once and only ever hold references.
+#define VPI_RECORD_QUEUE_SIZE 512
+static AVPacket *vpi_record_queue[VPI_RECORD_QUEUE_SIZE] = {0};
+static AVPacket *vpi_record_out = 0; // Owned by the writer thread
+static size_t vpi_record_queue_read = 0;
+static size_t vpi_record_queue_write = 0;
+static atomic_int vpi_record_queue_active = 0;
+static int vpi_record_resync = 0; // Dropping video until the next keyframe
+static pthread_mutex_t vpi_record_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_record_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t vpi_record_thread;
+static atomic_size_t vpi_record_backlog = 0;
+static atomic_uint_fast64_t vpi_record_dropped = 0;
+
+// Instant replay, see replay.h. Everything in the ring is guarded by vpi_replay_mutex.
+//
+// The console only sends keyframes when asked, so ask this often while the
+// ring is active. Eviction keeps up to one interval more than
+// VPI_REPLAY_SECONDS to hold on to the keyframe the replay starts from.
+#define VPI_REPLAY_IDR_INTERVAL_US (VPI_REPLAY_SECONDS * 1000000LL / 2)
+
+// Video comfortably above what the console sends, audio is raw 48 kHz stereo S16
+#define VPI_REPLAY_VIDEO_BYTES_PER_SEC (10 * 1000 * 1000 / 8)
+#define VPI_REPLAY_AUDIO_BYTES_PER_SEC (48000 * 4)
+#define VPI_REPLAY_SLAB_SIZE ((VPI_REPLAY_SECONDS + VPI_REPLAY_SECONDS / 2) * (VPI_REPLAY_VIDEO_BYTES_PER_SEC + VPI_REPLAY_AUDIO_BYTES_PER_SEC))
+#define VPI_REPLAY_MAX_PACKETS 32768
+static vpi_replay_ring_t vpi_replay = {0};
+static int64_t vpi_replay_last_key_time = 0;
+static int64_t vpi_replay_idr_request_time = 0;
+static pthread_mutex_t vpi_replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_replay_saved_cond = PTHREAD_COND_INITIALIZER;
+static int vpi_replay_saving = 0;
+static char vpi_replay_filename[4096];
+static void vpi_replay_start();
+static void vpi_replay_stop();
+
 static const int VIDEO_STREAM_INDEX = 0;
 static const int AUDIO_STREAM_INDEX = 1;
 
@@ -175,84 +287,223 @@ size_t build_avcc(uint8_t *dst, size_t cap,
     return (size_t)(p - dst);
 }
 
-static enum AVPixelFormat vaapi_get_format(struct AVCodecContext *s, const enum AVPixelFormat *fmt)
+typedef struct {
+    AVCodecContext *codec_ctx;
+    AVPacket *pkt;
+    AVFrame *frame;
+    AVBufferRef *hw_device_ctx;
+    AVBufferPool *frame_pool;
+    size_t frame_pool_size;
+
+    vpi_decoder_backend_t backends[VPI_DECODER_MAX_BACKENDS];
+    vpi_decoder_bench_t bench[VPI_DECODER_MAX_BACKENDS];
+    int backend_count;
+    int backend;
+    int benchmarking;
+
+    int degrade_level;
+    int degrade_frames;
+    int degrade_overruns;
+    int64_t degrade_time_sum;
+    int degrade_headroom_windows;
+} vpi_decode_state_t;
+
+// Software frames use the layout from decode_frame.h
+static pthread_mutex_t vpi_frame_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int vpi_get_cpu_buffer(struct AVCodecContext *c, AVFrame *frame, int flags)
 {
-	while (*fmt != AV_PIX_FMT_NONE) {
-        if (*fmt == AV_PIX_FMT_VAAPI) {
-            return *fmt;
-		}
-        fmt++;
+    vpi_decode_state_t *s = (vpi_decode_state_t *) c->opaque;
+
+    if (frame->format != AV_PIX_FMT_YUV420P) {
+        return avcodec_default_get_buffer2(c, frame, flags);
     }
 
-    return AV_PIX_FMT_NONE;
+    int w = frame->width;
+    int h = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(c, &w, &h, linesize_align);
+
+    vpi_decoder_frame_layout_t layout;
+    vpi_decoder_frame_layout(&layout, w, h);
+
+    pthread_mutex_lock(&vpi_frame_pool_mutex);
+    if (s->frame_pool_size != layout.size) {
+        // Buffers already handed out keep the old pool alive until they're released
+        av_buffer_pool_uninit(&s->frame_pool);
+        s->frame_pool = av_buffer_pool_init(layout.size, av_malloc);
+        s->frame_pool_size = s->frame_pool ? layout.size : 0;
+    }
+    frame->buf[0] = s->frame_pool ? av_buffer_pool_get(s->frame_pool) : NULL;
+    pthread_mutex_unlock(&vpi_frame_pool_mutex);
+
+    if (!frame->buf[0]) {
+        return AVERROR(ENOMEM);
+    }
+
+    frame->data[0] = frame->buf[0]->data;
+    frame->data[1] = frame->data[0] + layout.luma_size;
+    frame->data[2] = frame->data[1] + layout.chroma_size;
+    frame->linesize[0] = layout.stride;
+    frame->linesize[1] = layout.stride / 2;
+    frame->linesize[2] = layout.stride / 2;
+    frame->extended_data = frame->data;
+
+    return 0;
 }
 
-static enum AVPixelFormat drm_get_format(struct AVCodecContext *s, const enum AVPixelFormat *fmt)
+// Event buffers are handed to FFmpeg as-is, so they need at least as much padding as it expects
+_Static_assert(VANILLA_EVENT_BUFFER_PADDING >= AV_INPUT_BUFFER_PADDING_SIZE, "libvanilla event padding is too small for FFmpeg");
+
+static void vpi_release_event_buffer(void *opaque, uint8_t *data)
 {
-	while (*fmt != AV_PIX_FMT_NONE) {
-        if (*fmt == AV_PIX_FMT_DRM_PRIME) {
-            return *fmt;
-		}
-        fmt++;
+    vanilla_release_event_data(data);
+}
+
+static void vpi_present_frame_publish(AVFrame *frame)
+{
+    int64_t now = av_gettime_relative();
+
+    if (atomic_load(&vpi_present_queue_depth)) {
+        size_t w = atomic_load(&vpi_present_queue_write);
+        if (w - atomic_load(&vpi_present_queue_read) == VPI_PRESENT_QUEUE_SIZE) {
+            // Renderer isn't keeping up, drop this one
+            av_frame_unref(frame);
+            atomic_fetch_add(&vpi_present_count_skipped, 1);
+            return;
+        }
+
+        AVFrame *slot = vpi_present_queue[w % VPI_PRESENT_QUEUE_SIZE];
+        av_frame_unref(slot);
+        av_frame_move_ref(slot, frame);
+        vpi_present_queue_time[w % VPI_PRESENT_QUEUE_SIZE] = now;
+        atomic_store(&vpi_present_queue_write, w + 1);
+    } else {
+        AVFrame *slot = vpi_present_slots[vpi_present_write_idx];
+        av_frame_unref(slot);
+        av_frame_move_ref(slot, frame);
+        vpi_present_slot_time[vpi_present_write_idx] = now;
+
+        unsigned int prev = atomic_exchange(&vpi_present_middle, vpi_present_write_idx | VPI_PRESENT_FRESH);
+        vpi_present_write_idx = prev & 0x3;
+
+        // Renderer never picked up the frame we just replaced
+        if (prev & VPI_PRESENT_FRESH) {
+            atomic_fetch_add(&vpi_present_count_skipped, 1);
+        }
     }
 
-    return AV_PIX_FMT_NONE;
+    pthread_mutex_lock(&vpi_present_wait_mutex);
+    pthread_cond_signal(&vpi_present_wait_cond);
+    pthread_mutex_unlock(&vpi_present_wait_mutex);
 }
 
-typedef struct {
-    AVCodecContext *codec_ctx;
-    AVPacket *pkt;
+static int vpi_present_frame_available()
+{
+    if (atomic_load(&vpi_present_queue_depth)) {
+        return atomic_load(&vpi_present_queue_write) != atomic_load(&vpi_present_queue_read);
+    } else {
+        return (atomic_load(&vpi_present_middle) & VPI_PRESENT_FRESH) != 0;
+    }
+}
+
+AVFrame *vpi_present_frame_acquire(int64_t *decoded_time)
+{
+    if (!vpi_present_frame_available()) {
+        atomic_fetch_add(&vpi_present_count_repeated, 1);
+        return NULL;
+    }
+
     AVFrame *frame;
-    AVBufferRef *hw_device_ctx;
-} vpi_decode_state_t;
 
-int vpi_decode_init(vpi_decode_state_t *s)
+    int depth = atomic_load(&vpi_present_queue_depth);
+    if (depth) {
+        size_t r = atomic_load(&vpi_present_queue_read);
+        size_t w = atomic_load(&vpi_present_queue_write);
+
+        // Keep at most `depth` frames of latency, catch up by dropping the oldest
+        while (w - r > (size_t) depth) {
+            av_frame_unref(vpi_present_queue[r % VPI_PRESENT_QUEUE_SIZE]);
+            atomic_fetch_add(&vpi_present_count_skipped, 1);
+            r++;
+        }
+
+        // Slot is handed back to the decoder once `read` moves past it, so take
+        // the ref out first
+        frame = vpi_present_queue_out;
+        av_frame_unref(frame);
+        av_frame_move_ref(frame, vpi_present_queue[r % VPI_PRESENT_QUEUE_SIZE]);
+        if (decoded_time) *decoded_time = vpi_present_queue_time[r % VPI_PRESENT_QUEUE_SIZE];
+
+        atomic_store(&vpi_present_queue_read, r + 1);
+    } else {
+        unsigned int prev = atomic_exchange(&vpi_present_middle, vpi_present_read_idx);
+        vpi_present_read_idx = prev & 0x3;
+
+        frame = vpi_present_slots[vpi_present_read_idx];
+        if (decoded_time) *decoded_time = vpi_present_slot_time[vpi_present_read_idx];
+    }
+
+    atomic_fetch_add(&vpi_present_count_presented, 1);
+
+    return frame;
+}
+
+int vpi_present_frame_wait(int64_t timeout_us)
 {
-    int ffmpeg_err;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (timeout_us % 1000000) * 1000;
+    ts.tv_sec += timeout_us / 1000000 + ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&vpi_present_wait_mutex);
+    while (!vpi_present_frame_available()) {
+        if (pthread_cond_timedwait(&vpi_present_wait_cond, &vpi_present_wait_mutex, &ts) != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vpi_present_wait_mutex);
 
-    // Initialize FFmpeg
-	const AVCodec *codec = 0;
-	enum AVPixelFormat (*get_format)(struct AVCodecContext *s, const enum AVPixelFormat * fmt);
-
-	// Test for VAAPI
-	if ((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_VAAPI, 0, 0, 0)) >= 0) {
-		vpilog("Decoding: VAAPI\n");
-		codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-		get_format = vaapi_get_format;
-	} else if ((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_DRM, "/dev/dri/card0", 0, 0)) >= 0) {
-		vpilog("Decoding: DRM\n");
-		codec = avcodec_find_decoder_by_name("h264_v4l2m2m");
-		get_format = drm_get_format;
-	}
+    return vpi_present_frame_available();
+}
 
-	// If we couldn't find a decoder (regardless of if we found hwaccel), fallback to software
-	if (!codec) {
-		if (s->hw_device_ctx) {
-			av_buffer_unref(&s->hw_device_ctx);
-		}
-		vpilog("Decoding: Software\n");
-		codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-		get_format = 0;
-	}
+void vpi_present_set_queue_depth(int depth)
+{
+    if (depth > VPI_PRESENT_QUEUE_SIZE - 1) {
+        depth = VPI_PRESENT_QUEUE_SIZE - 1;
+    }
+    atomic_store(&vpi_present_queue_depth, depth);
+}
 
-	// If we couldn't find a hardware or software decoder, fail
-	if (!codec) {
-		vpilog("No decoder was available\n");
-        return VANILLA_ERR_GENERIC;
-	}
+void vpi_present_get_stats(uint64_t *presented, uint64_t *skipped, uint64_t *repeated)
+{
+    if (presented) *presented = atomic_load(&vpi_present_count_presented);
+    if (skipped) *skipped = atomic_load(&vpi_present_count_skipped);
+    if (repeated) *repeated = atomic_load(&vpi_present_count_repeated);
+}
 
-    s->codec_ctx = avcodec_alloc_context3(codec);
-	if (!s->codec_ctx) {
-		vpilog("Failed to allocate codec context\n");
-        return VANILLA_ERR_GENERIC;
-	}
+static void vpi_decode_close(vpi_decode_state_t *s)
+{
+    if (s->codec_ctx)
+        avcodec_free_context(&s->codec_ctx);
 
-    if (s->hw_device_ctx) {
-        s->codec_ctx->hw_device_ctx = av_buffer_ref(s->hw_device_ctx);
-	}
+	if (s->hw_device_ctx)
+		av_buffer_unref(&s->hw_device_ctx);
+}
 
-	if (get_format) {
-		s->codec_ctx->get_format = get_format;
+static int vpi_decode_open(vpi_decode_state_t *s, int index)
+{
+    int ffmpeg_err;
+    const AVCodec *codec;
+
+    if (vpi_decoder_create(&s->backends[index], &codec, &s->codec_ctx, &s->hw_device_ctx) != VANILLA_SUCCESS) {
+        return VANILLA_ERR_GENERIC;
+    }
+
+	if (!s->codec_ctx->get_format && (codec->capabilities & AV_CODEC_CAP_DR1)) {
+		s->codec_ctx->opaque = s;
+		s->codec_ctx->get_buffer2 = vpi_get_cpu_buffer;
 	}
 
     const int BUILD_AVCC = 0;
@@ -276,6 +527,180 @@ int vpi_decode_init(vpi_decode_state_t *s)
 	ffmpeg_err = avcodec_open2(s->codec_ctx, codec, NULL);
     if (ffmpeg_err < 0) {
 		vpilog("Failed to open decoder: %i\n", ffmpeg_err);
+        vpi_decode_close(s);
+        return VANILLA_ERR_GENERIC;
+	}
+
+    s->backend = index;
+
+    // Fresh decoder starts at full quality
+    s->degrade_level = VPI_DEGRADE_NONE;
+    s->degrade_frames = 0;
+    s->degrade_overruns = 0;
+    s->degrade_time_sum = 0;
+    s->degrade_headroom_windows = 0;
+    atomic_store(&vpi_decode_degrade_level, VPI_DEGRADE_NONE);
+
+    return VANILLA_SUCCESS;
+}
+
+// Opens the first backend from `start` onwards that initializes
+static int vpi_decode_open_next(vpi_decode_state_t *s, int start)
+{
+    for (int i = start; i < s->backend_count; i++) {
+        if (s->benchmarking) {
+            vpi_decoder_bench_start(&s->bench[i]);
+        }
+        if (vpi_decode_open(s, i) == VANILLA_SUCCESS) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void vpi_decode_bench_next(vpi_decode_state_t *s)
+{
+    vpi_decoder_bench_t *bench = &s->bench[s->backend];
+    vpi_decoder_bench_finish(bench);
+    if (bench->latency_ms >= 0) {
+        vpilog("Decoder %s: %.2f ms per frame, %.0f%% CPU\n", s->backends[s->backend].name, bench->latency_ms, bench->cpu_percent);
+    } else {
+        vpilog("Decoder %s: no usable output\n", s->backends[s->backend].name);
+    }
+
+    vpi_decode_close(s);
+
+    if (vpi_decode_open_next(s, s->backend + 1) == -1) {
+        s->benchmarking = 0;
+
+        int best = vpi_decoder_bench_pick(s->bench, s->backend_count);
+        if (best == -1) {
+            vpilog("No decoder produced frames during benchmark\n");
+            best = 0;
+        } else {
+            // Remember the winner so later sessions skip the benchmark
+            vpilog("Selected decoder: %s\n", s->backends[best].name);
+            if (!atomic_load(&vpi_decode_chosen_backend_ready)) {
+                vui_strncpy(vpi_decode_chosen_backend, s->backends[best].name, sizeof(vpi_decode_chosen_backend));
+                atomic_store(&vpi_decode_chosen_backend_ready, 1);
+            }
+        }
+
+        vpi_decode_open_next(s, best);
+    }
+
+    // New decoder can't start until the next keyframe
+    vanilla_request_idr();
+}
+
+static void vpi_decode_set_degrade_level(vpi_decode_state_t *s, int level)
+{
+    AVCodecContext *c = s->codec_ctx;
+
+    if (level >= VPI_DEGRADE_SKIP_LOOP_FILTER) {
+        c->skip_loop_filter = AVDISCARD_ALL;
+    } else if (level >= VPI_DEGRADE_SKIP_NONREF_LOOP_FILTER) {
+        c->skip_loop_filter = AVDISCARD_NONREF;
+    } else {
+        c->skip_loop_filter = AVDISCARD_DEFAULT;
+    }
+
+    if (level >= VPI_DEGRADE_FAST) {
+        c->flags2 |= AV_CODEC_FLAG2_FAST;
+    } else {
+        c->flags2 &= ~AV_CODEC_FLAG2_FAST;
+    }
+
+    if (level != s->degrade_level) {
+        vpilog("Decoder %s, now using: %s\n", level > s->degrade_level ? "falling behind" : "has headroom", vpi_degrade_names[level]);
+        atomic_fetch_add(&vpi_decode_degrade_transitions, 1);
+    }
+
+    s->degrade_level = level;
+    atomic_store(&vpi_decode_degrade_level, level);
+}
+
+static void vpi_decode_track_time(vpi_decode_state_t *s, int64_t decode_us)
+{
+    // Only software decoding competes with everything else for the CPU
+    if (s->benchmarking || s->backends[s->backend].type != VPI_DECODER_SOFTWARE) {
+        return;
+    }
+
+    s->degrade_frames++;
+    s->degrade_time_sum += decode_us;
+    if (decode_us > VPI_DECODE_BUDGET_US) {
+        s->degrade_overruns++;
+    }
+
+    if (s->degrade_frames < VPI_DECODE_WINDOW) {
+        return;
+    }
+
+    int64_t average = s->degrade_time_sum / s->degrade_frames;
+
+    if (s->degrade_overruns >= VPI_DECODE_WINDOW / 2 || average > VPI_DECODE_BUDGET_US * 9 / 10) {
+        // Sustained overrun, trade some quality to keep up
+        s->degrade_headroom_windows = 0;
+        if (s->degrade_level < VPI_DEGRADE_COUNT - 1) {
+            vpi_decode_set_degrade_level(s, s->degrade_level + 1);
+        }
+    } else if (average < VPI_DECODE_BUDGET_US / 2) {
+        // Wait for a few quiet windows in a row so we don't bounce between levels
+        s->degrade_headroom_windows++;
+        if (s->degrade_headroom_windows >= VPI_DECODE_HEADROOM_WINDOWS && s->degrade_level > VPI_DEGRADE_NONE) {
+            s->degrade_headroom_windows = 0;
+            vpi_decode_set_degrade_level(s, s->degrade_level - 1);
+        }
+    } else {
+        s->degrade_headroom_windows = 0;
+    }
+
+    s->degrade_frames = 0;
+    s->degrade_overruns = 0;
+    s->degrade_time_sum = 0;
+}
+
+void vpi_decode_get_degrade_stats(int *level, uint64_t *transitions)
+{
+    if (level) *level = atomic_load(&vpi_decode_degrade_level);
+    if (transitions) *transitions = atomic_load(&vpi_decode_degrade_transitions);
+}
+
+void vpi_decode_get_time_stats(uint64_t *frames, uint64_t *histogram)
+{
+    if (frames) *frames = atomic_load_explicit(&vpi_decode_count_frames, memory_order_relaxed);
+    if (histogram) {
+        for (int i = 0; i < VPI_DECODE_HIST_BUCKETS; i++) {
+            histogram[i] = atomic_load_explicit(&vpi_decode_time_hist[i], memory_order_relaxed);
+        }
+    }
+}
+
+int vpi_decode_init(vpi_decode_state_t *s)
+{
+    s->backend_count = vpi_decoder_enumerate(s->backends, VPI_DECODER_MAX_BACKENDS);
+    s->benchmarking = 0;
+
+    // Use the cached winner unless a new benchmark was asked for
+    int index = -1;
+    if (!vpi_decoder_take_benchmark_request() && vpi_config.decoder[0]) {
+        index = vpi_decoder_find(s->backends, s->backend_count, vpi_config.decoder);
+        if (index == -1) {
+            vpilog("Configured decoder %s is no longer available\n", vpi_config.decoder);
+        }
+    }
+
+    if (index == -1) {
+        if (s->backend_count > 1) {
+            vpilog("Benchmarking %i decoders\n", s->backend_count);
+            s->benchmarking = 1;
+        }
+        index = 0;
+    }
+
+	if (vpi_decode_open_next(s, index) == -1) {
+		vpilog("No decoder was available\n");
         return VANILLA_ERR_GENERIC;
 	}
 
@@ -285,10 +710,31 @@ int vpi_decode_init(vpi_decode_state_t *s)
         return VANILLA_ERR_GENERIC;
     }
 
-	vpi_present_frame = av_frame_alloc();
-	if (!vpi_present_frame) {
-		vpilog("Failed to allocate AVFrame\n");
-		return VANILLA_ERR_GENERIC;
+	// Slots are never freed, since the renderer may still be looking at them
+	for (int i = 0; i < 3; i++) {
+		if (!vpi_present_slots[i]) {
+			vpi_present_slots[i] = av_frame_alloc();
+			if (!vpi_present_slots[i]) {
+				vpilog("Failed to allocate AVFrame\n");
+				return VANILLA_ERR_GENERIC;
+			}
+		}
+	}
+	if (!vpi_present_queue_out) {
+		vpi_present_queue_out = av_frame_alloc();
+		if (!vpi_present_queue_out) {
+			vpilog("Failed to allocate AVFrame\n");
+			return VANILLA_ERR_GENERIC;
+		}
+	}
+	for (int i = 0; i < VPI_PRESENT_QUEUE_SIZE; i++) {
+		if (!vpi_present_queue[i]) {
+			vpi_present_queue[i] = av_frame_alloc();
+			if (!vpi_present_queue[i]) {
+				vpilog("Failed to allocate AVFrame\n");
+				return VANILLA_ERR_GENERIC;
+			}
+		}
 	}
 
 	s->pkt = av_packet_alloc();
@@ -312,14 +758,15 @@ void vpi_decode_exit(vpi_decode_state_t *s)
     if (s->pkt)
 	    av_packet_free(&s->pkt);
 
-    if (vpi_present_frame)
-	    av_frame_free(&vpi_present_frame);
+    if (vpi_present_slots[vpi_present_write_idx])
+        av_frame_unref(vpi_present_slots[vpi_present_write_idx]);
 
-    if (s->codec_ctx)
-        avcodec_free_context(&s->codec_ctx);
+    vpi_decode_close(s);
 
-	if (s->hw_device_ctx)
-		av_buffer_unref(&s->hw_device_ctx);
+	pthread_mutex_lock(&vpi_frame_pool_mutex);
+	av_buffer_pool_uninit(&s->frame_pool);
+	s->frame_pool_size = 0;
+	pthread_mutex_unlock(&vpi_frame_pool_mutex);
 }
 
 int64_t get_recording_timestamp(AVRational timebase)
@@ -331,6 +778,142 @@ int64_t get_recording_timestamp(AVRational timebase)
     return av_rescale_q(us, (AVRational) {1, 1000000}, timebase);
 }
 
+static int vpi_h264_is_keyframe(const uint8_t *data, int size)
+{
+    // Find the first slice and check whether it's IDR
+    for (int i = 0; i + 3 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            int type = data[i + 3] & 0x1F;
+            if (type == 1 || type == 5) {
+                return type == 5;
+            }
+            i += 2;
+        }
+    }
+    return 0;
+}
+
+static void vpi_replay_push(const uint8_t *data, int size, int stream_index)
+{
+    if (!vpi_replay.slab) {
+        return;
+    }
+
+    int key = (stream_index == VIDEO_STREAM_INDEX) && vpi_h264_is_keyframe(data, size);
+    int64_t now = av_gettime_relative();
+    int request_idr = 0;
+
+    pthread_mutex_lock(&vpi_replay_mutex);
+
+    if (key) {
+        vpi_replay_last_key_time = now;
+    } else if (stream_index == VIDEO_STREAM_INDEX
+               && now - vpi_replay_last_key_time > VPI_REPLAY_IDR_INTERVAL_US
+               && now - vpi_replay_idr_request_time > 1000000) {
+        // Keep a recent keyframe around, at most one request a second until it arrives
+        vpi_replay_idr_request_time = now;
+        request_idr = 1;
+    }
+
+    vpi_replay_ring_push(&vpi_replay, data, size, stream_index, key, now);
+
+    pthread_mutex_unlock(&vpi_replay_mutex);
+
+    if (request_idr) {
+        vanilla_request_idr();
+    }
+}
+
+// Queues a reference to `pkt` for the writer thread, timestamped now. Never
+// blocks: if the writer has fallen behind, the packet is dropped.
+static void vpi_record_queue_push(const AVPacket *pkt, int stream_index)
+{
+    if (!atomic_load(&vpi_record_queue_active)) {
+        return;
+    }
+
+    int key = (stream_index == VIDEO_STREAM_INDEX) && vpi_h264_is_keyframe(pkt->data, pkt->size);
+
+    pthread_mutex_lock(&vpi_record_queue_mutex);
+
+    if (!atomic_load(&vpi_record_queue_active)) {
+        goto unlock;
+    }
+
+    if (vpi_record_resync && stream_index == VIDEO_STREAM_INDEX) {
+        if (!key) {
+            atomic_fetch_add(&vpi_record_dropped, 1);
+            goto unlock;
+        }
+        vpi_record_resync = 0;
+        vpilog("Recording resumed at keyframe\n");
+    }
+
+    if (vpi_record_queue_write - vpi_record_queue_read == VPI_RECORD_QUEUE_SIZE) {
+        // Skip ahead to the next keyframe so the file stays decodable
+        if (!vpi_record_resync) {
+            vpilog("Recording writer fell behind, dropping video until the next keyframe\n");
+            vpi_record_resync = 1;
+            vanilla_request_idr();
+        }
+        atomic_fetch_add(&vpi_record_dropped, 1);
+        goto unlock;
+    }
+
+    AVPacket *slot = vpi_record_queue[vpi_record_queue_write % VPI_RECORD_QUEUE_SIZE];
+    if (av_packet_ref(slot, pkt) < 0) {
+        goto unlock;
+    }
+
+    AVStream *stream = (stream_index == VIDEO_STREAM_INDEX) ? recording_vstr : recording_astr;
+    int64_t ts = get_recording_timestamp(stream->time_base);
+    slot->stream_index = stream_index;
+    slot->dts = ts;
+    slot->pts = ts;
+    if (key) {
+        slot->flags |= AV_PKT_FLAG_KEY;
+    }
+
+    vpi_record_queue_write++;
+    atomic_store(&vpi_record_backlog, vpi_record_queue_write - vpi_record_queue_read);
+    pthread_cond_signal(&vpi_record_queue_cond);
+
+unlock:
+    pthread_mutex_unlock(&vpi_record_queue_mutex);
+}
+
+static void *vpi_record_loop(void *arg)
+{
+    pthread_mutex_lock(&vpi_record_queue_mutex);
+    while (1) {
+        while (atomic_load(&vpi_record_queue_active) && vpi_record_queue_read == vpi_record_queue_write) {
+            pthread_cond_wait(&vpi_record_queue_cond, &vpi_record_queue_mutex);
+        }
+
+        // Keep going after a stop until everything queued is written
+        if (vpi_record_queue_read == vpi_record_queue_write) {
+            break;
+        }
+
+        av_packet_move_ref(vpi_record_out, vpi_record_queue[vpi_record_queue_read % VPI_RECORD_QUEUE_SIZE]);
+        vpi_record_queue_read++;
+        atomic_store(&vpi_record_backlog, vpi_record_queue_write - vpi_record_queue_read);
+
+        pthread_mutex_unlock(&vpi_record_queue_mutex);
+        av_interleaved_write_frame(recording_fmt_ctx, vpi_record_out);
+        pthread_mutex_lock(&vpi_record_queue_mutex);
+    }
+    pthread_mutex_unlock(&vpi_record_queue_mutex);
+
+    return NULL;
+}
+
+void vpi_decode_get_record_stats(size_t *backlog, uint64_t *dropped)
+{
+    if (backlog) *backlog = atomic_load(&vpi_record_backlog);
+    if (dropped) *dropped = atomic_load(&vpi_record_dropped);
+}
+
 int dump_frame_to_file(const AVFrame *frame, const char *filename)
 {
 	AVFormatContext *ofmt;
@@ -521,6 +1104,88 @@ exit:
 	return ret;
 }
 
+static void *vpi_screenshot_loop(void *arg)
+{
+#ifdef __linux__
+    // Encoding can take its time, it shouldn't compete with decoding or rendering
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+#endif
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame) {
+        vpilog("Failed to allocate AVFrame for screenshots\n");
+        return NULL;
+    }
+
+    char filename[sizeof(vpi_screenshot_filename)];
+
+    pthread_mutex_lock(&vpi_screenshot_mutex);
+    while (1) {
+        while (vpi_screenshot_active && !vpi_screenshot_pending) {
+            pthread_cond_wait(&vpi_screenshot_cond, &vpi_screenshot_mutex);
+        }
+
+        // Finish a screenshot that was already taken before stopping
+        if (!vpi_screenshot_pending) {
+            break;
+        }
+
+        av_frame_move_ref(frame, vpi_screenshot_frame);
+        vui_strncpy(filename, vpi_screenshot_filename, sizeof(filename));
+        vpi_screenshot_pending = 0;
+        pthread_mutex_unlock(&vpi_screenshot_mutex);
+
+        dump_frame_to_file(frame, filename);
+        av_frame_unref(frame);
+
+        pthread_mutex_lock(&vpi_screenshot_mutex);
+    }
+    pthread_mutex_unlock(&vpi_screenshot_mutex);
+
+    av_frame_free(&frame);
+
+    return NULL;
+}
+
+static void vpi_screenshot_start()
+{
+    if (!vpi_screenshot_frame) {
+        vpi_screenshot_frame = av_frame_alloc();
+    }
+
+    vpi_screenshot_pending = 0;
+    vpi_screenshot_active = 1;
+    pthread_create(&vpi_screenshot_thread, 0, vpi_screenshot_loop, NULL);
+}
+
+static void vpi_screenshot_stop()
+{
+    pthread_mutex_lock(&vpi_screenshot_mutex);
+    vpi_screenshot_active = 0;
+    pthread_cond_signal(&vpi_screenshot_cond);
+    pthread_mutex_unlock(&vpi_screenshot_mutex);
+
+    pthread_join(vpi_screenshot_thread, 0);
+}
+
+static void vpi_screenshot_request(const AVFrame *frame, const char *filename)
+{
+    pthread_mutex_lock(&vpi_screenshot_mutex);
+    if (vpi_screenshot_frame) {
+        if (vpi_screenshot_pending) {
+            vpilog("Screenshot worker is busy, replacing pending screenshot\n");
+        }
+
+        av_frame_unref(vpi_screenshot_frame);
+        if (av_frame_ref(vpi_screenshot_frame, frame) >= 0) {
+            vui_strncpy(vpi_screenshot_filename, filename, sizeof(vpi_screenshot_filename));
+            vpi_screenshot_pending = 1;
+            pthread_cond_signal(&vpi_screenshot_cond);
+        }
+    }
+    pthread_mutex_unlock(&vpi_screenshot_mutex);
+}
+
 void vpi_game_shutdown()
 {
     vpi_game_queued_error = VANILLA_ERR_SHUTDOWN;
@@ -528,97 +1193,219 @@ void vpi_game_shutdown()
 
 static pthread_t vpi_event_thread;
 
-void *vpi_event_loop(void *arg)
+// Video events are decoded on their own thread so a slow decode can't hold up
+// audio, vibration or error events behind it
+#define VPI_VIDEO_QUEUE_SIZE 16
+static vanilla_event_t vpi_video_queue[VPI_VIDEO_QUEUE_SIZE];
+static size_t vpi_video_queue_read = 0;
+static size_t vpi_video_queue_write = 0;
+static int vpi_video_queue_active = 0;
+static pthread_mutex_t vpi_video_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_video_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t vpi_video_thread;
+
+static void vpi_video_queue_push(vanilla_event_t *event)
 {
-    vui_context_t *vui = (vui_context_t *) arg;
-    static int vpi_decode_alloc = 0;
+    int dropped = 0;
 
-    static vpi_decode_state_t s;
-    vanilla_event_t event;
-    while (vpi_game_queued_error == VANILLA_SUCCESS && vanilla_wait_event(&event)) {
-        int stop = 0;
+    pthread_mutex_lock(&vpi_video_queue_mutex);
 
-        switch (event.type) {
-        case VANILLA_EVENT_VIDEO:
-            if (!vpi_decode_alloc) {
-                int ret = vpi_decode_init(&s);
-                if (ret >= 0) {
-                    vpi_decode_alloc = 1;
-                }
-            }
+    if (vpi_video_queue_write - vpi_video_queue_read == VPI_VIDEO_QUEUE_SIZE) {
+        // Decoder has fallen too far behind, drop the oldest packet
+        vanilla_free_event(&vpi_video_queue[vpi_video_queue_read % VPI_VIDEO_QUEUE_SIZE]);
+        vpi_video_queue_read++;
+        dropped = 1;
+    }
+
+    // Queue takes ownership of the event data
+    vpi_video_queue[vpi_video_queue_write % VPI_VIDEO_QUEUE_SIZE] = *event;
+    vpi_video_queue_write++;
+    event->data = NULL;
+
+    pthread_cond_signal(&vpi_video_queue_cond);
+    pthread_mutex_unlock(&vpi_video_queue_mutex);
 
-            if (vpi_decode_alloc) {
-                AVPacket *pkt = s.pkt;
+    if (dropped) {
+        vpilog("Video decode queue full, dropped a packet\n");
 
-                // Send packet to decoder
-                pkt->data = event.data;
-                pkt->size = event.size;
+        // The stream is broken after a dropped packet, so ask for a fresh one
+        vanilla_request_idr();
+    }
+}
 
-                if (recording_fmt_ctx) {
-                    pkt->stream_index = VIDEO_STREAM_INDEX;
+static int vpi_video_queue_pop(vanilla_event_t *event)
+{
+    int ret = 0;
 
-                    int64_t ts = get_recording_timestamp(recording_vstr->time_base);
+    pthread_mutex_lock(&vpi_video_queue_mutex);
 
-                    pkt->dts = ts;
-                    pkt->pts = ts;
+    while (vpi_video_queue_active && vpi_video_queue_read == vpi_video_queue_write) {
+        pthread_cond_wait(&vpi_video_queue_cond, &vpi_video_queue_mutex);
+    }
 
-                    av_interleaved_write_frame(recording_fmt_ctx, pkt);
+    if (vpi_video_queue_active) {
+        *event = vpi_video_queue[vpi_video_queue_read % VPI_VIDEO_QUEUE_SIZE];
+        vpi_video_queue[vpi_video_queue_read % VPI_VIDEO_QUEUE_SIZE].data = NULL;
+        vpi_video_queue_read++;
+        ret = 1;
+    }
 
-                    // av_interleaved_write_frame() eventually calls av_packet_unref(),
-                    // so we must put the references back in
-                    pkt->data = event.data;
-                    pkt->size = event.size;
-                }
+    pthread_mutex_unlock(&vpi_video_queue_mutex);
+
+    return ret;
+}
+
+static void vpi_video_queue_stop()
+{
+    pthread_mutex_lock(&vpi_video_queue_mutex);
+    vpi_video_queue_active = 0;
+    pthread_cond_broadcast(&vpi_video_queue_cond);
+    pthread_mutex_unlock(&vpi_video_queue_mutex);
+
+    pthread_join(vpi_video_thread, 0);
+
+    // Return anything the decoder didn't get to
+    while (vpi_video_queue_read != vpi_video_queue_write) {
+        vanilla_free_event(&vpi_video_queue[vpi_video_queue_read % VPI_VIDEO_QUEUE_SIZE]);
+        vpi_video_queue_read++;
+    }
+}
+
+static void vpi_decode_video_event(vui_context_t *vui, vpi_decode_state_t *s, vanilla_event_t *event)
+{
+    AVPacket *pkt = s->pkt;
+
+    if (!s->codec_ctx) {
+        return;
+    }
+
+    // Wrap the event buffer so the decoder and muxer can reference it
+    // without copying. libvanilla gets it back once the last ref is gone.
+    pkt->buf = av_buffer_create(event->data, event->size + VANILLA_EVENT_BUFFER_PADDING, vpi_release_event_buffer, NULL, 0);
+    if (!pkt->buf) {
+        vpilog("Failed to wrap video event in AVBuffer\n");
+        return;
+    }
+    pkt->data = event->data;
+    pkt->size = event->size;
+    event->data = NULL;
+
+    vpi_record_queue_push(pkt, VIDEO_STREAM_INDEX);
+    vpi_replay_push(pkt->data, pkt->size, VIDEO_STREAM_INDEX);
 
-                int err = avcodec_send_packet(s.codec_ctx, pkt);
-
-                if (err < 0) {
-                    vpilog("Failed to send packet to decoder: %s (%i)\n", av_err2str(err), err);
-                    // return 0;
-
-                    vanilla_request_idr();
-                } else {
-                    int err;
-
-                    int ret = 1;
-
-                    // Retrieve frame from decoder
-                    while (1) {
-                        err = avcodec_receive_frame(s.codec_ctx, s.frame);
-                        if (err == AVERROR(EAGAIN)) {
-                            // Decoder wants another packet before it can output a frame. Silently exit.
-                            break;
-                        } else if (err < 0) {
-                            vpilog("Failed to receive frame from decoder: %i\n", err);
-                            ret = 0;
-                            break;
-                        } else {
-                            pthread_mutex_lock(&vpi_present_frame_mutex);
-
-                            // Swap refs from decoding_frame to present_frame
-                            av_frame_unref(vpi_present_frame);
-                            av_frame_move_ref(vpi_present_frame, s.frame);
-                            vpi_present_frame->pts = s.frame->pts;
-
-                            if (screenshot_buf[0] != 0) {
-                                // Dump this frame into file
-                                dump_frame_to_file(vpi_present_frame, screenshot_buf);
-                                screenshot_buf[0] = 0;
-                            }
-
-                            pthread_mutex_unlock(&vpi_present_frame_mutex);
-
-                            // Not thread safe?
-                            if (!vui_game_mode_get(vui)) {
-                                vui_game_mode_set(vui, 1);
-                                vui_audio_set_enabled(vui, 1);
-                            }
-                        }
+    // Decoders carry pts through to the frame, which lets us time each one
+    pkt->pts = av_gettime_relative();
+
+    int err = avcodec_send_packet(s->codec_ctx, pkt);
+    av_packet_unref(pkt);
+
+    int bench_done = s->benchmarking && vpi_decoder_bench_packet(&s->bench[s->backend], err < 0);
+
+    if (err < 0) {
+        vpilog("Failed to send packet to decoder: %s (%i)\n", av_err2str(err), err);
+        // return 0;
+
+        vanilla_request_idr();
+    } else {
+        int err;
+
+        int ret = 1;
+
+        // Retrieve frame from decoder
+        while (1) {
+            err = avcodec_receive_frame(s->codec_ctx, s->frame);
+            if (err == AVERROR(EAGAIN)) {
+                // Decoder wants another packet before it can output a frame. Silently exit.
+                break;
+            } else if (err < 0) {
+                vpilog("Failed to receive frame from decoder: %i\n", err);
+                ret = 0;
+                break;
+            } else {
+                atomic_fetch_add_explicit(&vpi_decode_count_frames, 1, memory_order_relaxed);
+
+                if (s->frame->pts != AV_NOPTS_VALUE) {
+                    int64_t decode_us = av_gettime_relative() - s->frame->pts;
+
+                    int64_t bucket = decode_us / VPI_DECODE_HIST_BUCKET_US;
+                    if (bucket >= VPI_DECODE_HIST_BUCKETS) bucket = VPI_DECODE_HIST_BUCKETS - 1;
+                    if (bucket < 0) bucket = 0;
+                    atomic_fetch_add_explicit(&vpi_decode_time_hist[bucket], 1, memory_order_relaxed);
+
+                    if (s->benchmarking) {
+                        bench_done |= vpi_decoder_bench_frame(&s->bench[s->backend], decode_us);
                     }
+                    vpi_decode_track_time(s, decode_us);
+                }
+
+                if (screenshot_buf[0] != 0) {
+                    // Worker takes it from here, all we pay for is a reference
+                    vpi_screenshot_request(s->frame, screenshot_buf);
+                    screenshot_buf[0] = 0;
+                }
+
+                vpi_present_frame_publish(s->frame);
 
-                    // return ret;
+                // Not thread safe?
+                if (!vui_game_mode_get(vui)) {
+                    vui_game_mode_set(vui, 1);
+                    vui_audio_set_enabled(vui, 1);
                 }
             }
+        }
+
+        // return ret;
+    }
+
+    if (bench_done) {
+        vpi_decode_bench_next(s);
+    }
+}
+
+void *vpi_video_loop(void *arg)
+{
+    vui_context_t *vui = (vui_context_t *) arg;
+    int vpi_decode_alloc = 0;
+
+    static vpi_decode_state_t s;
+    vanilla_event_t event;
+    while (vpi_video_queue_pop(&event)) {
+        if (!vpi_decode_alloc) {
+            int ret = vpi_decode_init(&s);
+            if (ret >= 0) {
+                vpi_decode_alloc = 1;
+            }
+        }
+
+        if (vpi_decode_alloc) {
+            vpi_decode_video_event(vui, &s, &event);
+        }
+
+        vanilla_free_event(&event);
+    }
+
+    if (vpi_decode_alloc) {
+        vpi_decode_exit(&s);
+    }
+
+    return NULL;
+}
+
+void *vpi_event_loop(void *arg)
+{
+    vui_context_t *vui = (vui_context_t *) arg;
+
+    vpi_video_queue_read = vpi_video_queue_write = 0;
+    vpi_video_queue_active = 1;
+    vpi_replay_start();
+    pthread_create(&vpi_video_thread, 0, vpi_video_loop, vui);
+    vpi_screenshot_start();
+
+    vanilla_event_t event;
+    while (vpi_game_queued_error == VANILLA_SUCCESS && vanilla_wait_event(&event)) {
+        switch (event.type) {
+        case VANILLA_EVENT_VIDEO:
+            vpi_video_queue_push(&event);
             break;
         case VANILLA_EVENT_AUDIO:
             vui_audio_push(vui, event.data, event.size);
@@ -626,7 +1413,7 @@ void *vpi_event_loop(void *arg)
             // We send audio to vpi_decode, but not actually for decoding since
             // the audio is already uncompressed. We send it in case vpi_decode
             // is recording, so the audio can be written to the file.
-            vpi_decode_send_audio(event.data, event.size);
+            vpi_decode_send_audio(&event);
             break;
         case VANILLA_EVENT_VIBRATE:
             vui_vibrate_set(vui, event.data[0]);
@@ -640,6 +1427,10 @@ void *vpi_event_loop(void *arg)
                 // Do nothing
                 break;
             case VANILLA_ERR_DISCONNECTED:
+                // Backend keeps everything up and re-associates on its own,
+                // so just let the user know and keep going
+                vpi_show_toast(lang(VPI_LANG_DISCONNECTED));
+                break;
             case VANILLA_ERR_SHUTDOWN:
                 vpi_game_queued_error = VANILLA_ERR_SHUTDOWN;
                 break;
@@ -656,17 +1447,25 @@ void *vpi_event_loop(void *arg)
 		vanilla_free_event(&event);
 	}
 
-    if (vpi_decode_alloc) {
-        vpi_decode_exit(&s);
-        vpi_decode_alloc = 0;
-    }
+    vpi_video_queue_stop();
+    vpi_screenshot_stop();
+    vpi_replay_stop();
 
     return NULL;
 }
 
+static void vpi_save_chosen_backend()
+{
+    if (atomic_exchange(&vpi_decode_chosen_backend_ready, 0)) {
+        vui_strncpy(vpi_config.decoder, vpi_decode_chosen_backend, sizeof(vpi_config.decoder));
+        vpi_config_save();
+    }
+}
+
 void vpi_display_update(vui_context_t *vui, int64_t time, void *v)
 {
     update_battery_information(vui, time);
+    vpi_save_chosen_backend();
 
     switch ((int)vpi_game_queued_error) {
     case VANILLA_SUCCESS:
@@ -682,6 +1481,7 @@ void vpi_display_update(vui_context_t *vui, int64_t time, void *v)
         // Something went wrong, assume we must fail and report to user
         pthread_join(vpi_event_thread, 0);
         vanilla_stop();
+        vpi_save_chosen_backend();
         if (vpi_game_queued_error != VANILLA_ERR_SHUTDOWN) {
             show_error(vui, (void*)(intptr_t) vpi_game_queued_error);
         } else {
@@ -762,25 +1562,36 @@ void vpi_get_toast(int *number, char *output, size_t output_size, struct timeval
     }
 }
 
-void vpi_decode_send_audio(const void *data, size_t size)
+void vpi_decode_send_audio(vanilla_event_t *event)
 {
-	if (recording_fmt_ctx) {
-        int ret;
+    // Only ever called from the event loop, so this packet is reused forever
+    static AVPacket *pkt = 0;
 
-		AVPacket *pkt = av_packet_alloc();
+    vpi_replay_push(event->data, event->size, AUDIO_STREAM_INDEX);
 
-		pkt->data = (uint8_t *) data;
-		pkt->size = size;
-
-		int64_t ts = get_recording_timestamp(recording_astr->time_base);
-        pkt->stream_index = AUDIO_STREAM_INDEX;
-        pkt->dts = ts;
-        pkt->pts = ts;
+    if (!atomic_load(&vpi_record_queue_active)) {
+        return;
+    }
 
-        av_interleaved_write_frame(recording_fmt_ctx, pkt);
+    if (!pkt) {
+        pkt = av_packet_alloc();
+        if (!pkt) {
+            return;
+        }
+    }
 
-        av_packet_free(&pkt);
+    // Hand the event buffer over to the writer instead of copying it
+    pkt->buf = av_buffer_create(event->data, event->size + VANILLA_EVENT_BUFFER_PADDING, vpi_release_event_buffer, NULL, 0);
+    if (!pkt->buf) {
+        return;
     }
+    pkt->data = event->data;
+    pkt->size = event->size;
+    event->data = NULL;
+
+    vpi_record_queue_push(pkt, AUDIO_STREAM_INDEX);
+
+    av_packet_unref(pkt);
 }
 
 int vpi_decode_is_recording()
@@ -788,65 +1599,269 @@ int vpi_decode_is_recording()
 	return (recording_fmt_ctx != 0);
 }
 
-int vpi_decode_record(const char *filename)
+// Creates an mp4 (or whatever `filename` implies) with the gamepad's video and
+// audio streams and writes its header
+static AVFormatContext *vpi_recording_open(const char *filename, AVStream **vstr, AVStream **astr)
 {
-    int r = avformat_alloc_output_context2(&recording_fmt_ctx, 0, 0, filename);
+    AVFormatContext *fmt_ctx = 0;
+
+    int r = avformat_alloc_output_context2(&fmt_ctx, 0, 0, filename);
     if (r < 0) {
 		vpilog("Failed to allocate output context for recording\n");
-        goto exit;
+        return 0;
     }
 
-	recording_vstr = avformat_new_stream(recording_fmt_ctx, 0);
-    if (!recording_vstr) {
+	*vstr = avformat_new_stream(fmt_ctx, 0);
+    if (!*vstr) {
 		vpilog("Failed to allocate video stream for recording\n");
         goto exit_and_free_context;
     }
 
-    recording_vstr->id = VIDEO_STREAM_INDEX;
-    recording_vstr->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    recording_vstr->codecpar->width = 854;
-    recording_vstr->codecpar->height = 480;
-    recording_vstr->codecpar->format = AV_PIX_FMT_YUV420P;
-    recording_vstr->time_base = (AVRational) {1, 60};
-    recording_vstr->codecpar->codec_id = AV_CODEC_ID_H264;
+    (*vstr)->id = VIDEO_STREAM_INDEX;
+    (*vstr)->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    (*vstr)->codecpar->width = 854;
+    (*vstr)->codecpar->height = 480;
+    (*vstr)->codecpar->format = AV_PIX_FMT_YUV420P;
+    (*vstr)->time_base = (AVRational) {1, 60};
+    (*vstr)->codecpar->codec_id = AV_CODEC_ID_H264;
 
-	recording_vstr->codecpar->extradata = av_malloc(200);
-	recording_vstr->codecpar->extradata_size = vanilla_generate_h264_header(recording_vstr->codecpar->extradata, 200);
+	(*vstr)->codecpar->extradata = av_malloc(200);
+	(*vstr)->codecpar->extradata_size = vanilla_generate_h264_header((*vstr)->codecpar->extradata, 200);
 
-    recording_astr = avformat_new_stream(recording_fmt_ctx, 0);
-    if (!recording_astr) {
+    *astr = avformat_new_stream(fmt_ctx, 0);
+    if (!*astr) {
 		vpilog("Failed to allocate audio stream for recording\n");
         goto exit_and_free_context;
     }
 
-    recording_astr->id = AUDIO_STREAM_INDEX;
-    recording_astr->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
-    recording_astr->codecpar->sample_rate = 48000;
+    (*astr)->id = AUDIO_STREAM_INDEX;
+    (*astr)->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+    (*astr)->codecpar->sample_rate = 48000;
 #if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57,24,100)
-    recording_astr->codecpar->ch_layout = (AVChannelLayout) AV_CHANNEL_LAYOUT_STEREO;
+    (*astr)->codecpar->ch_layout = (AVChannelLayout) AV_CHANNEL_LAYOUT_STEREO;
 #else
-    recording_astr->codecpar->channel_layout = AV_CH_LAYOUT_STEREO;
+    (*astr)->codecpar->channel_layout = AV_CH_LAYOUT_STEREO;
 #endif
-    recording_astr->codecpar->format = AV_SAMPLE_FMT_S16;
-    recording_astr->time_base = (AVRational) {1, 48000};
-    recording_astr->codecpar->codec_id = AV_CODEC_ID_PCM_S16LE;
+    (*astr)->codecpar->format = AV_SAMPLE_FMT_S16;
+    (*astr)->time_base = (AVRational) {1, 48000};
+    (*astr)->codecpar->codec_id = AV_CODEC_ID_PCM_S16LE;
 
-	r = avio_open2(&recording_fmt_ctx->pb, filename, AVIO_FLAG_WRITE, 0, 0);
+	r = avio_open2(&fmt_ctx->pb, filename, AVIO_FLAG_WRITE, 0, 0);
     if (r < 0) {
 		vpilog("Failed to open AVIO for recording\n");
         goto exit_and_free_context;
     }
 
-    r = avformat_write_header(recording_fmt_ctx, 0);
+    r = avformat_write_header(fmt_ctx, 0);
     if (r < 0) {
 		vpilog("Failed to write header for recording\n");
+        avio_closep(&fmt_ctx->pb);
         goto exit_and_free_context;
     }
 
-	vanilla_request_idr();
+    return fmt_ctx;
+
+exit_and_free_context:
+    avformat_free_context(fmt_ctx);
+    return 0;
+}
+
+static int vpi_recording_close(AVFormatContext *fmt_ctx)
+{
+    int r = av_write_trailer(fmt_ctx);
+    if (r < 0) {
+        vpilog("Failed to write trailer for recording\n");
+    }
+
+    avio_closep(&fmt_ctx->pb);
+
+    avformat_free_context(fmt_ctx);
+
+    return r;
+}
+
+static void *vpi_replay_save_loop(void *arg)
+{
+    int ret = VANILLA_ERR_GENERIC;
+    AVStream *vstr, *astr;
+
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt) {
+        vpilog("Failed to allocate AVPacket for replay\n");
+        goto exit;
+    }
+
+    // Everything from the first keyframe up to now, so the file starts decodable
+    pthread_mutex_lock(&vpi_replay_mutex);
+    size_t start = vpi_replay_ring_find_key(&vpi_replay, vpi_replay.head);
+    size_t end = vpi_replay.tail;
+    vpi_replay.pin = start;
+    pthread_mutex_unlock(&vpi_replay_mutex);
+
+    if (start == end) {
+        vpilog("No keyframe in replay buffer yet\n");
+        goto exit_and_unpin;
+    }
+
+    AVFormatContext *fmt_ctx = vpi_recording_open(vpi_replay_filename, &vstr, &astr);
+    if (!fmt_ctx) {
+        goto exit_and_unpin;
+    }
+
+    int64_t start_time = vpi_replay_ring_packet(&vpi_replay, start)->time;
+
+    for (size_t i = start; i != end; i++) {
+        // Pinned packets aren't touched by producers, so they can be read without the lock
+        vpi_replay_packet_t *p = vpi_replay_ring_packet(&vpi_replay, i);
+        AVStream *stream = (p->stream_index == VIDEO_STREAM_INDEX) ? vstr : astr;
+
+        pkt->data = vpi_replay.slab + p->offset;
+        pkt->size = p->size;
+        pkt->stream_index = p->stream_index;
+        pkt->flags = p->key ? AV_PKT_FLAG_KEY : 0;
+        pkt->pts = pkt->dts = av_rescale_q(p->time - start_time, (AVRational) {1, 1000000}, stream->time_base);
+
+        // Packets are already in order, so no interleaving (and no copying) is needed
+        av_write_frame(fmt_ctx, pkt);
+
+        // Give the space back as we go
+        pthread_mutex_lock(&vpi_replay_mutex);
+        vpi_replay.pin = i + 1;
+        pthread_mutex_unlock(&vpi_replay_mutex);
+    }
+
+    ret = vpi_recording_close(fmt_ctx);
+
+exit_and_unpin:
+    pthread_mutex_lock(&vpi_replay_mutex);
+    vpi_replay.pin = SIZE_MAX;
+    pthread_mutex_unlock(&vpi_replay_mutex);
+
+exit:
+    av_packet_free(&pkt);
+
+    char buf[VPI_TOAST_MAX_LEN];
+    if (ret >= 0) {
+        vpilog("Saved replay to \"%s\"\n", vpi_replay_filename);
+        snprintf(buf, sizeof(buf), lang(VPI_LANG_REPLAY_SAVED), vpi_replay_filename);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", lang(VPI_LANG_REPLAY_ERROR));
+    }
+    vpi_show_toast(buf);
+
+    pthread_mutex_lock(&vpi_replay_mutex);
+    vpi_replay_saving = 0;
+    pthread_cond_broadcast(&vpi_replay_saved_cond);
+    pthread_mutex_unlock(&vpi_replay_mutex);
+
+    return NULL;
+}
+
+static void vpi_replay_wait_for_save()
+{
+    pthread_mutex_lock(&vpi_replay_mutex);
+    while (vpi_replay_saving) {
+        pthread_cond_wait(&vpi_replay_saved_cond, &vpi_replay_mutex);
+    }
+    pthread_mutex_unlock(&vpi_replay_mutex);
+}
+
+static void vpi_replay_start()
+{
+    // Kept for the lifetime of the process, like the present slots
+    if (!vpi_replay.slab) {
+        if (vpi_replay_ring_init(&vpi_replay, VPI_REPLAY_SLAB_SIZE, VPI_REPLAY_MAX_PACKETS, VIDEO_STREAM_INDEX) != 0) {
+            vpilog("Failed to allocate replay buffer, instant replay is unavailable\n");
+            return;
+        }
+    }
+
+    vpi_replay_wait_for_save();
+
+    pthread_mutex_lock(&vpi_replay_mutex);
+    vpi_replay_ring_reset(&vpi_replay);
+    vpi_replay_last_key_time = 0;
+    vpi_replay_idr_request_time = 0;
+    pthread_mutex_unlock(&vpi_replay_mutex);
+}
+
+static void vpi_replay_stop()
+{
+    // Let a save in progress finish before the session goes away
+    vpi_replay_wait_for_save();
+}
+
+void vpi_decode_save_replay(const char *filename)
+{
+    if (!vpi_replay.slab) {
+        return;
+    }
+
+    pthread_mutex_lock(&vpi_replay_mutex);
+    int busy = vpi_replay_saving;
+    vpi_replay_saving = 1;
+    pthread_mutex_unlock(&vpi_replay_mutex);
+
+    if (busy) {
+        vpilog("Already saving a replay\n");
+        return;
+    }
+
+    vui_strncpy(vpi_replay_filename, filename, sizeof(vpi_replay_filename));
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, vpi_replay_save_loop, NULL) == 0) {
+        pthread_detach(thread);
+    } else {
+        pthread_mutex_lock(&vpi_replay_mutex);
+        vpi_replay_saving = 0;
+        pthread_cond_broadcast(&vpi_replay_saved_cond);
+        pthread_mutex_unlock(&vpi_replay_mutex);
+    }
+}
+
+int vpi_decode_record(const char *filename)
+{
+    int r = 0;
+
+    pthread_mutex_lock(&recording_mutex);
+
+    recording_fmt_ctx = vpi_recording_open(filename, &recording_vstr, &recording_astr);
+    if (!recording_fmt_ctx) {
+        r = VANILLA_ERR_GENERIC;
+        goto exit;
+    }
+
+    for (int i = 0; i < VPI_RECORD_QUEUE_SIZE; i++) {
+        if (!vpi_record_queue[i]) {
+            vpi_record_queue[i] = av_packet_alloc();
+            if (!vpi_record_queue[i]) {
+                vpilog("Failed to allocate AVPacket\n");
+                r = AVERROR(ENOMEM);
+                goto exit_and_close;
+            }
+        }
+    }
+    if (!vpi_record_out) {
+        vpi_record_out = av_packet_alloc();
+        if (!vpi_record_out) {
+            vpilog("Failed to allocate AVPacket\n");
+            r = AVERROR(ENOMEM);
+            goto exit_and_close;
+        }
+    }
 
 	gettimeofday(&recording_start, 0);
 
+    vpi_record_queue_read = vpi_record_queue_write = 0;
+    vpi_record_resync = 1; // The file has to start on a keyframe
+    atomic_store(&vpi_record_backlog, 0);
+    atomic_store(&vpi_record_dropped, 0);
+    atomic_store(&vpi_record_queue_active, 1);
+    pthread_create(&vpi_record_thread, 0, vpi_record_loop, NULL);
+
+	vanilla_request_idr();
+
 	char buf[VPI_TOAST_MAX_LEN];
 	snprintf(buf, sizeof(buf), lang(VPI_LANG_RECORDING_START), filename);
 	vpi_show_toast(buf);
@@ -854,30 +1869,39 @@ int vpi_decode_record(const char *filename)
 
     goto exit;
 
-exit_and_free_context:
-    avformat_free_context(recording_fmt_ctx);
+exit_and_close:
+    vpi_recording_close(recording_fmt_ctx);
     recording_fmt_ctx = 0;
 
 exit:
+    pthread_mutex_unlock(&recording_mutex);
 	return r;
 }
 
 void vpi_decode_record_stop()
 {
+    pthread_mutex_lock(&recording_mutex);
 	if (recording_fmt_ctx) {
-        int r = av_write_trailer(recording_fmt_ctx);
-		if (r < 0) {
-			vpilog("Failed to write trailer for recording\n");
-		}
+        // Writer drains whatever is still queued before it exits
+        pthread_mutex_lock(&vpi_record_queue_mutex);
+        atomic_store(&vpi_record_queue_active, 0);
+        pthread_cond_broadcast(&vpi_record_queue_cond);
+        pthread_mutex_unlock(&vpi_record_queue_mutex);
+
+        pthread_join(vpi_record_thread, 0);
 
-        avio_closep(&recording_fmt_ctx->pb);
+        uint64_t dropped = atomic_load(&vpi_record_dropped);
+        if (dropped) {
+            vpilog("Recording dropped %llu packets while the writer was behind\n", (unsigned long long) dropped);
+        }
 
-        avformat_free_context(recording_fmt_ctx);
+        vpi_recording_close(recording_fmt_ctx);
         recording_fmt_ctx = 0;
 
 		vpilog("Finished recording\n");
 		vpi_show_toast(lang(VPI_LANG_RECORDING_FINISH));
     }
+    pthread_mutex_unlock(&recording_mutex);
 }
 
 void vpi_decode_screenshot(const char *filename)
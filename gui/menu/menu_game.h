@@ -4,13 +4,36 @@
 #include <libavutil/frame.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <vanilla.h>
 
 #include "ui/ui.h"
 
 #define VPI_TOAST_MAX_LEN 1024
 
-extern AVFrame *vpi_present_frame;
-extern pthread_mutex_t vpi_present_frame_mutex;
+// Decode times are counted in buckets this wide, the last one also takes anything slower
+#define VPI_DECODE_HIST_BUCKET_US 500
+#define VPI_DECODE_HIST_BUCKETS 64
+
+/**
+ * Take the next decoded frame, or NULL if there hasn't been a new one since the last call
+ *
+ * By default this is the most recent frame. With a queue depth set, frames come out in order with
+ * at most `depth` frames of backlog. Only one thread (the renderer) may call this, and the frame's
+ * reference must be moved out before the next call. `decoded_time` receives av_gettime_relative()
+ * from when the frame was decoded.
+ */
+AVFrame *vpi_present_frame_acquire(int64_t *decoded_time);
+int vpi_present_frame_wait(int64_t timeout_us);
+void vpi_present_set_queue_depth(int depth);
+void vpi_present_get_stats(uint64_t *presented, uint64_t *skipped, uint64_t *repeated);
+void vpi_decode_get_degrade_stats(int *level, uint64_t *transitions);
+
+/**
+ * Get the number of frames decoded so far and a histogram of how long they took
+ *
+ * `histogram` receives VPI_DECODE_HIST_BUCKETS cumulative counts. Both can be NULL.
+ */
+void vpi_decode_get_time_stats(uint64_t *frames, uint64_t *histogram);
 
 void vpi_menu_game(vui_context_t *vui, void *v);
 
@@ -23,6 +46,8 @@ void vpi_decode_screenshot(const char *filename);
 int vpi_decode_is_recording();
 int vpi_decode_record(const char *filename);
 void vpi_decode_record_stop();
-void vpi_decode_send_audio(const void *data, size_t size);
+void vpi_decode_save_replay(const char *filename);
+void vpi_decode_send_audio(vanilla_event_t *event);
+void vpi_decode_get_record_stats(size_t *backlog, uint64_t *dropped);
 
 #endif // VANILLA_PI_MENU_GAME_H
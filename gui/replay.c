@@ -0,0 +1,187 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+int vpi_replay_ring_init(vpi_replay_ring_t *ring, size_t slab_size, size_t max_packets, int video_stream_index)
+{
+    ring->packets = malloc(max_packets * sizeof(vpi_replay_packet_t));
+    ring->slab = malloc(slab_size);
+    if (!ring->packets || !ring->slab) {
+        free(ring->packets);
+        free(ring->slab);
+        ring->packets = NULL;
+        ring->slab = NULL;
+        return -1;
+    }
+
+    ring->slab_size = slab_size;
+    ring->max_packets = max_packets;
+    ring->video_stream_index = video_stream_index;
+    ring->pin = SIZE_MAX;
+    vpi_replay_ring_reset(ring);
+
+    return 0;
+}
+
+void vpi_replay_ring_free(vpi_replay_ring_t *ring)
+{
+    free(ring->packets);
+    free(ring->slab);
+    ring->packets = NULL;
+    ring->slab = NULL;
+}
+
+void vpi_replay_ring_reset(vpi_replay_ring_t *ring)
+{
+    ring->head = ring->tail = 0;
+    ring->data_write = 0;
+    ring->next_key = SIZE_MAX;
+    ring->full_logged = 0;
+    ring->resync = 0;
+}
+
+size_t vpi_replay_ring_find_key(const vpi_replay_ring_t *ring, size_t index)
+{
+    for (; index < ring->tail; index++) {
+        const vpi_replay_packet_t *p = vpi_replay_ring_packet(ring, index);
+        if (p->stream_index == ring->video_stream_index && p->key) {
+            break;
+        }
+    }
+    return index;
+}
+
+static void replay_ring_update_next_key(vpi_replay_ring_t *ring)
+{
+    size_t i = vpi_replay_ring_find_key(ring, ring->head + 1);
+    ring->next_key = (i < ring->tail) ? i : SIZE_MAX;
+}
+
+static int replay_ring_evict_oldest(vpi_replay_ring_t *ring)
+{
+    if (ring->head == ring->tail || ring->head >= ring->pin) {
+        return 0;
+    }
+    ring->head++;
+    if (ring->head >= ring->next_key) {
+        replay_ring_update_next_key(ring);
+    }
+    return 1;
+}
+
+// Drops whole GOPs that are entirely older than VPI_REPLAY_SECONDS, so the
+// newest keyframe and everything after it always stay
+static void replay_ring_evict_aged(vpi_replay_ring_t *ring, int64_t now)
+{
+    const int64_t max_age = VPI_REPLAY_SECONDS * 1000000LL;
+
+    while (ring->head != ring->tail) {
+        size_t until;
+        if (ring->next_key != SIZE_MAX) {
+            // Only move up to the next keyframe once a replay from there would still be long enough
+            if (now - vpi_replay_ring_packet(ring, ring->next_key)->time < max_age) {
+                break;
+            }
+            until = ring->next_key;
+        } else {
+            // No keyframe to move up to. Keep the one we have, but anything before the first
+            // keyframe can't be decoded anyway so just let it age out.
+            const vpi_replay_packet_t *p = vpi_replay_ring_packet(ring, ring->head);
+            if ((p->stream_index == ring->video_stream_index && p->key) || now - p->time < max_age) {
+                break;
+            }
+            until = ring->head + 1;
+        }
+
+        while (ring->head < until && replay_ring_evict_oldest(ring)) {
+        }
+        if (ring->head < until) {
+            // Pinned by a save
+            break;
+        }
+    }
+}
+
+// Finds room for `size` contiguous bytes in the slab, evicting as needed
+static int replay_ring_reserve(vpi_replay_ring_t *ring, int size, size_t *offset, int64_t now)
+{
+    if ((size_t) size > ring->slab_size) {
+        return 0;
+    }
+
+    while (1) {
+        if (ring->head == ring->tail) {
+            ring->data_write = 0;
+        }
+
+        if (ring->tail - ring->head < ring->max_packets) {
+            if (ring->head == ring->tail) {
+                *offset = 0;
+                return 1;
+            }
+
+            size_t oldest = vpi_replay_ring_packet(ring, ring->head)->offset;
+            if (ring->data_write > oldest) {
+                // Data is contiguous, fit after it or wrap round to the start
+                if (ring->data_write + size <= ring->slab_size) {
+                    *offset = ring->data_write;
+                    return 1;
+                } else if ((size_t) size <= oldest) {
+                    *offset = 0;
+                    return 1;
+                }
+            } else if (ring->data_write + size <= oldest) {
+                *offset = ring->data_write;
+                return 1;
+            }
+        }
+
+        if (!ring->full_logged && ring->head != ring->tail
+            && now - vpi_replay_ring_packet(ring, ring->head)->time < VPI_REPLAY_SECONDS * 1000000LL) {
+            vpilog("Replay buffer is full, replays will be shorter than %i seconds\n", VPI_REPLAY_SECONDS);
+            ring->full_logged = 1;
+        }
+
+        if (!replay_ring_evict_oldest(ring)) {
+            return 0;
+        }
+    }
+}
+
+int vpi_replay_ring_push(vpi_replay_ring_t *ring, const uint8_t *data, int size, int stream_index, int key, int64_t now)
+{
+    if (ring->resync && stream_index == ring->video_stream_index) {
+        if (!key) {
+            return 0;
+        }
+        ring->resync = 0;
+    }
+
+    replay_ring_evict_aged(ring, now);
+
+    size_t offset;
+    if (!replay_ring_reserve(ring, size, &offset, now)) {
+        // Only happens while a save is holding on to the data, pick up again at the next keyframe
+        ring->resync = 1;
+        return 0;
+    }
+
+    memcpy(ring->slab + offset, data, size);
+    ring->data_write = offset + size;
+
+    vpi_replay_packet_t *p = vpi_replay_ring_packet(ring, ring->tail);
+    p->offset = offset;
+    p->size = size;
+    p->stream_index = stream_index;
+    p->key = key;
+    p->time = now;
+    if (key && ring->next_key == SIZE_MAX && ring->tail != ring->head) {
+        ring->next_key = ring->tail;
+    }
+    ring->tail++;
+
+    return 1;
+}
@@ -0,0 +1,64 @@
+#ifndef VANILLA_PI_REPLAY_H
+#define VANILLA_PI_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How much gameplay an instant replay covers
+#define VPI_REPLAY_SECONDS 30
+
+typedef struct {
+    size_t offset;
+    int size;
+    int stream_index;
+    int key;
+    int64_t time;
+} vpi_replay_packet_t;
+
+/**
+ * Instant replay ring: the last VPI_REPLAY_SECONDS of compressed video and audio, copied into one
+ * preallocated slab so nothing is allocated during play
+ *
+ * Packets are indexed in order and evicted oldest first, a whole GOP at a time so the oldest packet
+ * left is always a keyframe once there is one. While a replay is being saved, everything from `pin`
+ * onwards is left alone. The ring does no locking of its own.
+ */
+typedef struct {
+    uint8_t *slab;
+    size_t slab_size;
+    vpi_replay_packet_t *packets;
+    size_t max_packets;
+    int video_stream_index;
+
+    size_t head; // Oldest packet
+    size_t tail; // Next packet to be written
+    size_t data_write;
+    size_t pin;
+    size_t next_key; // First keyframe after the oldest packet
+    int full_logged;
+    int resync; // Out of room while saving, wait for a keyframe
+} vpi_replay_ring_t;
+
+int vpi_replay_ring_init(vpi_replay_ring_t *ring, size_t slab_size, size_t max_packets, int video_stream_index);
+void vpi_replay_ring_free(vpi_replay_ring_t *ring);
+
+// Drop everything, e.g. for a new session
+void vpi_replay_ring_reset(vpi_replay_ring_t *ring);
+
+/**
+ * Copy a packet in, evicting whatever is too old or in the way
+ *
+ * `key` marks video keyframes. Returns 0 if the packet was dropped, which only happens while a save
+ * has pinned the data; video is then dropped until the next keyframe.
+ */
+int vpi_replay_ring_push(vpi_replay_ring_t *ring, const uint8_t *data, int size, int stream_index, int key, int64_t now);
+
+// First keyframe at or after `index`, or `tail` if there isn't one
+size_t vpi_replay_ring_find_key(const vpi_replay_ring_t *ring, size_t index);
+
+static inline vpi_replay_packet_t *vpi_replay_ring_packet(const vpi_replay_ring_t *ring, size_t index)
+{
+    return &ring->packets[index % ring->max_packets];
+}
+
+#endif // VANILLA_PI_REPLAY_H
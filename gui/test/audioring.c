@@ -0,0 +1,306 @@
+/**
+ * Simulates the console's audio stream against the SDL audio callback to check that the jitter
+ * buffer refills after running dry or a stream restart, and that the resampler follows clock drift
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ui/ui_sdl_audio.h"
+
+// The console sends 384 frames every 8 ms, SDL asks for 256 frames at a time
+#define PACKET_FRAMES 384
+#define PACKET_US 8000.0
+#define CALLBACK_FRAMES 256
+#define CALLBACK_US (CALLBACK_FRAMES * 1000000.0 / VUI_SDL_AUDIO_RATE)
+
+#define TARGET_FRAMES 512
+
+typedef struct {
+    // Input
+    double drift;           // How much faster the console's clock runs than ours
+    int jitter_us;          // Random delay added to each packet
+    double stall_start_us;  // Packets sent in [start, end) only arrive at `end`
+    double stall_end_us;
+    int restart;            // The stream stops over [start, end) instead, nothing sent is delivered
+    double duration_us;
+    double settle_us;       // Rate and fill are only averaged after this
+
+    // Output
+    int silent_after_start; // Silent callbacks once playback had started
+    int discontinuities;    // Played samples that don't follow on from the previous one
+    double first_sound_us;
+    double resumed_us;      // First sound after the stall
+    size_t resumed_fill;
+    double avg_rate_ppm;
+    double avg_fill;
+    size_t target;
+    vui_sdl_audio_ring_t ring;
+} sim_t;
+
+static double deliver_time(const sim_t *sim, double sent)
+{
+    if (sent >= sim->stall_start_us && sent < sim->stall_end_us) {
+        return sim->stall_end_us;
+    }
+    return sent + (sim->jitter_us ? rand() % sim->jitter_us : 0);
+}
+
+static int simulate(sim_t *sim)
+{
+    vui_sdl_audio_ring_t *ring = &sim->ring;
+    if (vui_sdl_audio_ring_init(ring, TARGET_FRAMES) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+
+    uint32_t in[PACKET_FRAMES], out[CALLBACK_FRAMES];
+    int16_t sample = 0;
+    int direction = 1;
+    int16_t last_played = 0;
+    int playing = 0;
+
+    double packet_us = PACKET_US / (1 + sim->drift);
+    double sent = 0, next_arrival = deliver_time(sim, 0), callback = 0;
+    double rate_sum = 0, fill_sum = 0;
+    long samples = 0;
+
+    sim->silent_after_start = 0;
+    sim->discontinuities = 0;
+    sim->first_sound_us = -1;
+    sim->resumed_us = -1;
+    sim->resumed_fill = 0;
+
+    srand(1);
+
+    while (callback < sim->duration_us) {
+        if (next_arrival <= callback && sim->restart && sent >= sim->stall_start_us && sent < sim->stall_end_us) {
+            sent += packet_us;
+            next_arrival = deliver_time(sim, sent);
+            continue;
+        }
+
+        if (next_arrival <= callback) {
+            // A slow triangle wave, so anything dropped or repeated shows up as a jump
+            for (int i = 0; i < PACKET_FRAMES; i++) {
+                if (sample == 30000 || sample == -30000) {
+                    direction = -direction;
+                }
+                sample += direction;
+                in[i] = (uint16_t) sample | ((uint32_t) (uint16_t) sample << 16);
+            }
+            vui_sdl_audio_ring_write(ring, in, PACKET_FRAMES, (int64_t) next_arrival);
+
+            sent += packet_us;
+            double arrival = deliver_time(sim, sent);
+            next_arrival = arrival > next_arrival ? arrival : next_arrival;
+            continue;
+        }
+
+        int stalled = sim->stall_end_us > 0 && callback >= sim->stall_start_us;
+        if (vui_sdl_audio_ring_read(ring, out, CALLBACK_FRAMES)) {
+            if (sim->first_sound_us < 0) {
+                sim->first_sound_us = callback;
+            }
+            if (stalled && sim->resumed_us < 0 && callback >= sim->stall_end_us) {
+                sim->resumed_us = callback;
+                sim->resumed_fill = vui_sdl_audio_ring_fill(ring) + CALLBACK_FRAMES;
+            }
+
+            for (int i = 0; i < CALLBACK_FRAMES; i++) {
+                int16_t l = (int16_t) (out[i] & 0xFFFF);
+                int16_t r = (int16_t) (out[i] >> 16);
+                int d = l - last_played;
+                if (l != r || (playing && (d < -2 || d > 2))) {
+                    sim->discontinuities++;
+                }
+                last_played = l;
+                playing = 1;
+            }
+        } else if (sim->first_sound_us >= 0) {
+            sim->silent_after_start++;
+            playing = 0;
+        }
+
+        callback += CALLBACK_US;
+        if (callback > sim->settle_us) {
+            rate_sum += (int) ring->rate_ppm;
+            fill_sum += ring->fill_avg;
+            samples++;
+        }
+    }
+
+    sim->avg_rate_ppm = samples ? rate_sum / samples : 0;
+    sim->avg_fill = samples ? fill_sum / samples : 0;
+    sim->target = atomic_load(&ring->target_frames);
+
+    return 0;
+}
+
+static int check_drift(double drift, int jitter_us)
+{
+    sim_t sim = {0};
+    sim.drift = drift;
+    sim.jitter_us = jitter_us;
+    sim.duration_us = 300e6;
+    sim.settle_us = 120e6;
+
+    if (simulate(&sim)) {
+        return 1;
+    }
+
+    int ret = 0;
+    double drift_ppm = drift * 1e6;
+
+    // A few hundred ms of startup is spent filling up to target
+    if (sim.first_sound_us < 0 || sim.first_sound_us > 200e3) {
+        printf("FAIL (drift %+.0f ppm: first sound at %.0f us)\n", drift_ppm, sim.first_sound_us);
+        ret = 1;
+    } else if (sim.silent_after_start || sim.ring.underruns) {
+        printf("FAIL (drift %+.0f ppm: %d silent callbacks, %lu underruns)\n", drift_ppm,
+               sim.silent_after_start, (unsigned long) sim.ring.underruns);
+        ret = 1;
+    } else if (sim.ring.overrun_frames || sim.ring.skipped_frames) {
+        printf("FAIL (drift %+.0f ppm: %lu frames overrun, %lu skipped)\n", drift_ppm,
+               (unsigned long) sim.ring.overrun_frames, (unsigned long) sim.ring.skipped_frames);
+        ret = 1;
+    } else if (sim.discontinuities) {
+        printf("FAIL (drift %+.0f ppm: %d discontinuities)\n", drift_ppm, sim.discontinuities);
+        ret = 1;
+    } else if (fabs(sim.avg_rate_ppm - drift_ppm) > 50 + fabs(drift_ppm) / 20) {
+        printf("FAIL (drift %+.0f ppm: resampler settled at %+.0f ppm)\n", drift_ppm, sim.avg_rate_ppm);
+        ret = 1;
+    } else if (sim.avg_fill < sim.target * 0.9 || sim.avg_fill > sim.target * 1.1) {
+        printf("FAIL (drift %+.0f ppm: fill %.0f, target %zu)\n", drift_ppm, sim.avg_fill, sim.target);
+        ret = 1;
+    }
+
+    vui_sdl_audio_ring_free(&sim.ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int steady()
+{
+    return check_drift(0, 0);
+}
+
+int console_fast()
+{
+    return check_drift(300e-6, 0);
+}
+
+int console_slow_with_jitter()
+{
+    return check_drift(-3000e-6, 4000);
+}
+
+int underrun_refills()
+{
+    // Delivery stalls for 100 ms and then everything sent meanwhile arrives at once
+    sim_t sim = {0};
+    sim.stall_start_us = 10e6;
+    sim.stall_end_us = 10.1e6;
+    sim.duration_us = 30e6;
+    sim.settle_us = 20e6;
+
+    if (simulate(&sim)) {
+        return 1;
+    }
+
+    int ret = 0;
+    if (sim.ring.underruns != 1) {
+        printf("FAIL (expected 1 underrun, got %lu)\n", (unsigned long) sim.ring.underruns);
+        ret = 1;
+    } else if (sim.resumed_us < 0 || sim.resumed_us > sim.stall_end_us + 20e3) {
+        printf("FAIL (playback resumed at %.0f us)\n", sim.resumed_us);
+        ret = 1;
+    } else if (sim.resumed_fill < TARGET_FRAMES) {
+        // Resuming on a scrap of audio would underrun again on the next late packet
+        printf("FAIL (resumed with only %zu frames queued)\n", sim.resumed_fill);
+        ret = 1;
+    } else if (sim.avg_fill < sim.target * 0.9 || sim.avg_fill > sim.target * 1.1) {
+        printf("FAIL (fill %.0f didn't settle back on target %zu)\n", sim.avg_fill, sim.target);
+        ret = 1;
+    }
+
+    vui_sdl_audio_ring_free(&sim.ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int restart_rebuffers()
+{
+    // The console stops sending for 400 ms, e.g. while the stream is restarted
+    sim_t sim = {0};
+    sim.stall_start_us = 10e6;
+    sim.stall_end_us = 10.4e6;
+    sim.restart = 1;
+    sim.duration_us = 30e6;
+    sim.settle_us = 20e6;
+
+    if (simulate(&sim)) {
+        return 1;
+    }
+
+    int ret = 0;
+    if (sim.ring.underruns != 1) {
+        printf("FAIL (expected 1 underrun, got %lu)\n", (unsigned long) sim.ring.underruns);
+        ret = 1;
+    } else if (sim.resumed_fill < TARGET_FRAMES + PACKET_FRAMES) {
+        printf("FAIL (resumed with only %zu frames queued)\n", sim.resumed_fill);
+        ret = 1;
+    } else if (sim.resumed_us < 0 || sim.resumed_us > sim.stall_end_us + 50e3) {
+        printf("FAIL (playback resumed at %.0f us)\n", sim.resumed_us);
+        ret = 1;
+    } else if (sim.ring.jitter_us > 500) {
+        // The gap is a restart, not jitter, and mustn't inflate the target for the rest of the session
+        printf("FAIL (gap counted as %d us of jitter)\n", (int) sim.ring.jitter_us);
+        ret = 1;
+    } else if (sim.target != TARGET_FRAMES + PACKET_FRAMES) {
+        printf("FAIL (target %zu, expected %d)\n", sim.target, TARGET_FRAMES + PACKET_FRAMES);
+        ret = 1;
+    }
+
+    vui_sdl_audio_ring_free(&sim.ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int main()
+{
+    if (steady()) {
+        return 1;
+    }
+
+    if (console_fast()) {
+        return 1;
+    }
+
+    if (console_slow_with_jitter()) {
+        return 1;
+    }
+
+    if (underrun_refills()) {
+        return 1;
+    }
+
+    if (restart_rebuffers()) {
+        return 1;
+    }
+
+    return 0;
+}
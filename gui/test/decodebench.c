@@ -0,0 +1,141 @@
+/**
+ * Small unit test for the decoder benchmark's bookkeeping and for how it picks a winner
+ */
+
+#include <stdio.h>
+
+#include "decode_bench.h"
+
+static vpi_decoder_bench_t result(float latency_ms, float cpu_percent)
+{
+    vpi_decoder_bench_t b;
+    vpi_decoder_bench_start(&b);
+    b.latency_ms = latency_ms;
+    b.cpu_percent = cpu_percent;
+    return b;
+}
+
+static int expect_pick(const char *name, const vpi_decoder_bench_t *bench, int count, int expected)
+{
+    int best = vpi_decoder_bench_pick(bench, count);
+    if (best != expected) {
+        printf("FAIL (%s: picked %i, expected %i)\n", name, best, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int pick()
+{
+    vpi_decoder_bench_t none[] = {result(-1, 0), result(-1, 0)};
+    vpi_decoder_bench_t one[] = {result(-1, 0), result(30.0f, 90.0f), result(-1, 0)};
+    vpi_decoder_bench_t faster[] = {result(8.0f, 10.0f), result(3.0f, 80.0f)};
+    vpi_decoder_bench_t cheaper[] = {result(3.0f, 80.0f), result(3.8f, 10.0f)};
+    vpi_decoder_bench_t tie[] = {result(3.0f, 20.0f), result(3.0f, 20.0f)};
+    vpi_decoder_bench_t later[] = {result(-1, 0), result(9.0f, 50.0f), result(4.0f, 60.0f), result(4.5f, 15.0f)};
+
+    if (expect_pick("nothing worked", none, 2, -1)
+        || expect_pick("nothing to pick from", none, 0, -1)
+        || expect_pick("only one worked", one, 3, 1)
+        || expect_pick("clearly faster", faster, 2, 1)
+        || expect_pick("within tolerance, cheaper", cheaper, 2, 1)
+        || expect_pick("identical keeps the first", tie, 2, 0)
+        || expect_pick("best found after failures", later, 4, 3)) {
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+int give_up()
+{
+    vpi_decoder_bench_t b;
+
+    // A backend that never outputs a frame is abandoned after VPI_DECODER_BENCH_MAX_PACKETS
+    vpi_decoder_bench_start(&b);
+    for (int i = 1; i < VPI_DECODER_BENCH_MAX_PACKETS; i++) {
+        if (vpi_decoder_bench_packet(&b, 0)) {
+            printf("FAIL (gave up after %i packets)\n", i);
+            return 1;
+        }
+    }
+    if (!vpi_decoder_bench_packet(&b, 0)) {
+        printf("FAIL (kept going without any frames)\n");
+        return 1;
+    }
+
+    // Producing frames doesn't save a backend that keeps failing
+    vpi_decoder_bench_start(&b);
+    vpi_decoder_bench_frame(&b, 1000);
+    int gave_up = 0, packets = 0;
+    while (!gave_up && packets < VPI_DECODER_BENCH_MAX_PACKETS) {
+        gave_up = vpi_decoder_bench_packet(&b, 1);
+        packets++;
+    }
+    if (!gave_up || b.errors != VPI_DECODER_BENCH_MAX_PACKETS / 4 + 1) {
+        printf("FAIL (gave up after %i errors)\n", b.errors);
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+int measure()
+{
+    vpi_decoder_bench_t b;
+
+    // Nothing measured yet, so there's no result
+    vpi_decoder_bench_start(&b);
+    for (int i = 0; i < VPI_DECODER_BENCH_WARMUP; i++) {
+        vpi_decoder_bench_frame(&b, 50000);
+    }
+    vpi_decoder_bench_finish(&b);
+    if (b.latency_ms >= 0) {
+        printf("FAIL (result from warmup frames only)\n");
+        return 1;
+    }
+
+    // Slow warmup frames don't count towards the average
+    vpi_decoder_bench_start(&b);
+    int done = 0, frames = 0;
+    while (!done) {
+        done = vpi_decoder_bench_frame(&b, frames < VPI_DECODER_BENCH_WARMUP ? 50000 : 2000 + (frames % 2) * 1000);
+        frames++;
+    }
+    vpi_decoder_bench_finish(&b);
+
+    if (frames != VPI_DECODER_BENCH_WARMUP + VPI_DECODER_BENCH_FRAMES) {
+        printf("FAIL (finished after %i frames)\n", frames);
+        return 1;
+    }
+    if (b.latency_ms < 2.49f || b.latency_ms > 2.51f) {
+        printf("FAIL (average latency %.3f ms, expected 2.5)\n", b.latency_ms);
+        return 1;
+    }
+    if (b.cpu_percent < 0) {
+        printf("FAIL (negative CPU usage)\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+int main()
+{
+    if (pick()) {
+        return 1;
+    }
+
+    if (give_up()) {
+        return 1;
+    }
+
+    if (measure()) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * Small unit test for the plane layout of software decoded frames
+ */
+
+#include <stdio.h>
+
+#include "decode_frame.h"
+
+static int check(int width, int height)
+{
+    vpi_decoder_frame_layout_t l;
+    vpi_decoder_frame_layout(&l, width, height);
+
+    size_t chroma_stride = l.stride / 2;
+    size_t u_offset = l.luma_size;
+    size_t v_offset = u_offset + l.chroma_size;
+    size_t end = v_offset + l.chroma_size;
+
+    if (l.stride < width || l.height < height) {
+        printf("FAIL (%ix%i: %ix%i luma plane is too small)\n", width, height, l.stride, l.height);
+        return 1;
+    }
+
+    // The renderer only uploads in one go when chroma is exactly half of luma, which is also
+    // the pitch an IYUV texture `stride` wide expects
+    if (l.stride % 2 != 0 || chroma_stride * 2 != (size_t) l.stride) {
+        printf("FAIL (%ix%i: chroma stride %zu isn't half of %i)\n", width, height, chroma_stride, l.stride);
+        return 1;
+    }
+
+    // Every row of every plane starts aligned, given an aligned buffer
+    if (l.stride % VPI_FRAME_ALIGN != 0 || chroma_stride % VPI_FRAME_ALIGN != 0
+        || u_offset % VPI_FRAME_ALIGN != 0 || v_offset % VPI_FRAME_ALIGN != 0) {
+        printf("FAIL (%ix%i: planes aren't %i byte aligned)\n", width, height, VPI_FRAME_ALIGN);
+        return 1;
+    }
+
+    // Planes sit back to back without overlapping
+    if (l.luma_size != (size_t) l.stride * l.height || l.chroma_size != chroma_stride * (l.height / 2)
+        || l.height % 2 != 0) {
+        printf("FAIL (%ix%i: plane sizes don't match their strides)\n", width, height);
+        return 1;
+    }
+
+    // Decoders may read a little past the end of the last plane
+    if (l.size < end + 16) {
+        printf("FAIL (%ix%i: only %zu bytes of padding)\n", width, height, l.size - end);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main()
+{
+    // The console's own resolution, as aligned by the H.264 decoder
+    if (check(864, 480) || check(854, 480)) {
+        return 1;
+    }
+
+    for (int height = 1; height <= 270; height++) {
+        for (int width = 1; width <= 1000; width += 3) {
+            if (check(width, height)) {
+                return 1;
+            }
+        }
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
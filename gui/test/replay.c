@@ -0,0 +1,282 @@
+/**
+ * Feeds a simulated stream through the instant replay ring to check eviction, keyframe tracking,
+ * and that pinned data survives a save
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+#define VIDEO 0
+#define AUDIO 1
+
+#define SECOND 1000000LL
+
+void vpilog(const char *fmt, ...)
+{
+    // Expected when the slab is deliberately small, keep the output readable
+}
+
+static uint32_t next_seq = 0;
+
+static int push(vpi_replay_ring_t *ring, int stream_index, int key, int size, int64_t now)
+{
+    uint8_t data[4096];
+
+    // Every byte identifies the packet, so overlapping writes show up as corruption
+    uint32_t seq = next_seq++;
+    memset(data, seq & 0xFF, size);
+    memcpy(data, &seq, sizeof(seq));
+
+    return vpi_replay_ring_push(ring, data, size, stream_index, key, now);
+}
+
+static int check_ring(const vpi_replay_ring_t *ring, const char *test)
+{
+    if (ring->tail - ring->head > ring->max_packets) {
+        printf("FAIL (%s: %zu packets indexed, limit is %zu)\n", test, ring->tail - ring->head, ring->max_packets);
+        return 1;
+    }
+
+    int64_t last_seq = -1;
+    for (size_t i = ring->head; i < ring->tail; i++) {
+        const vpi_replay_packet_t *p = vpi_replay_ring_packet(ring, i);
+        if (p->offset + p->size > ring->slab_size) {
+            printf("FAIL (%s: packet %zu runs off the end of the slab)\n", test, i);
+            return 1;
+        }
+
+        const uint8_t *data = ring->slab + p->offset;
+        uint32_t seq;
+        memcpy(&seq, data, sizeof(seq));
+        for (int j = sizeof(seq); j < p->size; j++) {
+            if (data[j] != (seq & 0xFF)) {
+                printf("FAIL (%s: packet %zu was overwritten)\n", test, i);
+                return 1;
+            }
+        }
+        if ((int64_t) seq <= last_seq) {
+            printf("FAIL (%s: packet %zu is out of order)\n", test, i);
+            return 1;
+        }
+        last_seq = seq;
+    }
+
+    // next_key must always be the first keyframe after the oldest packet
+    size_t expected = (ring->head == ring->tail) ? ring->tail : vpi_replay_ring_find_key(ring, ring->head + 1);
+    if (expected == ring->tail) {
+        expected = SIZE_MAX;
+    }
+    if (ring->next_key != expected) {
+        printf("FAIL (%s: next keyframe is %zu, expected %zu)\n", test, ring->next_key, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+// 10 fps video with a keyframe every `key_interval`, audio at 20 packets a second
+static int play(vpi_replay_ring_t *ring, int64_t from, int64_t to, int64_t key_interval, int video_size, const char *test)
+{
+    for (int64_t t = from; t < to; t += SECOND / 20) {
+        if ((t / (SECOND / 20)) % 2 == 0) {
+            int key = key_interval && (t % key_interval) == 0;
+            push(ring, VIDEO, key, video_size + (int) (t / 1000 % 7) * 100, t);
+        }
+        push(ring, AUDIO, 0, 200, t);
+
+        if (check_ring(ring, test)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int aged_eviction_keeps_gop()
+{
+    vpi_replay_ring_t ring;
+    if (vpi_replay_ring_init(&ring, 16 * 1024 * 1024, 8192, VIDEO) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+
+    const int64_t key_interval = 15 * SECOND;
+    int ret = 0;
+
+    for (int64_t t = 0; t < 120 * SECOND && !ret; t += 5 * SECOND) {
+        ret = play(&ring, t, t + 5 * SECOND, key_interval, 1000, "aged eviction");
+        if (ret || t < 45 * SECOND) {
+            continue;
+        }
+
+        // The replay starts on a keyframe and covers at least VPI_REPLAY_SECONDS, but never
+        // holds on to more than one extra keyframe interval
+        const vpi_replay_packet_t *oldest = vpi_replay_ring_packet(&ring, ring.head);
+        int64_t age = (t + 5 * SECOND) - oldest->time;
+        if (oldest->stream_index != VIDEO || !oldest->key) {
+            printf("FAIL (aged eviction: oldest packet isn't a keyframe)\n");
+            ret = 1;
+        } else if (age < VPI_REPLAY_SECONDS * SECOND || age > VPI_REPLAY_SECONDS * SECOND + key_interval) {
+            printf("FAIL (aged eviction: holding %.1f seconds)\n", (double) age / SECOND);
+            ret = 1;
+        }
+    }
+
+    vpi_replay_ring_free(&ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int no_keyframe_ages_out()
+{
+    vpi_replay_ring_t ring;
+    if (vpi_replay_ring_init(&ring, 16 * 1024 * 1024, 8192, VIDEO) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+
+    int ret = 0;
+
+    // Nothing before the first keyframe can be decoded, so it just ages out
+    if (play(&ring, 0, 40 * SECOND, 0, 1000, "no keyframe")) {
+        ret = 1;
+    } else if (40 * SECOND - vpi_replay_ring_packet(&ring, ring.head)->time > VPI_REPLAY_SECONDS * SECOND) {
+        printf("FAIL (no keyframe: kept packets older than %i seconds)\n", VPI_REPLAY_SECONDS);
+        ret = 1;
+    }
+
+    // Once there is a keyframe, it stays until a newer one can take over, however old it gets
+    size_t key = ring.tail;
+    if (!ret && (push(&ring, VIDEO, 1, 1000, 40 * SECOND) != 1 || play(&ring, 40 * SECOND + SECOND / 10, 100 * SECOND, 0, 1000, "single keyframe"))) {
+        ret = 1;
+    } else if (!ret && ring.head != key) {
+        printf("FAIL (single keyframe: evicted the only keyframe)\n");
+        ret = 1;
+    }
+
+    vpi_replay_ring_free(&ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int capacity_eviction()
+{
+    // Far too small for VPI_REPLAY_SECONDS, so space runs out long before anything ages out
+    vpi_replay_ring_t ring;
+    if (vpi_replay_ring_init(&ring, 64 * 1024, 8192, VIDEO) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+
+    int ret = play(&ring, 0, 20 * SECOND, 2 * SECOND, 1500, "capacity eviction");
+    if (!ret && !ring.full_logged) {
+        printf("FAIL (capacity eviction: never ran out of space)\n");
+        ret = 1;
+    }
+
+    vpi_replay_ring_free(&ring);
+
+    // Too few slots rather than too few bytes
+    if (!ret && vpi_replay_ring_init(&ring, 16 * 1024 * 1024, 16, VIDEO) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+    if (!ret) {
+        ret = play(&ring, 0, 20 * SECOND, 2 * SECOND, 1500, "packet limit");
+        vpi_replay_ring_free(&ring);
+    }
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int pinned_save()
+{
+    vpi_replay_ring_t ring;
+    if (vpi_replay_ring_init(&ring, 64 * 1024, 8192, VIDEO) != 0) {
+        printf("FAIL (couldn't allocate ring)\n");
+        return 1;
+    }
+
+    int ret = 0;
+    int64_t t = 0;
+
+    push(&ring, VIDEO, 1, 1000, t);
+    ring.pin = ring.head;
+
+    // Everything pinned stays put, so once the slab is full new packets are refused
+    int dropped = 0;
+    for (int i = 0; i < 200 && !dropped; i++) {
+        t += SECOND / 20;
+        dropped = !push(&ring, i % 2 ? AUDIO : VIDEO, 0, 1000, t);
+    }
+
+    if (!dropped || !ring.resync) {
+        printf("FAIL (pinned save: packets weren't refused once full)\n");
+        ret = 1;
+    } else if (ring.head != ring.pin) {
+        printf("FAIL (pinned save: evicted pinned packets)\n");
+        ret = 1;
+    } else if (check_ring(&ring, "pinned save")) {
+        ret = 1;
+    }
+
+    // Save done. Video that depends on what was dropped must wait for the next keyframe
+    ring.pin = SIZE_MAX;
+    t += SECOND / 20;
+    if (!ret && push(&ring, VIDEO, 0, 1000, t)) {
+        printf("FAIL (pinned save: kept video that can't be decoded)\n");
+        ret = 1;
+    } else if (!ret && !push(&ring, AUDIO, 0, 200, t)) {
+        printf("FAIL (pinned save: dropped audio after unpinning)\n");
+        ret = 1;
+    } else if (!ret && (!push(&ring, VIDEO, 1, 1000, t) || ring.resync)) {
+        printf("FAIL (pinned save: didn't resume at the keyframe)\n");
+        ret = 1;
+    } else if (!ret && check_ring(&ring, "after save")) {
+        ret = 1;
+    }
+
+    vpi_replay_ring_free(&ring);
+
+    if (!ret) {
+        printf("SUCCESS\n");
+    }
+
+    return ret;
+}
+
+int main()
+{
+    if (aged_eviction_keeps_gop()) {
+        return 1;
+    }
+
+    if (no_keyframe_ages_out()) {
+        return 1;
+    }
+
+    if (capacity_eviction()) {
+        return 1;
+    }
+
+    if (pinned_save()) {
+        return 1;
+    }
+
+    return 0;
+}
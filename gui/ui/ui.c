@@ -28,6 +28,7 @@ vui_context_t *vui_alloc(int width, int height)
 	vui->mic_callback = 0;
 	vui->mic_enabled_handler = 0;
 	vui->audio_enabled_handler = 0;
+    vui->perf_hud = 0;
     vui->quit = 0;
     vui_reset(vui);
     return vui;
@@ -39,6 +40,17 @@ void vui_free(vui_context_t *vui)
     free(vui);
 }
 
+void vui_mark_dirty(vui_context_t *ctx, int layer)
+{
+    if (layer < 0) {
+        for (int i = 0; i < MAX_BUTTON_COUNT; i++) {
+            ctx->layer_dirty[i] = 1;
+        }
+    } else if (layer < MAX_BUTTON_COUNT) {
+        ctx->layer_dirty[layer] = 1;
+    }
+}
+
 void vui_reset(vui_context_t *ctx)
 {
     ctx->button_count = 0;
@@ -56,6 +68,7 @@ void vui_reset(vui_context_t *ctx)
     ctx->selected_button = -1;
     ctx->cancel_button = -1;
     ctx->active_textedit = -1;
+    vui_mark_dirty(ctx, -1);
 	vui_audio_set_enabled(ctx, 0);
     if (ctx->text_open_handler)
         ctx->text_open_handler(ctx, -1, 0, ctx->text_open_handler_data);
@@ -69,12 +82,16 @@ void vui_get_screen_size(vui_context_t *ctx, int *width, int *height)
 
 void vui_enable_background(vui_context_t *ctx, int enabled)
 {
-    ctx->background_enabled = enabled;
+    if (ctx->background_enabled != enabled) {
+        ctx->background_enabled = enabled;
+        vui_mark_dirty(ctx, 0);
+    }
 }
 
 void vui_set_background(vui_context_t *ctx, const char *background_image)
 {
     vui_strncpy(ctx->background_image, background_image, sizeof(ctx->background_image));
+    vui_mark_dirty(ctx, 0);
 }
 
 int vui_button_create(vui_context_t *ctx, int x, int y, int w, int h, const char *text, const char *icon, vui_button_style_t style, int layer, vui_button_callback_t callback, void *callback_data)
@@ -116,6 +133,7 @@ int vui_button_create(vui_context_t *ctx, int x, int y, int w, int h, const char
     vui_button_update_enabled(ctx, index, 1);
     vui_button_update_checked(ctx, index, 0);
     vui_button_update_checkable(ctx, index, 0);
+    vui_mark_dirty(ctx, layer);
 
     ctx->button_count++;
 
@@ -125,7 +143,10 @@ int vui_button_create(vui_context_t *ctx, int x, int y, int w, int h, const char
 void vui_button_update_visible(vui_context_t *ctx, int index, int visible)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->visible = visible;
+    if (btn->visible != visible) {
+        btn->visible = visible;
+        vui_mark_dirty(ctx, btn->layer);
+    }
     if (!visible && ctx->selected_button == index) {
         ctx->selected_button = -1;
     }
@@ -134,7 +155,10 @@ void vui_button_update_visible(vui_context_t *ctx, int index, int visible)
 void vui_button_update_enabled(vui_context_t *ctx, int index, int enabled)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->enabled = enabled;
+    if (btn->enabled != enabled) {
+        btn->enabled = enabled;
+        vui_mark_dirty(ctx, btn->layer);
+    }
     if (!enabled && ctx->selected_button == index) {
         ctx->selected_button = -1;
     }
@@ -143,13 +167,19 @@ void vui_button_update_enabled(vui_context_t *ctx, int index, int enabled)
 void vui_button_update_checked(vui_context_t *ctx, int index, int checked)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->checked = checked;
+    if (btn->checked != checked) {
+        btn->checked = checked;
+        vui_mark_dirty(ctx, btn->layer);
+    }
 }
 
 void vui_button_update_checkable(vui_context_t *ctx, int index, int checkable)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->checkable = checkable;
+    if (btn->checkable != checkable) {
+        btn->checkable = checkable;
+        vui_mark_dirty(ctx, btn->layer);
+    }
 }
 
 void vui_button_set_cancel(vui_context_t *ctx, int button)
@@ -182,28 +212,36 @@ int vui_button_get_checked(vui_context_t *ctx, int index)
 void vui_button_update_geometry(vui_context_t *ctx, int index, int x, int y, int w, int h)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->sx = x;
-    btn->sy = y;
-    btn->sw = w;
-    btn->sh = h;
+    if (btn->sx != x || btn->sy != y || btn->sw != w || btn->sh != h) {
+        btn->sx = x;
+        btn->sy = y;
+        btn->sw = w;
+        btn->sh = h;
+        vui_mark_dirty(ctx, btn->layer);
+    }
 }
 
 void vui_button_update_icon(vui_context_t *ctx, int index, const char *icon)
 {
     vui_button_t *btn = &ctx->buttons[index];
     vui_strncpy(btn->icon, icon, sizeof(btn->icon));
+    vui_mark_dirty(ctx, btn->layer);
 }
 
 void vui_button_update_text(vui_context_t *ctx, int index, const char *text)
 {
     vui_button_t *btn = &ctx->buttons[index];
     vui_strncpy(btn->text, text, sizeof(btn->text));
+    vui_mark_dirty(ctx, btn->layer);
 }
 
 void vui_button_update_style(vui_context_t *ctx, int index, vui_button_style_t style)
 {
     vui_button_t *btn = &ctx->buttons[index];
-    btn->style = style;
+    if (btn->style != style) {
+        btn->style = style;
+        vui_mark_dirty(ctx, btn->layer);
+    }
 }
 
 void vui_select_direction(vui_context_t *ctx, vui_direction_t dir)
@@ -500,7 +538,22 @@ int vui_game_mode_get(vui_context_t *ctx)
 
 void vui_game_mode_set(vui_context_t *ctx, int enabled)
 {
-    ctx->game_mode = enabled;
+    if (ctx->game_mode != enabled) {
+        ctx->game_mode = enabled;
+
+        // Layers weren't kept up to date while the game was showing
+        vui_mark_dirty(ctx, -1);
+    }
+}
+
+int vui_perf_hud_get(vui_context_t *ctx)
+{
+    return ctx->perf_hud;
+}
+
+void vui_perf_hud_set(vui_context_t *ctx, int enabled)
+{
+    ctx->perf_hud = enabled;
 }
 
 int vui_get_font_height(vui_context_t *ctx, vui_font_size_t size)
@@ -547,6 +600,7 @@ int vui_layer_create(vui_context_t *ctx)
     // Set layer defaults
     ctx->layer_opacity[cur_layer] = 1.0f;
 	ctx->layer_enabled[cur_layer] = 1;
+    vui_mark_dirty(ctx, cur_layer);
 
     vui_color_t *layerbg = &ctx->layer_color[cur_layer];
     layerbg->r = 0;
@@ -566,17 +620,26 @@ int vui_layer_destroy(vui_context_t *ctx)
 
     ctx->layers--;
 
+    // Layers below have to be flattened again without it
+    vui_mark_dirty(ctx, ctx->layers);
+
     return cur_layer;
 }
 
 void vui_layer_set_opacity(vui_context_t *ctx, int layer, float opacity)
 {
-    ctx->layer_opacity[layer] = opacity;
+    if (ctx->layer_opacity[layer] != opacity) {
+        ctx->layer_opacity[layer] = opacity;
+        vui_mark_dirty(ctx, layer);
+    }
 }
 
 void vui_layer_set_enabled(vui_context_t *ctx, int layer, int enabled)
 {
-	ctx->layer_enabled[layer] = enabled;
+	if (ctx->layer_enabled[layer] != enabled) {
+		ctx->layer_enabled[layer] = enabled;
+		vui_mark_dirty(ctx, layer);
+	}
 }
 
 vui_color_t vui_color_create(float r, float g, float b, float a)
@@ -592,6 +655,7 @@ vui_color_t vui_color_create(float r, float g, float b, float a)
 void vui_layer_set_bgcolor(vui_context_t *ctx, int layer, vui_color_t color)
 {
     ctx->layer_color[layer] = color;
+    vui_mark_dirty(ctx, layer);
 }
 
 int vui_label_create(vui_context_t *ctx, int x, int y, int w, int h, const char *text, vui_color_t color, vui_font_size_t size, int layer)
@@ -615,6 +679,7 @@ int vui_label_create(vui_context_t *ctx, int x, int y, int w, int h, const char
     lbl->layer = layer;
     vui_label_update_text(ctx, index, text);
     vui_label_update_visible(ctx, index, 1);
+    vui_mark_dirty(ctx, layer);
 
     ctx->label_count++;
 
@@ -624,13 +689,19 @@ int vui_label_create(vui_context_t *ctx, int x, int y, int w, int h, const char
 void vui_label_update_text(vui_context_t *ctx, int index, const char *text)
 {
     vui_label_t *lbl = &ctx->labels[index];
-    vui_strncpy(lbl->text, text, sizeof(lbl->text));
+    if (!text || strncmp(lbl->text, text, sizeof(lbl->text) - 1)) {
+        vui_strncpy(lbl->text, text, sizeof(lbl->text));
+        vui_mark_dirty(ctx, lbl->layer);
+    }
 }
 
 void vui_label_update_visible(vui_context_t *ctx, int index, int visible)
 {
     vui_label_t *lbl = &ctx->labels[index];
-    lbl->visible = visible;
+    if (lbl->visible != visible) {
+        lbl->visible = visible;
+        vui_mark_dirty(ctx, lbl->layer);
+    }
 }
 
 int vui_textedit_create(vui_context_t *ctx, int x, int y, int w, int h, const char *initial_text, vui_font_size_t size, int password, int layer)
@@ -657,6 +728,7 @@ int vui_textedit_create(vui_context_t *ctx, int x, int y, int w, int h, const ch
     vui_textedit_update_text(ctx, index, initial_text);
     vui_textedit_update_visible(ctx, index, 1);
     vui_textedit_update_enabled(ctx, index, 1);
+    vui_mark_dirty(ctx, layer);
 
     if (initial_text) {
         edit->cursor = vui_utf8_cp_len(initial_text);
@@ -677,6 +749,7 @@ void vui_textedit_update_text(vui_context_t *ctx, int index, const char *text)
 {
     vui_textedit_t *edit = &ctx->textedits[index];
     vui_strncpy(edit->text, text, sizeof(edit->text));
+    vui_mark_dirty(ctx, edit->layer);
 
     if (text) {
         size_t len = vui_utf8_cp_len(text);
@@ -691,13 +764,19 @@ void vui_textedit_update_text(vui_context_t *ctx, int index, const char *text)
 void vui_textedit_update_visible(vui_context_t *ctx, int index, int visible)
 {
     vui_textedit_t *edit = &ctx->textedits[index];
-    edit->visible = visible;
+    if (edit->visible != visible) {
+        edit->visible = visible;
+        vui_mark_dirty(ctx, edit->layer);
+    }
 }
 
 void vui_textedit_update_enabled(vui_context_t *ctx, int index, int enabled)
 {
     vui_textedit_t *edit = &ctx->textedits[index];
-    edit->enabled = enabled;
+    if (edit->enabled != enabled) {
+        edit->enabled = enabled;
+        vui_mark_dirty(ctx, edit->layer);
+    }
 }
 
 void vui_textedit_input(vui_context_t *ctx, int index, const char *text)
@@ -794,6 +873,7 @@ void vui_textedit_set_cursor(vui_context_t *ctx, int index, int pos)
 {
     vui_textedit_t *edit = &ctx->textedits[index];
     edit->cursor = pos;
+    vui_mark_dirty(ctx, edit->layer);
 
     // Store last time of input
     gettimeofday(&ctx->active_textedit_time, 0);
@@ -817,6 +897,7 @@ int vui_rect_create(vui_context_t *ctx, int x, int y, int w, int h, int border_r
     rect->layer = layer;
     rect->color = color;
     rect->border_radius = border_radius;
+    vui_mark_dirty(ctx, layer);
 
     ctx->rect_count++;
 
@@ -847,22 +928,26 @@ int vui_image_create(vui_context_t *ctx, int x, int y, int w, int h, const char
     img->w = w;
     img->h = h;
 
-	vui_image_update(ctx, index, image);
-
     img->layer = layer;
 
+	vui_image_update(ctx, index, image);
+
     return index;
 }
 
 void vui_image_update(vui_context_t *ctx, int image, const char *file)
 {
     vui_image_t *img = &ctx->images[image];
-    vui_strncpy(img->image, file, sizeof(img->image));
+    if (!file || strncmp(img->image, file, sizeof(img->image) - 1)) {
+        vui_strncpy(img->image, file, sizeof(img->image));
+        vui_mark_dirty(ctx, img->layer);
+    }
 }
 
 void vui_image_destroy(vui_context_t *ctx, int image)
 {
     ctx->images[image].valid = 0;
+    vui_mark_dirty(ctx, ctx->images[image].layer);
 }
 
 void vui_process_keydown(vui_context_t *ctx, int button)
@@ -63,9 +63,16 @@ void vui_free(vui_context_t *ctx);
 void vui_update(vui_context_t *ctx);
 int vui_game_mode_get(vui_context_t *ctx);
 void vui_game_mode_set(vui_context_t *ctx, int enabled);
+
+// Overlay with stream statistics, shown on top of the game
+int vui_perf_hud_get(vui_context_t *ctx);
+void vui_perf_hud_set(vui_context_t *ctx, int enabled);
 int vui_get_font_height(vui_context_t *ctx, vui_font_size_t size);
 void vui_quit(vui_context_t *ctx);
 
+// Flag a layer as needing to be redrawn, or all of them if `layer` is -1
+void vui_mark_dirty(vui_context_t *ctx, int layer);
+
 /**
  * Audio-related functions
  */
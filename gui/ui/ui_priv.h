@@ -124,6 +124,7 @@ typedef struct vui_context_t {
     float layer_opacity[MAX_BUTTON_COUNT];
     int layer_enabled[MAX_BUTTON_COUNT];
     vui_color_t layer_color[MAX_BUTTON_COUNT];
+    int layer_dirty[MAX_BUTTON_COUNT];
     char background_image[MAX_BUTTON_TEXT];
     int background_enabled;
     vui_audio_handler_t audio_handler;
@@ -131,6 +132,7 @@ typedef struct vui_context_t {
     vui_vibrate_handler_t vibrate_handler;
     void *vibrate_handler_data;
     int game_mode;
+    int perf_hud;
     int selected_button;
     int cancel_button;
     vui_font_height_handler_t font_height_handler;
@@ -8,15 +8,20 @@
 #include <SDL_power.h>
 #include <SDL_ttf.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <vanilla.h>
 #include <libavutil/hwcontext.h>
 #include <libavutil/hwcontext_drm.h>
+#include <libavutil/time.h>
 #include <unistd.h>
 
 #ifdef VANILLA_HAS_EGL
 #include <SDL2/SDL_egl.h>
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_opengles2.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #endif
 
 #ifdef VANILLA_DRM_AVAILABLE
@@ -28,9 +33,13 @@
 #include "menu/menu_game.h"
 #include "platform.h"
 #include "ui_priv.h"
+#include "ui_sdl_audio.h"
+#include "ui_sdl_geom.h"
+#include "ui_sdl_text.h"
 #include "ui_util.h"
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define EGL_IMAGE_CACHE_SIZE 64
 #define PW_CHAR_SIZE 20
 #define PW_CHAR_PAD 2
 
@@ -43,34 +52,87 @@ typedef struct {
     int checked;
 } vui_sdl_cached_texture_t;
 
+#ifdef VANILLA_HAS_EGL
+// dma-bufs are identified by inode rather than fd, since fds get closed and
+// renumbered between frames while the underlying buffer stays the same
+typedef struct {
+    EGLImage image;
+    dev_t dev;
+    ino_t ino;
+    ptrdiff_t offset;
+    ptrdiff_t pitch;
+    uint64_t modifier;
+    uint32_t format;
+    int w;
+    int h;
+    uint64_t last_used;
+} vui_sdl_egl_image_t;
+#endif
+
+#define PERF_HUD_LINES 6
+
+// Counters as of the last time the HUD text was refreshed, so it can show rates
+typedef struct {
+    int64_t sample_us;
+    uint64_t frames_received;
+    uint64_t frames_incomplete;
+    uint64_t frames_dropped;
+    uint64_t idr_requests;
+    uint64_t frames_decoded;
+    uint64_t decode_hist[VPI_DECODE_HIST_BUCKETS];
+    uint64_t audio_underruns;
+    uint64_t audio_overrun_frames;
+    uint64_t audio_skipped_frames;
+    int64_t latency_sum;
+    int latency_frames;
+
+    vui_sdl_text_t lines[PERF_HUD_LINES];
+    int line_count;
+    vui_sdl_shape_t bg;
+} vui_sdl_perf_hud_t;
+
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Rect dst_rect;
     SDL_Texture *background;
     SDL_Texture *layer_data[MAX_BUTTON_COUNT];
-    SDL_Texture *label_data[MAX_BUTTON_COUNT];
+    SDL_Texture *flat_data[MAX_BUTTON_COUNT]; // Each layer with everything above it composited on
+    SDL_Texture *menu_tex;
     vui_sdl_cached_texture_t button_cache[MAX_BUTTON_COUNT];
     vui_sdl_cached_texture_t image_cache[MAX_BUTTON_COUNT];
-    vui_sdl_cached_texture_t textedit_cache[MAX_BUTTON_COUNT];
+    vui_sdl_text_t label_text[MAX_BUTTON_COUNT];
+    vui_sdl_shape_t rect_shapes[MAX_BUTTON_COUNT];
+    vui_sdl_shape_t textedit_shapes[MAX_BUTTON_COUNT];
+    vui_sdl_batch_t batch;
+    vui_sdl_text_t textedit_text[MAX_BUTTON_COUNT];
     TTF_Font *sysfont;
     TTF_Font *sysfont_small;
     TTF_Font *sysfont_tiny;
+    vui_sdl_glyph_atlas_t *sysfont_atlas;
+    vui_sdl_glyph_atlas_t *sysfont_small_atlas;
+    vui_sdl_glyph_atlas_t *sysfont_tiny_atlas;
     SDL_AudioDeviceID audio;
     SDL_AudioDeviceID mic;
     SDL_GameController *controller;
     SDL_Texture *game_tex;
+    SDL_Rect game_src; // Visible part of game_tex, which may be wider than the frame
     int last_shown_toast;
     SDL_Texture *toast_tex;
     struct timeval toast_expiry;
     AVFrame *frame;
+    AVFrame *drm_map_frame;
 	SDL_Texture *pw_tex;
 
-	uint8_t *audio_buffer;
-	size_t audio_buffer_size;
-	size_t audio_buffer_start;
-	size_t audio_buffer_end;
-	pthread_mutex_t audio_buffer_mutex;
+#ifdef VANILLA_HAS_EGL
+    vui_sdl_egl_image_t egl_images[EGL_IMAGE_CACHE_SIZE];
+    int egl_image_count;
+    uint64_t egl_image_clock;
+    int egl_image_cache_usable;
+#endif
+
+	vui_sdl_audio_ring_t audio_ring;
+	int audio_latency_ms;
 
 	Uint32 last_power_state_check;
 	vui_power_state_t last_power_state;
@@ -79,8 +141,54 @@ typedef struct {
 
     SDL_Thread *event_thread;
     SDL_mutex *display_mutex;
+
+    // dst_rect as last published by the render thread, so the event thread
+    // can map touches in game mode without taking display_mutex
+    atomic_uint input_rect_seq;
+    atomic_int input_rect[4];
+
+    // Signalled by the event thread so an idle menu can sleep until there's input
+    SDL_cond *redraw_cond;
+    int needs_present;
+    int drawn_selected_button;
+    int drawn_active_textedit;
+    int drawn_cursor_visible;
+
+    // Presentation scheduling, only touched by the render thread
+    int present_mode;
+    int vsync;
+    int64_t refresh_us;
+    int64_t render_cost_us;
+    int64_t last_vblank_us;
+    int64_t last_frame_present_us;
+    int64_t stats_start_us;
+    int stats_frames;
+    int64_t stats_latency_sum;
+    int64_t stats_judder_sum;
+    float present_latency_ms;
+    float present_judder_ms;
+    vui_sdl_perf_hud_t perf_hud;
 } vui_sdl_context_t;
 
+#ifdef VANILLA_HAS_EGL
+void clear_egl_image_cache(vui_sdl_context_t *sdl_ctx);
+#endif
+static void vui_sdl_update_refresh_rate(vui_sdl_context_t *sdl_ctx);
+
+// The console always sends 60 FPS
+#define CONSOLE_FRAME_US 16667
+#define PRESENT_WAKE_MARGIN_US 1500
+#define PRESENT_STATS_INTERVAL_US 10000000
+#define PERF_HUD_INTERVAL_US 500000
+
+#define AUDIO_MIN_SAMPLES 128
+#define AUDIO_MAX_SAMPLES 4096
+
+// Longest an idle menu sleeps before checking for changes made outside the event thread
+#define IDLE_MAX_WAIT_US 100000
+#define CURSOR_BLINK_US 500000
+#define SMOOTH_QUEUE_DEPTH 2
+
 static int button_map[SDL_CONTROLLER_BUTTON_MAX];
 static int axis_map[SDL_CONTROLLER_AXIS_MAX];
 static int key_map[SDL_NUM_SCANCODES];
@@ -145,7 +253,9 @@ void init_gamepad()
     key_map[SDL_SCANCODE_U] = VANILLA_BTN_R;
     key_map[SDL_SCANCODE_J] = VANILLA_BTN_ZR;
 
+    key_map[SDL_SCANCODE_F3] = VPI_ACTION_TOGGLE_PERF_HUD;
     key_map[SDL_SCANCODE_F5] = VPI_ACTION_TOGGLE_RECORDING;
+    key_map[SDL_SCANCODE_F6] = VPI_ACTION_SAVE_REPLAY;
     key_map[SDL_SCANCODE_F12] = VPI_ACTION_SCREENSHOT;
     key_map[SDL_SCANCODE_ESCAPE] = VPI_ACTION_DISCONNECT;
 }
@@ -183,23 +293,11 @@ void vui_sdl_audio_handler(const void *data, size_t size, void *userdata)
 		return;
 	}
 
-	pthread_mutex_lock(&sdl_ctx->audio_buffer_mutex);
-
-	for (size_t i = 0; i < size; ) {
-		size_t phys = sdl_ctx->audio_buffer_end % sdl_ctx->audio_buffer_size;
-		size_t max_write = MIN(sdl_ctx->audio_buffer_size - phys, size - i);
-		memcpy(sdl_ctx->audio_buffer + phys, ((const unsigned char *) data) + i, max_write);
-
-		i += max_write;
-		sdl_ctx->audio_buffer_end += max_write;
-
-		if (sdl_ctx->audio_buffer_end > sdl_ctx->audio_buffer_start + sdl_ctx->audio_buffer_size) {
-			vpilog("SKIPPED %zu AUDIO BYTES\n", (sdl_ctx->audio_buffer_end - sdl_ctx->audio_buffer_size) - sdl_ctx->audio_buffer_start);
-			sdl_ctx->audio_buffer_start = sdl_ctx->audio_buffer_end - sdl_ctx->audio_buffer_size;
-		}
+	size_t frames = size / VUI_SDL_AUDIO_FRAME_SIZE;
+	size_t written = vui_sdl_audio_ring_write(&sdl_ctx->audio_ring, data, frames, av_gettime_relative());
+	if (written < frames) {
+		vpilog("SKIPPED %zu AUDIO BYTES\n", (frames - written) * VUI_SDL_AUDIO_FRAME_SIZE);
 	}
-
-	pthread_mutex_unlock(&sdl_ctx->audio_buffer_mutex);
 }
 
 void vui_sdl_vibrate_handler(uint8_t vibrate, void *userdata)
@@ -227,6 +325,19 @@ TTF_Font *get_font(vui_sdl_context_t *sdl_ctx, vui_font_size_t size)
     }
 }
 
+vui_sdl_glyph_atlas_t *get_font_atlas(vui_sdl_context_t *sdl_ctx, vui_font_size_t size)
+{
+    switch (size) {
+    case VUI_FONT_SIZE_TINY:
+        return sdl_ctx->sysfont_tiny_atlas;
+    case VUI_FONT_SIZE_SMALL:
+        return sdl_ctx->sysfont_small_atlas;
+    case VUI_FONT_SIZE_NORMAL:
+    default:
+        return sdl_ctx->sysfont_atlas;
+    }
+}
+
 int vui_sdl_font_height_handler(vui_font_size_t size, void *userdata)
 {
     vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) userdata;
@@ -287,22 +398,8 @@ void audio_callback(void *userdata, Uint8 *stream, int len)
 {
 	vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) userdata;
 
-	pthread_mutex_lock(&sdl_ctx->audio_buffer_mutex);
-
-	if ((sdl_ctx->audio_buffer_end - sdl_ctx->audio_buffer_start) >= len) {
-		for (size_t i = 0; i < len; ) {
-            size_t phys = sdl_ctx->audio_buffer_start % sdl_ctx->audio_buffer_size;
-			size_t max_write = MIN(sdl_ctx->audio_buffer_size - phys, len - i);
-			memcpy(stream + i, sdl_ctx->audio_buffer + phys, max_write);
-			i += max_write;
-			sdl_ctx->audio_buffer_start += max_write;
-		}
-	} else {
-		// Return silence
-		memset(stream, 0, len);
-	}
-
-	pthread_mutex_unlock(&sdl_ctx->audio_buffer_mutex);
+	// Never blocks, anything missing comes out as silence
+	vui_sdl_audio_ring_read(&sdl_ctx->audio_ring, stream, len / VUI_SDL_AUDIO_FRAME_SIZE);
 }
 
 void mic_callback(void *userdata, Uint8 *stream, int len)
@@ -319,20 +416,204 @@ int32_t pack_float(float f)
     return x;
 }
 
+static void vui_sdl_publish_input_rect(vui_sdl_context_t *sdl_ctx, const SDL_Rect *r)
+{
+    if (atomic_load(&sdl_ctx->input_rect[0]) == r->x && atomic_load(&sdl_ctx->input_rect[1]) == r->y
+        && atomic_load(&sdl_ctx->input_rect[2]) == r->w && atomic_load(&sdl_ctx->input_rect[3]) == r->h) {
+        return;
+    }
+
+    // Odd sequence number means an update is in progress
+    atomic_fetch_add(&sdl_ctx->input_rect_seq, 1);
+    atomic_store(&sdl_ctx->input_rect[0], r->x);
+    atomic_store(&sdl_ctx->input_rect[1], r->y);
+    atomic_store(&sdl_ctx->input_rect[2], r->w);
+    atomic_store(&sdl_ctx->input_rect[3], r->h);
+    atomic_fetch_add(&sdl_ctx->input_rect_seq, 1);
+}
+
+static void vui_sdl_read_input_rect(vui_sdl_context_t *sdl_ctx, SDL_Rect *r)
+{
+    unsigned int seq;
+    do {
+        seq = atomic_load(&sdl_ctx->input_rect_seq);
+        r->x = atomic_load(&sdl_ctx->input_rect[0]);
+        r->y = atomic_load(&sdl_ctx->input_rect[1]);
+        r->w = atomic_load(&sdl_ctx->input_rect[2]);
+        r->h = atomic_load(&sdl_ctx->input_rect[3]);
+    } while ((seq & 1) || seq != atomic_load(&sdl_ctx->input_rect_seq));
+}
+
+#define INPUT_BATCH_MAX 32
+
+// Gamepad state gathered from a run of SDL events and handed to Vanilla in one go
+typedef struct {
+    int buttons[INPUT_BATCH_MAX];
+    int32_t values[INPUT_BATCH_MAX];
+    size_t count;
+    int touch_pending;
+    int touch_x;
+    int touch_y;
+} vui_sdl_input_batch_t;
+
+static void input_batch_flush(vui_sdl_input_batch_t *batch)
+{
+    if (batch->count) {
+        vanilla_set_buttons(batch->buttons, batch->values, batch->count);
+        batch->count = 0;
+    }
+    if (batch->touch_pending) {
+        vanilla_set_touch(batch->touch_x, batch->touch_y);
+        batch->touch_pending = 0;
+    }
+}
+
+static void input_batch_set(vui_sdl_input_batch_t *batch, int button, int32_t value)
+{
+    // Only the newest value of each button matters
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->buttons[i] == button) {
+            batch->values[i] = value;
+            return;
+        }
+    }
+
+    if (batch->count == INPUT_BATCH_MAX) {
+        input_batch_flush(batch);
+    }
+
+    batch->buttons[batch->count] = button;
+    batch->values[batch->count] = value;
+    batch->count++;
+}
+
+static int is_current_controller(vui_sdl_context_t *sdl_ctx, SDL_JoystickID which)
+{
+    return sdl_ctx->controller && which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(sdl_ctx->controller));
+}
+
+// Handles events that only feed the gamepad, which don't need display_mutex.
+// Returns 0 if the event has to go through the UI instead.
+static int vui_sdl_handle_input_event(vui_context_t *vui, vui_sdl_context_t *sdl_ctx, const SDL_Event *ev, vui_sdl_input_batch_t *batch)
+{
+    if (ev->type == SDL_CONTROLLERSENSORUPDATE) {
+        if (ev->csensor.sensor == SDL_SENSOR_ACCEL) {
+            input_batch_set(batch, VANILLA_SENSOR_ACCEL_X, pack_float(ev->csensor.data[0]));
+            input_batch_set(batch, VANILLA_SENSOR_ACCEL_Y, pack_float(ev->csensor.data[1]));
+            input_batch_set(batch, VANILLA_SENSOR_ACCEL_Z, pack_float(ev->csensor.data[2]));
+        } else if (ev->csensor.sensor == SDL_SENSOR_GYRO) {
+            input_batch_set(batch, VANILLA_SENSOR_GYRO_PITCH, pack_float(ev->csensor.data[0]));
+            input_batch_set(batch, VANILLA_SENSOR_GYRO_YAW, pack_float(ev->csensor.data[1]));
+            input_batch_set(batch, VANILLA_SENSOR_GYRO_ROLL, pack_float(ev->csensor.data[2]));
+        }
+        return 1;
+    }
+
+    // Everything else is only passed straight through while a game is showing.
+    // game_mode is read without the lock, worst case one event takes the UI path.
+    if (!vui->game_mode) {
+        return 0;
+    }
+
+    switch (ev->type) {
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+    {
+        if (!is_current_controller(sdl_ctx, ev->cbutton.which)) {
+            return 1;
+        }
+        int vanilla_btn = button_map[ev->cbutton.button];
+        if (vanilla_btn > VPI_ACTION_START_INDEX) {
+            return 0;
+        }
+        if (vanilla_btn != -1) {
+            input_batch_set(batch, vanilla_btn, ev->type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0);
+        }
+        return 1;
+    }
+    case SDL_CONTROLLERAXISMOTION:
+    {
+        if (is_current_controller(sdl_ctx, ev->caxis.which)) {
+            int vanilla_axis = axis_map[ev->caxis.axis];
+            if (vanilla_axis != -1) {
+                input_batch_set(batch, vanilla_axis, ev->caxis.value);
+            }
+        }
+        return 1;
+    }
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    {
+        if (vui->active_textedit != -1) {
+            return 0;
+        }
+        int vanilla_btn = key_map[ev->key.keysym.scancode];
+        if (vanilla_btn > VPI_ACTION_START_INDEX) {
+            return 0;
+        }
+        if (vanilla_btn != -1) {
+            input_batch_set(batch, vanilla_btn, ev->type == SDL_KEYDOWN ? INT16_MAX : 0);
+        }
+        return 1;
+    }
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    {
+        SDL_Rect dst_rect;
+        vui_sdl_read_input_rect(sdl_ctx, &dst_rect);
+        if (dst_rect.w > 0 && dst_rect.h > 0) {
+            // Translate screen coords to gamepad coords
+            if (ev->button.button == SDL_BUTTON_LEFT && (ev->type == SDL_MOUSEBUTTONDOWN || ev->type == SDL_MOUSEMOTION)) {
+                batch->touch_x = (ev->button.x - dst_rect.x) * vui->screen_width / dst_rect.w;
+                batch->touch_y = (ev->button.y - dst_rect.y) * vui->screen_height / dst_rect.h;
+            } else {
+                batch->touch_x = -1;
+                batch->touch_y = -1;
+            }
+            batch->touch_pending = 1;
+        }
+        return 1;
+    }
+    }
+
+    return 0;
+}
+
 int vui_sdl_event_thread(void *data)
 {
     vui_context_t *vui = (vui_context_t *) data;
     vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) vui->platform_data;
 
+    vui_sdl_input_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+
     SDL_Event ev;
     while (!vui->quit) {
-        while (SDL_WaitEventTimeout(&ev, 100)) {
-            SDL_LockMutex(sdl_ctx->display_mutex);
+        if (!SDL_WaitEventTimeout(&ev, 100)) {
+            continue;
+        }
+
+        // Drain everything that's queued up, so e.g. a burst of sensor
+        // updates becomes a single commit to Vanilla
+        int locked = 0;
+        do {
+            if (vui_sdl_handle_input_event(vui, sdl_ctx, &ev, &batch)) {
+                continue;
+            }
+
+            // Anything that touches the UI goes through display_mutex
+            if (!locked) {
+                SDL_LockMutex(sdl_ctx->display_mutex);
+                locked = 1;
+            }
 
             switch (ev.type) {
             case SDL_QUIT:
+                input_batch_flush(&batch);
                 vanilla_stop();
                 vui_quit(vui);
+                SDL_CondSignal(sdl_ctx->redraw_cond);
                 SDL_UnlockMutex(sdl_ctx->display_mutex);
                 return 0;
             case SDL_MOUSEMOTION:
@@ -341,61 +622,27 @@ int vui_sdl_event_thread(void *data)
             {
                 // Ensure dst_rect is initialized
                 SDL_Rect *dst_rect = &sdl_ctx->dst_rect;
-                if (dst_rect->w > 0 && dst_rect->h > 0) {
+                // Game mode touches have already been passed to Vanilla
+                if (dst_rect->w > 0 && dst_rect->h > 0 && !vui->game_mode) {
                     // Translate screen coords to logical coords
                     int tr_x, tr_y;
                     tr_x = (ev.button.x - dst_rect->x) * vui->screen_width / dst_rect->w;
                     tr_y = (ev.button.y - dst_rect->y) * vui->screen_height / dst_rect->h;
 
-                    if (vui->game_mode) {
-                        // In game mode, pass clicks directly to Vanilla
-                        int x, y;
-                        if (ev.button.button == SDL_BUTTON_LEFT && (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEMOTION)) {
-                            x = tr_x;
-                            y = tr_y;
-                        } else {
-                            x = -1;
-                            y = -1;
-                        }
-                        vanilla_set_touch(x, y);
-                    } else {
-                        // Otherwise, handle ourselves
-                        if (ev.type == SDL_MOUSEBUTTONDOWN)
-                            vui_process_mousedown(vui, tr_x, tr_y);
-                        else if (ev.type == SDL_MOUSEBUTTONUP)
-                            vui_process_mouseup(vui, tr_x, tr_y);
-
-                        if (vui->active_textedit != -1 && (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEMOTION) && ev.button.button == SDL_BUTTON_LEFT) {
-                            // Put cursor in correct position
-                            vui_textedit_t *edit = &vui->textedits[vui->active_textedit];
-                            TTF_Font *font = get_font(sdl_ctx, edit->size);
-
-                            // Determine best location for new cursor
-                            int rel_x = tr_x - edit->x;
-                            char tmp[MAX_BUTTON_TEXT];
-                            int new_cursor = 0;
-                            int diff = rel_x;
-                            size_t len = 0;
-                            char *src = edit->text;
-                            while (*src != 0) {
-                                src = vui_utf8_advance(src);
-
-                                size_t len = src - edit->text;
-                                strncpy(tmp, edit->text, len);
-                                tmp[len] = 0;
-
-                                int tw;
-                                TTF_SizeUTF8(font, tmp, &tw, 0);
-
-                                int this_diff = abs(tw - rel_x);
-                                if (this_diff < diff) {
-                                    diff = this_diff;
-                                    new_cursor++;
-                                } else {
-                                    break;
-                                }
-                            }
+                    if (ev.type == SDL_MOUSEBUTTONDOWN)
+                        vui_process_mousedown(vui, tr_x, tr_y);
+                    else if (ev.type == SDL_MOUSEBUTTONUP)
+                        vui_process_mouseup(vui, tr_x, tr_y);
+
+                    if (vui->active_textedit != -1 && (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEMOTION) && ev.button.button == SDL_BUTTON_LEFT) {
+                        // Put cursor in correct position
+                        vui_textedit_t *edit = &vui->textedits[vui->active_textedit];
+                        vui_sdl_text_t *layout = &sdl_ctx->textedit_text[vui->active_textedit];
 
+                        // Determine best location for new cursor from the
+                        // character offsets found when the text was last drawn
+                        if (!strcmp(layout->text, edit->text)) {
+                            int new_cursor = vui_sdl_text_hit_test(layout, tr_x - edit->x);
                             vui_textedit_set_cursor(vui, vui->active_textedit, new_cursor);
                         }
                     }
@@ -417,14 +664,14 @@ int vui_sdl_event_thread(void *data)
                 break;
             case SDL_CONTROLLERBUTTONDOWN:
             case SDL_CONTROLLERBUTTONUP:
-                if (sdl_ctx->controller && ev.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(sdl_ctx->controller))) {
+                if (is_current_controller(sdl_ctx, ev.cbutton.which)) {
                     int vanilla_btn = button_map[ev.cbutton.button];
                     if (vanilla_btn > VPI_ACTION_START_INDEX) {
                         if (ev.type == SDL_CONTROLLERBUTTONDOWN)
                             vpi_menu_action(vui, (vpi_extra_action_t) vanilla_btn);
                     } else if (vanilla_btn != -1) {
                         if (vui->game_mode) {
-                            vanilla_set_button(vanilla_btn, ev.type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0);
+                            input_batch_set(&batch, vanilla_btn, ev.type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0);
                         } else if (ev.type == SDL_CONTROLLERBUTTONDOWN) {
                             vui_process_keydown(vui, vanilla_btn);
                         } else {
@@ -434,12 +681,12 @@ int vui_sdl_event_thread(void *data)
                 }
                 break;
             case SDL_CONTROLLERAXISMOTION:
-                if (sdl_ctx->controller && ev.cdevice.which == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(sdl_ctx->controller))) {
+                if (is_current_controller(sdl_ctx, ev.caxis.which)) {
                     int vanilla_axis = axis_map[ev.caxis.axis];
                     Sint16 axis_value = ev.caxis.value;
                     if (vanilla_axis != -1) {
                         if (vui->game_mode) {
-                            vanilla_set_button(vanilla_axis, axis_value);
+                            input_batch_set(&batch, vanilla_axis, axis_value);
                         } else if (vanilla_axis == SDL_CONTROLLER_AXIS_LEFTX) {
                             if (axis_value < 0)
                                 vui_process_keydown(vui, VANILLA_AXIS_L_LEFT);
@@ -462,17 +709,6 @@ int vui_sdl_event_thread(void *data)
                     }
                 }
                 break;
-            case SDL_CONTROLLERSENSORUPDATE:
-                if (ev.csensor.sensor == SDL_SENSOR_ACCEL) {
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_X, pack_float(ev.csensor.data[0]));
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_Y, pack_float(ev.csensor.data[1]));
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_Z, pack_float(ev.csensor.data[2]));
-                } else if (ev.csensor.sensor == SDL_SENSOR_GYRO) {
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_PITCH, pack_float(ev.csensor.data[0]));
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_YAW, pack_float(ev.csensor.data[1]));
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_ROLL, pack_float(ev.csensor.data[2]));
-                }
-                break;
             case SDL_KEYDOWN:
             case SDL_KEYUP:
             {
@@ -483,7 +719,7 @@ int vui_sdl_event_thread(void *data)
                             vpi_menu_action(vui, (vpi_extra_action_t) vanilla_btn);
                     } else if (vanilla_btn != -1) {
                         if (vui->game_mode) {
-                            vanilla_set_button(vanilla_btn, ev.type == SDL_KEYDOWN ? INT16_MAX : 0);
+                            input_batch_set(&batch, vanilla_btn, ev.type == SDL_KEYDOWN ? INT16_MAX : 0);
                         } else if (ev.type == SDL_KEYDOWN) {
                             vui_process_keydown(vui, vanilla_btn);
                         } else {
@@ -520,7 +756,18 @@ int vui_sdl_event_thread(void *data)
             case SDL_TEXTEDITING:
                 vpilog("text editing!\n");
                 break;
+            case SDL_WINDOWEVENT:
+                // Window may have been resized or uncovered
+                sdl_ctx->needs_present = 1;
+                break;
             }
+        } while (SDL_PollEvent(&ev));
+
+        input_batch_flush(&batch);
+
+        if (locked) {
+            // Wake the render thread in case it's idle
+            SDL_CondSignal(sdl_ctx->redraw_cond);
             SDL_UnlockMutex(sdl_ctx->display_mutex);
         }
     }
@@ -528,6 +775,66 @@ int vui_sdl_event_thread(void *data)
     return 0;
 }
 
+static int vui_sdl_open_audio(vui_context_t *ctx, vui_sdl_context_t *sdl_ctx, int latency_ms)
+{
+    SDL_AudioSpec desired = {0}, obtained;
+    desired.freq = VUI_SDL_AUDIO_RATE;
+    desired.format = AUDIO_S16LSB;
+    desired.channels = 2;
+	desired.callback = audio_callback;
+	desired.userdata = sdl_ctx;
+
+    size_t target_frames = 0;
+    if (latency_ms > 0) {
+        // Ask for callbacks small enough that the device's own buffer doesn't eat the budget
+        target_frames = (size_t) latency_ms * VUI_SDL_AUDIO_RATE / 1000;
+        desired.samples = AUDIO_MIN_SAMPLES;
+        while (desired.samples < AUDIO_MAX_SAMPLES && desired.samples * 4 <= target_frames) {
+            desired.samples *= 2;
+        }
+    }
+
+    sdl_ctx->audio = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
+    if (!sdl_ctx->audio) {
+        return -1;
+    }
+
+    // Keep at least two callbacks queued so one late packet doesn't drop out
+    if (target_frames < (size_t) obtained.samples * 2) {
+        target_frames = (size_t) obtained.samples * 2;
+    }
+
+    if (vui_sdl_audio_ring_init(&sdl_ctx->audio_ring, target_frames) != 0) {
+        SDL_CloseAudioDevice(sdl_ctx->audio);
+        sdl_ctx->audio = 0;
+        return -1;
+    }
+    sdl_ctx->audio_latency_ms = latency_ms;
+
+    vpilog("Audio: %i frames per callback, keeping %zu frames (%zu ms) queued\n",
+        obtained.samples, target_frames, target_frames * 1000 / VUI_SDL_AUDIO_RATE);
+
+    // Set up handler for audio submitted from VPI to VUI
+    ctx->audio_handler = vui_sdl_audio_handler;
+    ctx->audio_handler_data = sdl_ctx;
+
+    // Set up handler for enabling audio
+    ctx->audio_enabled_handler = vui_sdl_audio_set_enabled;
+    ctx->audio_enabled_handler_data = sdl_ctx;
+
+    return 0;
+}
+
+static void vui_sdl_close_audio(vui_sdl_context_t *sdl_ctx)
+{
+	if (sdl_ctx->audio) {
+		SDL_CloseAudioDevice(sdl_ctx->audio);
+		sdl_ctx->audio = 0;
+
+		vui_sdl_audio_ring_free(&sdl_ctx->audio_ring);
+	}
+}
+
 int vui_init_sdl(vui_context_t *ctx, int fullscreen)
 {
 	// Enable Steam Deck gyroscopes even while Steam is open and in gaming mode
@@ -579,33 +886,11 @@ int vui_init_sdl(vui_context_t *ctx, int fullscreen)
         vpilog("Failed to CreateRenderer\n");
         return -1;
     }
+    sdl_ctx->vsync = 1;
+    vui_sdl_update_refresh_rate(sdl_ctx);
 
     // Open audio output device
-    SDL_AudioSpec desired = {0}, obtained;
-    desired.freq = 48000;
-    desired.format = AUDIO_S16LSB;
-    desired.channels = 2;
-	desired.callback = audio_callback;
-	desired.userdata = sdl_ctx;
-
-    sdl_ctx->audio = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
-    if (sdl_ctx->audio) {
-		// Set up buffers
-		size_t buffer_size = obtained.samples * 4 * 3; // * 2 for 16-bit, * 2 for stereo, * 3 so there's plenty of buffer
-		sdl_ctx->audio_buffer_size = buffer_size;
-		sdl_ctx->audio_buffer = malloc(buffer_size);
-		sdl_ctx->audio_buffer_start = 0;
-		sdl_ctx->audio_buffer_end = 0;
-		pthread_mutex_init(&sdl_ctx->audio_buffer_mutex, 0);
-
-		// Set up handler for audio submitted from VPI to VUI
-        ctx->audio_handler = vui_sdl_audio_handler;
-        ctx->audio_handler_data = sdl_ctx;
-
-		// Set up handler for enabling audio
-		ctx->audio_enabled_handler = vui_sdl_audio_set_enabled;
-		ctx->audio_enabled_handler_data = sdl_ctx;
-    } else {
+    if (vui_sdl_open_audio(ctx, sdl_ctx, 0) != 0) {
         vpilog("Failed to open audio device\n");
     }
 
@@ -667,6 +952,13 @@ int vui_init_sdl(vui_context_t *ctx, int fullscreen)
     TTF_SetFontWrappedAlign(sdl_ctx->sysfont_small, TTF_WRAPPED_ALIGN_CENTER);
     TTF_SetFontWrappedAlign(sdl_ctx->sysfont_tiny, TTF_WRAPPED_ALIGN_CENTER);
 
+    sdl_ctx->sysfont_atlas = vui_sdl_atlas_create(sdl_ctx->renderer, sdl_ctx->sysfont);
+    sdl_ctx->sysfont_small_atlas = vui_sdl_atlas_create(sdl_ctx->renderer, sdl_ctx->sysfont_small);
+    sdl_ctx->sysfont_tiny_atlas = vui_sdl_atlas_create(sdl_ctx->renderer, sdl_ctx->sysfont_tiny);
+    if (!sdl_ctx->sysfont_atlas || !sdl_ctx->sysfont_small_atlas || !sdl_ctx->sysfont_tiny_atlas) {
+        return -1;
+    }
+
 	sdl_ctx->game_tex = 0;
 
     sdl_ctx->background = 0;
@@ -674,16 +966,28 @@ int vui_init_sdl(vui_context_t *ctx, int fullscreen)
     sdl_ctx->toast_tex = 0;
 	sdl_ctx->pw_tex = 0;
     memset(sdl_ctx->layer_data, 0, sizeof(sdl_ctx->layer_data));
-    memset(sdl_ctx->label_data, 0, sizeof(sdl_ctx->label_data));
     memset(sdl_ctx->button_cache, 0, sizeof(sdl_ctx->button_cache));
     memset(sdl_ctx->image_cache, 0, sizeof(sdl_ctx->image_cache));
-    memset(sdl_ctx->textedit_cache, 0, sizeof(sdl_ctx->textedit_cache));
+    memset(sdl_ctx->label_text, 0, sizeof(sdl_ctx->label_text));
+    memset(sdl_ctx->textedit_text, 0, sizeof(sdl_ctx->textedit_text));
     sdl_ctx->controller = find_valid_controller();
 
     sdl_ctx->frame = av_frame_alloc();
+    sdl_ctx->drm_map_frame = av_frame_alloc();
+#ifdef VANILLA_HAS_EGL
+    sdl_ctx->egl_image_cache_usable = -1;
+#endif
+
+    memset(sdl_ctx->flat_data, 0, sizeof(sdl_ctx->flat_data));
+    sdl_ctx->menu_tex = 0;
+    sdl_ctx->needs_present = 1;
+    sdl_ctx->drawn_selected_button = -1;
+    sdl_ctx->drawn_active_textedit = -1;
+    sdl_ctx->drawn_cursor_visible = 0;
 
-    sdl_ctx->event_thread = SDL_CreateThread(vui_sdl_event_thread, "vanilla-event", ctx);
     sdl_ctx->display_mutex = SDL_CreateMutex();
+    sdl_ctx->redraw_cond = SDL_CreateCond();
+    sdl_ctx->event_thread = SDL_CreateThread(vui_sdl_event_thread, "vanilla-event", ctx);
 
 	// Initialize gamepad lookup tables
 	init_gamepad();
@@ -706,18 +1010,22 @@ void vui_close_sdl(vui_context_t *ctx)
         SDL_DestroyMutex(sdl_ctx->display_mutex);
     }
 
+    if (sdl_ctx->redraw_cond) {
+        SDL_DestroyCond(sdl_ctx->redraw_cond);
+    }
+
     av_frame_free(&sdl_ctx->frame);
+    av_frame_free(&sdl_ctx->drm_map_frame);
+
+#ifdef VANILLA_HAS_EGL
+    clear_egl_image_cache(sdl_ctx);
+#endif
 
     if (sdl_ctx->controller) {
         SDL_GameControllerClose(sdl_ctx->controller);
     }
 
-	if (sdl_ctx->audio) {
-		SDL_CloseAudioDevice(sdl_ctx->audio);
-
-		free(sdl_ctx->audio_buffer);
-		pthread_mutex_destroy(&sdl_ctx->audio_buffer_mutex);
-	}
+	vui_sdl_close_audio(sdl_ctx);
 
 	if (sdl_ctx->mic) {
 		SDL_CloseAudioDevice(sdl_ctx->mic);
@@ -736,8 +1044,8 @@ void vui_close_sdl(vui_context_t *ctx)
         if (sdl_ctx->layer_data[i]) {
             SDL_DestroyTexture(sdl_ctx->layer_data[i]);
         }
-        if (sdl_ctx->label_data[i]) {
-            SDL_DestroyTexture(sdl_ctx->label_data[i]);
+        if (sdl_ctx->flat_data[i]) {
+            SDL_DestroyTexture(sdl_ctx->flat_data[i]);
         }
         if (sdl_ctx->button_cache[i].texture) {
             SDL_DestroyTexture(sdl_ctx->button_cache[i].texture);
@@ -745,19 +1053,18 @@ void vui_close_sdl(vui_context_t *ctx)
         if (sdl_ctx->image_cache[i].texture) {
             SDL_DestroyTexture(sdl_ctx->image_cache[i].texture);
         }
-        if (sdl_ctx->textedit_cache[i].texture) {
-            SDL_DestroyTexture(sdl_ctx->textedit_cache[i].texture);
-        }
     }
 
+    vui_sdl_atlas_free(sdl_ctx->sysfont_tiny_atlas);
+    vui_sdl_atlas_free(sdl_ctx->sysfont_small_atlas);
+    vui_sdl_atlas_free(sdl_ctx->sysfont_atlas);
+
     TTF_CloseFont(sdl_ctx->sysfont_tiny);
     TTF_CloseFont(sdl_ctx->sysfont_small);
     TTF_CloseFont(sdl_ctx->sysfont);
 
     TTF_Quit();
 
-	SDL_CloseAudioDevice(sdl_ctx->audio);
-
     SDL_DestroyRenderer(sdl_ctx->renderer);
 
     SDL_DestroyWindow(sdl_ctx->window);
@@ -1032,19 +1339,35 @@ void vui_sdl_draw_button(vui_context_t *vui, vui_sdl_context_t *sdl_ctx, vui_but
 
 void vui_sdl_draw_background(vui_context_t *ctx, SDL_Renderer *renderer)
 {
-    const int bg_r1 = 0xB8;
-    const int bg_g1 = 0xB8;
-    const int bg_b1 = 0xC8;
-    const int bg_r2 = 0xE0;
-    const int bg_g2 = 0xF0;
-    const int bg_b2 = 0xF0;
-    for (int x = 0; x < ctx->screen_width; x++) {
-        float xf = x / (float) ctx->screen_width;
-        SDL_SetRenderDrawColor(renderer, lerp(bg_r1, bg_r2, xf), lerp(bg_g1, bg_g2, xf), lerp(bg_b1, bg_b2, xf), 0xFF);
-        SDL_RenderDrawLine(renderer, x, 0, x, ctx->screen_height);
-    }
+    const SDL_Color bg1 = {0xB8, 0xB8, 0xC8, 0xFF};
+    const SDL_Color bg2 = {0xE0, 0xF0, 0xF0, 0xFF};
+
+    SDL_Rect r;
+    r.x = 0;
+    r.y = 0;
+    r.w = ctx->screen_width;
+    r.h = ctx->screen_height;
+
+    // Horizontal gradient, interpolated between the vertex colors
+    vui_sdl_shape_t shape;
+    shape.valid = 0;
+    vui_sdl_shape_gradient_rect(&shape, &r, bg1, bg2);
+    SDL_RenderGeometry(renderer, NULL, shape.verts, shape.vert_count, shape.indices, shape.index_count);
 }
 
+static SDL_BlendMode vui_sdl_layer_blend_mode()
+{
+    return SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD
+    );
+}
+
+// Only layers flagged in ctx->layer_dirty are redrawn, the rest keep last frame's contents
 void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
 {
     vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) ctx->platform_data;
@@ -1054,18 +1377,17 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
             // Create a new layer here
             sdl_ctx->layer_data[layer] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, ctx->screen_width, ctx->screen_height);
 
-            SDL_BlendMode bm = SDL_ComposeCustomBlendMode(
-                SDL_BLENDFACTOR_ONE,
-                SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                SDL_BLENDOPERATION_ADD,
-                SDL_BLENDFACTOR_ONE,
-                SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                SDL_BLENDOPERATION_ADD
-            );
-
+            SDL_BlendMode bm = vui_sdl_layer_blend_mode();
             SDL_SetRenderDrawBlendMode(sdl_ctx->renderer, bm);
             SDL_SetTextureBlendMode(sdl_ctx->layer_data[layer], bm);
+
+            ctx->layer_dirty[layer] = 1;
+        }
+
+        if (!ctx->layer_dirty[layer]) {
+            continue;
         }
+
         SDL_SetRenderTarget(renderer, sdl_ctx->layer_data[layer]);
 
         if (layer == 0 && ctx->background_enabled) {
@@ -1084,34 +1406,44 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
         }
     }
 
-    // Draw rects
-    for (int i = 0; i < ctx->rect_count; i++) {
-        vui_rect_priv_t *rect = &ctx->rects[i];
+    // Draw rects, one batch per layer
+    for (int layer = 0; layer < ctx->layers; layer++) {
+        if (!ctx->layer_dirty[layer]) {
+            continue;
+        }
 
-        SDL_SetRenderTarget(renderer, sdl_ctx->layer_data[rect->layer]);
+        for (int i = 0; i < ctx->rect_count; i++) {
+            vui_rect_priv_t *rect = &ctx->rects[i];
+            if (rect->layer != layer) {
+                continue;
+            }
 
-        SDL_Rect sr;
-        sr.x = rect->x;
-        sr.y = rect->y;
-        sr.w = rect->w;
-        sr.h = rect->h;
-        vui_sdl_set_render_color(renderer, rect->color);
+            SDL_Rect sr;
+            sr.x = rect->x;
+            sr.y = rect->y;
+            sr.w = rect->w;
+            sr.h = rect->h;
 
-        if (rect->border_radius == 0) {
-            SDL_RenderFillRect(renderer, &sr);
-        } else {
-            for (int y = 0; y < sr.h; y++) {
-                float x_inset = calculate_x_inset(y, sr.h, rect->border_radius);
-                float draw_y = sr.y + y;
-                SDL_RenderDrawLineF(renderer, sr.x + x_inset, draw_y, sr.x + sr.w - x_inset, draw_y);
-            }
+            SDL_Color c;
+            c.r = rect->color.r * 0xFF;
+            c.g = rect->color.g * 0xFF;
+            c.b = rect->color.b * 0xFF;
+            c.a = rect->color.a * 0xFF;
+
+            vui_sdl_shape_rounded_rect(&sdl_ctx->rect_shapes[i], &sr, rect->border_radius, c);
+            vui_sdl_batch_add(renderer, &sdl_ctx->batch, &sdl_ctx->rect_shapes[i]);
+        }
+
+        if (sdl_ctx->batch.index_count) {
+            SDL_SetRenderTarget(renderer, sdl_ctx->layer_data[layer]);
+            vui_sdl_batch_flush(renderer, &sdl_ctx->batch);
         }
     }
 
     // Draw labels
     for (int i = 0; i < ctx->label_count; i++) {
         vui_label_t *lbl = &ctx->labels[i];
-        if (lbl->text[0] && lbl->visible) {
+        if (lbl->text[0] && lbl->visible && ctx->layer_dirty[lbl->layer]) {
             SDL_SetRenderTarget(renderer, sdl_ctx->layer_data[lbl->layer]);
 
             SDL_Color c;
@@ -1120,31 +1452,54 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
             c.b = lbl->color.b * 0xFF;
             c.a = lbl->color.a * 0xFF;
 
-            SDL_Surface *surface = TTF_RenderUTF8_Blended_Wrapped(get_font(sdl_ctx, lbl->size), lbl->text, c, lbl->w);
+            // Layout is cached, so unchanged labels cost one copy per glyph
+            vui_sdl_text_t *layout = &sdl_ctx->label_text[i];
+            vui_sdl_text_layout(layout, get_font_atlas(sdl_ctx, lbl->size), lbl->text, lbl->w);
 
-            SDL_Rect sr;
-            sr.x = 0;
-            sr.y = 0;
-            sr.w = intmin(lbl->w, surface->w);
-            sr.h = intmin(lbl->h, surface->h);
+            SDL_Rect clip;
+            clip.x = lbl->x;
+            clip.y = lbl->y;
+            clip.w = intmin(lbl->w, layout->w);
+            clip.h = intmin(lbl->h, layout->h);
+
+            vui_sdl_text_draw(renderer, layout, lbl->x, lbl->y, &clip, c);
+        }
+    }
 
-            SDL_Rect dr;
-            dr.x = lbl->x;
-            dr.y = lbl->y;
-            dr.w = sr.w;
-            dr.h = sr.h;
+    // Draw textedit backgrounds, one batch per layer
+    const int bgrect_pad = 8;
+    for (int layer = 0; layer < ctx->layers; layer++) {
+        if (!ctx->layer_dirty[layer]) {
+            continue;
+        }
 
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-            SDL_RenderCopy(renderer, texture, &sr, &dr);
-            SDL_DestroyTexture(texture);
-            SDL_FreeSurface(surface);
+        for (int i = 0; i < ctx->textedit_count; i++) {
+            vui_textedit_t *edit = &ctx->textedits[i];
+            if (!edit->visible || edit->layer != layer) {
+                continue;
+            }
+
+            SDL_Rect bgrect;
+            bgrect.x = edit->x - bgrect_pad;
+            bgrect.y = edit->y - bgrect_pad;
+            bgrect.w = edit->w + bgrect_pad + bgrect_pad;
+            bgrect.h = edit->h + bgrect_pad + bgrect_pad;
+
+            SDL_Color bgcolor = {0x00, 0x00, 0x00, 0x80};
+            vui_sdl_shape_rounded_rect(&sdl_ctx->textedit_shapes[i], &bgrect, bgrect_pad, bgcolor);
+            vui_sdl_batch_add(renderer, &sdl_ctx->batch, &sdl_ctx->textedit_shapes[i]);
+        }
+
+        if (sdl_ctx->batch.index_count) {
+            SDL_SetRenderTarget(renderer, sdl_ctx->layer_data[layer]);
+            vui_sdl_batch_flush(renderer, &sdl_ctx->batch);
         }
     }
 
     // Draw textedits
     for (int i = 0; i < ctx->textedit_count; i++) {
         vui_textedit_t *edit = &ctx->textedits[i];
-        if (!edit->visible) {
+        if (!edit->visible || !ctx->layer_dirty[edit->layer]) {
             continue;
         }
 
@@ -1156,25 +1511,13 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
         rect.w = edit->w;
         rect.h = edit->h;
 
-        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x80);
-
-        const int bgrect_pad = 8;
-        SDL_Rect bgrect = rect;
-        bgrect.x -= bgrect_pad;
-        bgrect.y -= bgrect_pad;
-        bgrect.w += bgrect_pad + bgrect_pad;
-        bgrect.h += bgrect_pad + bgrect_pad;
-
-        for (int y = 0; y < bgrect.h; y++) {
-            int x_inset = calculate_x_inset(y, bgrect.h, bgrect_pad);
-            int ry = bgrect.y+y;
-            SDL_RenderDrawLine(renderer, bgrect.x + x_inset, ry, bgrect.x + bgrect.w - x_inset, ry);
-        }
-
         SDL_Color c;
         c.r = c.g = c.b = c.a = 0xFF;
 
-        TTF_Font *font = get_font(sdl_ctx, edit->size);
+        vui_sdl_text_t *layout = &sdl_ctx->textedit_text[i];
+        if (!edit->password) {
+            vui_sdl_text_layout(layout, get_font_atlas(sdl_ctx, edit->size), edit->text, 0);
+        }
 
         if (edit->text[0]) {
 
@@ -1199,28 +1542,13 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
 					pwr.x += PW_CHAR_SIZE + PW_CHAR_PAD;
 				}
 			} else {
-				SDL_Surface *surface = TTF_RenderUTF8_Blended(font, edit->text, c);
-				SDL_Texture *texture = SDL_CreateTextureFromSurface(sdl_ctx->renderer, surface);
-				SDL_Rect src;
-				src.x = src.y = 0;
-
-				src.w = surface->w;
-				src.h = surface->h;
-
-				if (src.w > rect.w) {
-					src.w = rect.w;
-				} else {
-					rect.w = src.w;
-				}
+				SDL_Rect clip = rect;
+				clip.w = intmin(rect.w, layout->w);
 
 				uint8_t f = (edit->enabled ? 1 : 0.5f) * 0xFF;
-				SDL_SetTextureAlphaMod(texture, f);
-				SDL_SetTextureColorMod(texture, f, f, f);
-
-				SDL_RenderCopy(renderer, texture, &src, &rect);
+				SDL_Color tc = {f, f, f, f};
 
-				SDL_FreeSurface(surface);
-				SDL_DestroyTexture(texture);
+				vui_sdl_text_draw(renderer, layout, rect.x, rect.y, &clip, tc);
 			}
         }
 
@@ -1229,24 +1557,18 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
             gettimeofday(&now, 0);
             time_t diff = (now.tv_sec - ctx->active_textedit_time.tv_sec) * 1000000 + (now.tv_usec - ctx->active_textedit_time.tv_usec);
             if ((diff % 1000000) < 500000) {
-                char *copy_end = edit->text;
-                for (int i = 0; i < edit->cursor; i++) {
-                    copy_end = vui_utf8_advance(copy_end);
-                }
-
-                size_t len = copy_end - edit->text;
-
 				int cursor_x;
 				if (edit->password) {
+	                char *copy_end = edit->text;
+	                for (int i = 0; i < edit->cursor; i++) {
+	                    copy_end = vui_utf8_advance(copy_end);
+	                }
+
+	                size_t len = copy_end - edit->text;
+
 					cursor_x = rect.x + (PW_CHAR_SIZE + PW_CHAR_PAD) * len - PW_CHAR_PAD/2;
 				} else {
-                	char tmp_ate[MAX_BUTTON_TEXT];
-					strncpy(tmp_ate, edit->text, len);
-					tmp_ate[len] = 0;
-
-					int tw;
-					TTF_SizeUTF8(font, tmp_ate, &tw, 0);
-					cursor_x = rect.x + tw;
+					cursor_x = rect.x + vui_sdl_text_cursor_x(layout, edit->cursor);
 				}
 				SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
 				SDL_RenderDrawLine(renderer, cursor_x, rect.y, cursor_x, rect.y + rect.h);
@@ -1258,7 +1580,7 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
     for (int i = 0; i < ctx->button_count; i++) {
         vui_button_t *btn = &ctx->buttons[i];
 
-        if (!btn->visible) {
+        if (!btn->visible || !ctx->layer_dirty[btn->layer]) {
             continue;
         }
 
@@ -1358,7 +1680,7 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
     // Draw images
     for (int i = 0; i < MAX_BUTTON_COUNT; i++) {
         vui_image_t *img = &ctx->images[i];
-        if (!img->valid || img->image[0] == 0) {
+        if (!img->valid || img->image[0] == 0 || !ctx->layer_dirty[img->layer]) {
             continue;
         }
 
@@ -1388,18 +1710,41 @@ void vui_draw_sdl(vui_context_t *ctx, SDL_Renderer *renderer)
 
 int get_texture_from_cpu_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
 {
+	// When the decoder's strides line up (see decode_frame.h), size the
+	// texture to the full stride so every plane uploads in one go instead of
+	// the renderer repacking it row by row
+	int tex_w = f->width;
+	if (f->linesize[1] == f->linesize[0] / 2 && f->linesize[2] == f->linesize[1] && f->linesize[0] % 2 == 0) {
+		tex_w = f->linesize[0];
+	}
+
+	if (sdl_ctx->game_tex) {
+		int w, h;
+		SDL_QueryTexture(sdl_ctx->game_tex, 0, 0, &w, &h);
+		if (w != tex_w || h != f->height) {
+			SDL_DestroyTexture(sdl_ctx->game_tex);
+			sdl_ctx->game_tex = 0;
+		}
+	}
+
 	if (!sdl_ctx->game_tex) {
 		sdl_ctx->game_tex = SDL_CreateTexture(
 			sdl_ctx->renderer,
 			SDL_PIXELFORMAT_IYUV,
 			SDL_TEXTUREACCESS_STREAMING,
-			f->width,
+			tex_w,
 			f->height
 		);
 		if (!sdl_ctx->game_tex) {
 			vpilog("Failed to create texture for CPU frame\n");
+			return 0;
 		}
 	}
+
+	sdl_ctx->game_src.x = 0;
+	sdl_ctx->game_src.y = 0;
+	sdl_ctx->game_src.w = f->width;
+	sdl_ctx->game_src.h = f->height;
 	// SDL_SetRenderTarget(sdl_ctx->renderer, sdl_ctx->game_tex);
 	// SDL_SetRenderDrawColor(sdl_ctx->renderer, 0, 0, 0, 0);
 	// SDL_RenderClear(sdl_ctx->renderer);
@@ -1460,6 +1805,104 @@ int check_has_EGL_EXT_image_dma_buf_import()
 	// 	has_eglCreateImage = true;
 	// }
 }
+
+int check_dma_buf_has_unique_inode(int fd)
+{
+	// Kernels before 5.3 give every dma-buf the shared anonymous inode, in
+	// which case we can't tell buffers apart and mustn't cache
+	struct stat dmabuf_st, anon_st;
+	if (fstat(fd, &dmabuf_st) != 0) {
+		return 0;
+	}
+
+	int anon_fd = eventfd(0, EFD_CLOEXEC);
+	if (anon_fd < 0) {
+		return 0;
+	}
+
+	int ret = (fstat(anon_fd, &anon_st) == 0) && (anon_st.st_ino != dmabuf_st.st_ino || anon_st.st_dev != dmabuf_st.st_dev);
+	close(anon_fd);
+
+	return ret;
+}
+
+void clear_egl_image_cache(vui_sdl_context_t *sdl_ctx)
+{
+	if (!sdl_ctx->egl_image_count) {
+		return;
+	}
+
+	EGLDisplay display = eglGetCurrentDisplay();
+	for (int i = 0; i < sdl_ctx->egl_image_count; i++) {
+		eglDestroyImage(display, sdl_ctx->egl_images[i].image);
+	}
+	sdl_ctx->egl_image_count = 0;
+}
+
+// Returns a cached image for this plane, creating one if necessary. If `owned` is set on return,
+// the image couldn't be cached and the caller must destroy it.
+EGLImage get_egl_image(vui_sdl_context_t *sdl_ctx, EGLDisplay display, const AVDRMObjectDescriptor *object, const AVDRMPlaneDescriptor *plane, uint32_t format, int w, int h, const EGLAttrib *attr, int *owned)
+{
+	*owned = 1;
+
+	if (sdl_ctx->egl_image_cache_usable == -1) {
+		sdl_ctx->egl_image_cache_usable = check_dma_buf_has_unique_inode(object->fd);
+		if (!sdl_ctx->egl_image_cache_usable) {
+			vpilog("dma-bufs don't have unique inodes, EGLImage caching disabled\n");
+		}
+	}
+
+	struct stat st;
+	if (!sdl_ctx->egl_image_cache_usable || fstat(object->fd, &st) != 0) {
+		return eglCreateImage(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, 0, attr);
+	}
+
+	sdl_ctx->egl_image_clock++;
+
+	int lru = 0;
+	for (int i = 0; i < sdl_ctx->egl_image_count; i++) {
+		vui_sdl_egl_image_t *e = &sdl_ctx->egl_images[i];
+		if (e->ino == st.st_ino && e->dev == st.st_dev && e->offset == plane->offset && e->pitch == plane->pitch
+			&& e->modifier == object->format_modifier && e->format == format && e->w == w && e->h == h) {
+			e->last_used = sdl_ctx->egl_image_clock;
+			*owned = 0;
+			return e->image;
+		}
+
+		if (e->last_used < sdl_ctx->egl_images[lru].last_used) {
+			lru = i;
+		}
+	}
+
+	EGLImage image = eglCreateImage(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, 0, attr);
+	if (image == EGL_NO_IMAGE) {
+		return image;
+	}
+
+	// Evict the least recently used image if the decoder's pool outgrew the cache
+	vui_sdl_egl_image_t *e;
+	if (sdl_ctx->egl_image_count < EGL_IMAGE_CACHE_SIZE) {
+		e = &sdl_ctx->egl_images[sdl_ctx->egl_image_count];
+		sdl_ctx->egl_image_count++;
+	} else {
+		e = &sdl_ctx->egl_images[lru];
+		eglDestroyImage(display, e->image);
+	}
+
+	e->image = image;
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->offset = plane->offset;
+	e->pitch = plane->pitch;
+	e->modifier = object->format_modifier;
+	e->format = format;
+	e->w = w;
+	e->h = h;
+	e->last_used = sdl_ctx->egl_image_clock;
+
+	*owned = 0;
+	return image;
+}
 #endif // VANILLA_HAS_EGL
 
 int get_texture_from_drm_prime_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
@@ -1509,6 +1952,11 @@ int get_texture_from_drm_prime_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
                     vpilog("Failed to create texture for DRM PRIME frame\n");
                     return 0;
                 }
+
+                sdl_ctx->game_src.x = 0;
+                sdl_ctx->game_src.y = 0;
+                sdl_ctx->game_src.w = f->width;
+                sdl_ctx->game_src.h = f->height;
             }
 
             EGLAttrib use_fmt = layer->format == DRM_FORMAT_YUV420 ? DRM_FORMAT_R8 : layer->format;
@@ -1532,7 +1980,8 @@ int get_texture_from_drm_prime_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
                 EGL_NONE
             };
 
-            EGLImage image = eglCreateImage(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, 0, attr);
+            int owned;
+            EGLImage image = get_egl_image(sdl_ctx, display, object, plane, use_fmt, w, h, attr, &owned);
             if (image == EGL_NO_IMAGE) {
                 vpilog("Failed to create EGLImage: 0x%x (display: %p, layer %i, plane %i)\n", eglGetError(), display, i, j);
                 return 0;
@@ -1544,7 +1993,9 @@ int get_texture_from_drm_prime_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
 			image_index++;
 			SDL_GL_UnbindTexture(sdl_ctx->game_tex);
 
-            eglDestroyImage(display, image);
+            if (owned) {
+                eglDestroyImage(display, image);
+            }
 		}
 	}
 
@@ -1555,11 +2006,496 @@ int get_texture_from_drm_prime_frame(vui_sdl_context_t *sdl_ctx, AVFrame *f)
 #endif
 }
 
+static void vui_sdl_set_vsync(vui_sdl_context_t *sdl_ctx, int enabled)
+{
+    if (sdl_ctx->vsync == enabled) {
+        return;
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (SDL_RenderSetVSync(sdl_ctx->renderer, enabled) == 0) {
+        sdl_ctx->vsync = enabled;
+    }
+#endif
+}
+
+static void vui_sdl_update_refresh_rate(vui_sdl_context_t *sdl_ctx)
+{
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(sdl_ctx->window, &mode) == 0 && mode.refresh_rate > 0) {
+        sdl_ctx->refresh_us = 1000000 / mode.refresh_rate;
+    } else {
+        sdl_ctx->refresh_us = CONSOLE_FRAME_US;
+    }
+}
+
+void vui_sdl_set_present_mode(vui_context_t *vui, int mode)
+{
+    vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) vui->platform_data;
+
+    sdl_ctx->present_mode = mode;
+
+    // Smooth mode wants every frame in order, the others only care about the newest
+    vpi_present_set_queue_depth(mode == VUI_PRESENT_MODE_SMOOTH ? SMOOTH_QUEUE_DEPTH : 0);
+
+    vui_sdl_update_refresh_rate(sdl_ctx);
+}
+
+void vui_sdl_set_audio_latency(vui_context_t *vui, int latency_ms)
+{
+    vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) vui->platform_data;
+
+    if (sdl_ctx->audio && sdl_ctx->audio_latency_ms == latency_ms) {
+        return;
+    }
+
+    // Device buffer size can only be chosen when opening it
+    vui_sdl_close_audio(sdl_ctx);
+    if (vui_sdl_open_audio(vui, sdl_ctx, latency_ms) != 0) {
+        vpilog("Failed to open audio device\n");
+    }
+}
+
+static const char *vui_sdl_present_mode_name(int mode)
+{
+    switch (mode) {
+    case VUI_PRESENT_MODE_LOW_LATENCY: return "low-latency";
+    case VUI_PRESENT_MODE_SMOOTH: return "smooth";
+    default: return "adaptive";
+    }
+}
+
+// Decide when to start rendering the next game frame. Called without display_mutex held.
+static void vui_sdl_schedule_present(vui_sdl_context_t *sdl_ctx)
+{
+    switch (sdl_ctx->present_mode) {
+    case VUI_PRESENT_MODE_LOW_LATENCY:
+        // Present the moment a frame is decoded and let it tear rather than wait for vblank
+        vui_sdl_set_vsync(sdl_ctx, 0);
+        vpi_present_frame_wait(CONSOLE_FRAME_US * 2);
+        break;
+    case VUI_PRESENT_MODE_SMOOTH:
+        vui_sdl_set_vsync(sdl_ctx, 1);
+        break;
+    case VUI_PRESENT_MODE_ADAPTIVE:
+    default:
+    {
+        vui_sdl_set_vsync(sdl_ctx, 1);
+
+        // Sleep until just before the next vblank so we pick up the newest
+        // frame instead of one that's been waiting since the last flip
+        if (sdl_ctx->last_vblank_us) {
+            int64_t wake = sdl_ctx->last_vblank_us + sdl_ctx->refresh_us - sdl_ctx->render_cost_us - PRESENT_WAKE_MARGIN_US;
+            int64_t now = av_gettime_relative();
+            if (wake > now) {
+                av_usleep(wake - now);
+            }
+        }
+        break;
+    }
+    }
+}
+
+static void vui_sdl_update_present_stats(vui_sdl_context_t *sdl_ctx, int64_t decoded_time)
+{
+    int64_t now = av_gettime_relative();
+
+    sdl_ctx->stats_frames++;
+    sdl_ctx->stats_latency_sum += now - decoded_time;
+    sdl_ctx->perf_hud.latency_frames++;
+    sdl_ctx->perf_hud.latency_sum += now - decoded_time;
+    if (sdl_ctx->last_frame_present_us) {
+        int64_t judder = (now - sdl_ctx->last_frame_present_us) - CONSOLE_FRAME_US;
+        sdl_ctx->stats_judder_sum += judder < 0 ? -judder : judder;
+    }
+    sdl_ctx->last_frame_present_us = now;
+
+    if (!sdl_ctx->stats_start_us) {
+        sdl_ctx->stats_start_us = now;
+    } else if (now - sdl_ctx->stats_start_us >= PRESENT_STATS_INTERVAL_US) {
+        uint64_t skipped, repeated;
+        vpi_present_get_stats(0, &skipped, &repeated);
+
+        sdl_ctx->present_latency_ms = sdl_ctx->stats_latency_sum / (sdl_ctx->stats_frames * 1000.0f);
+        sdl_ctx->present_judder_ms = sdl_ctx->stats_judder_sum / (sdl_ctx->stats_frames * 1000.0f);
+
+        vpilog("Present (%s): %i frames, latency %.2f ms, judder %.2f ms, skipped %llu, repeated %llu\n",
+            vui_sdl_present_mode_name(sdl_ctx->present_mode), sdl_ctx->stats_frames,
+            sdl_ctx->present_latency_ms, sdl_ctx->present_judder_ms,
+            (unsigned long long) skipped, (unsigned long long) repeated);
+
+        sdl_ctx->stats_start_us = now;
+        sdl_ctx->stats_frames = 0;
+        sdl_ctx->stats_latency_sum = 0;
+        sdl_ctx->stats_judder_sum = 0;
+    }
+}
+
+// Upper edge of the bucket that `pct` percent of the frames in `hist` fall under
+static float decode_percentile_ms(const uint64_t *hist, uint64_t total, int pct)
+{
+    uint64_t target = (total * pct + 99) / 100;
+    uint64_t count = 0;
+    for (int i = 0; i < VPI_DECODE_HIST_BUCKETS; i++) {
+        count += hist[i];
+        if (count >= target) {
+            return (i + 1) * VPI_DECODE_HIST_BUCKET_US / 1000.0f;
+        }
+    }
+    return VPI_DECODE_HIST_BUCKETS * VPI_DECODE_HIST_BUCKET_US / 1000.0f;
+}
+
+static void perf_hud_set_line(vui_sdl_context_t *sdl_ctx, const char *fmt, ...)
+{
+    vui_sdl_perf_hud_t *hud = &sdl_ctx->perf_hud;
+    if (hud->line_count == PERF_HUD_LINES) {
+        return;
+    }
+
+    char buf[MAX_BUTTON_TEXT];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    // Layout is cached, so this only costs anything when a number changes
+    vui_sdl_text_layout(&hud->lines[hud->line_count], sdl_ctx->sysfont_tiny_atlas, buf, 0);
+    hud->line_count++;
+}
+
+// Samples all the counters, but only turns them into text every PERF_HUD_INTERVAL_US
+static void vui_sdl_perf_hud_update(vui_sdl_context_t *sdl_ctx)
+{
+    vui_sdl_perf_hud_t *hud = &sdl_ctx->perf_hud;
+    int64_t now = av_gettime_relative();
+
+    if (hud->sample_us && now - hud->sample_us < PERF_HUD_INTERVAL_US) {
+        return;
+    }
+
+    vanilla_stream_stats_t stream;
+    vanilla_get_stream_stats(&stream);
+
+    uint64_t decoded;
+    uint64_t hist[VPI_DECODE_HIST_BUCKETS];
+    vpi_decode_get_time_stats(&decoded, hist);
+
+    vui_sdl_audio_ring_t *ring = &sdl_ctx->audio_ring;
+    uint64_t underruns = 0, overrun_frames = 0, skipped_frames = 0;
+    size_t audio_fill = 0, audio_target = 0;
+    int audio_jitter_us = 0, audio_rate_ppm = 0;
+    if (sdl_ctx->audio) {
+        underruns = atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+        overrun_frames = atomic_load_explicit(&ring->overrun_frames, memory_order_relaxed);
+        skipped_frames = atomic_load_explicit(&ring->skipped_frames, memory_order_relaxed);
+        audio_fill = vui_sdl_audio_ring_fill(ring);
+        audio_target = atomic_load_explicit(&ring->target_frames, memory_order_relaxed);
+        audio_jitter_us = atomic_load_explicit(&ring->jitter_us, memory_order_relaxed);
+        audio_rate_ppm = atomic_load_explicit(&ring->rate_ppm, memory_order_relaxed);
+    }
+
+    if (hud->sample_us) {
+        float secs = (now - hud->sample_us) / 1000000.0f;
+
+        uint64_t window[VPI_DECODE_HIST_BUCKETS];
+        uint64_t window_total = 0;
+        for (int i = 0; i < VPI_DECODE_HIST_BUCKETS; i++) {
+            window[i] = hist[i] - hud->decode_hist[i];
+            window_total += window[i];
+        }
+
+        hud->line_count = 0;
+        perf_hud_set_line(sdl_ctx, "Received %.1f fps, decoded %.1f fps",
+            (stream.frames_received - hud->frames_received) / secs, (decoded - hud->frames_decoded) / secs);
+        if (window_total) {
+            perf_hud_set_line(sdl_ctx, "Decode p50 %.1f ms, p95 %.1f ms, p99 %.1f ms",
+                decode_percentile_ms(window, window_total, 50),
+                decode_percentile_ms(window, window_total, 95),
+                decode_percentile_ms(window, window_total, 99));
+        } else {
+            perf_hud_set_line(sdl_ctx, "Decode -");
+        }
+        perf_hud_set_line(sdl_ctx, "Present latency %.1f ms, event queue %zu",
+            hud->latency_frames ? hud->latency_sum / (hud->latency_frames * 1000.0f) : 0.0f, stream.event_queue_depth);
+        perf_hud_set_line(sdl_ctx, "Incomplete %llu, dropped %llu, IDR requests %llu",
+            (unsigned long long) (stream.frames_incomplete - hud->frames_incomplete),
+            (unsigned long long) (stream.frames_dropped - hud->frames_dropped),
+            (unsigned long long) (stream.idr_requests - hud->idr_requests));
+        perf_hud_set_line(sdl_ctx, "Audio %.1f/%.1f ms, jitter %.1f ms, rate %+d ppm",
+            audio_fill * 1000.0f / VUI_SDL_AUDIO_RATE, audio_target * 1000.0f / VUI_SDL_AUDIO_RATE,
+            audio_jitter_us / 1000.0f, audio_rate_ppm);
+        perf_hud_set_line(sdl_ctx, "Audio underruns %llu, overruns %llu, skipped %llu",
+            (unsigned long long) (underruns - hud->audio_underruns),
+            (unsigned long long) (overrun_frames - hud->audio_overrun_frames),
+            (unsigned long long) (skipped_frames - hud->audio_skipped_frames));
+    }
+
+    hud->sample_us = now;
+    hud->frames_received = stream.frames_received;
+    hud->frames_incomplete = stream.frames_incomplete;
+    hud->frames_dropped = stream.frames_dropped;
+    hud->idr_requests = stream.idr_requests;
+    hud->frames_decoded = decoded;
+    memcpy(hud->decode_hist, hist, sizeof(hist));
+    hud->audio_underruns = underruns;
+    hud->audio_overrun_frames = overrun_frames;
+    hud->audio_skipped_frames = skipped_frames;
+    hud->latency_sum = 0;
+    hud->latency_frames = 0;
+}
+
+static void vui_sdl_perf_hud_draw(SDL_Renderer *renderer, vui_sdl_context_t *sdl_ctx, const SDL_Rect *dst_rect)
+{
+    vui_sdl_perf_hud_t *hud = &sdl_ctx->perf_hud;
+    if (!hud->line_count) {
+        return;
+    }
+
+    const int PERF_HUD_PADDING = 6;
+    int line_h = TTF_FontLineSkip(sdl_ctx->sysfont_tiny);
+    int text_w = 0;
+    for (int i = 0; i < hud->line_count; i++) {
+        text_w = intmax(text_w, hud->lines[i].w);
+    }
+
+    SDL_Rect bg_rect;
+    bg_rect.x = dst_rect->x + PERF_HUD_PADDING;
+    bg_rect.y = dst_rect->y + PERF_HUD_PADDING;
+    bg_rect.w = text_w + PERF_HUD_PADDING * 2;
+    bg_rect.h = line_h * hud->line_count + PERF_HUD_PADDING * 2;
+
+    SDL_Color bg_color = {0, 0, 0, 0xB0};
+    vui_sdl_shape_rounded_rect(&hud->bg, &bg_rect, PERF_HUD_PADDING, bg_color);
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    vui_sdl_batch_add(renderer, &sdl_ctx->batch, &hud->bg);
+    vui_sdl_batch_flush(renderer, &sdl_ctx->batch);
+    SDL_SetRenderDrawBlendMode(renderer, vui_sdl_layer_blend_mode());
+
+    SDL_Color text_color = {0xFF, 0xFF, 0xFF, 0xFF};
+    for (int i = 0; i < hud->line_count; i++) {
+        vui_sdl_text_draw(renderer, &hud->lines[i], bg_rect.x + PERF_HUD_PADDING, bg_rect.y + PERF_HUD_PADDING + i * line_h, NULL, text_color);
+    }
+}
+
+static int64_t timeval_us(const struct timeval *tv)
+{
+    return (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static int64_t get_time_us()
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return timeval_us(&now);
+}
+
+// Flag layers whose look depends on state that isn't changed through a setter
+static void vui_sdl_check_damage(vui_context_t *vui, vui_sdl_context_t *sdl_ctx)
+{
+    if (vui->selected_button != sdl_ctx->drawn_selected_button) {
+        if (sdl_ctx->drawn_selected_button >= 0 && sdl_ctx->drawn_selected_button < vui->button_count) {
+            vui_mark_dirty(vui, vui->buttons[sdl_ctx->drawn_selected_button].layer);
+        }
+        if (vui->selected_button >= 0) {
+            vui_mark_dirty(vui, vui->buttons[vui->selected_button].layer);
+        }
+        sdl_ctx->drawn_selected_button = vui->selected_button;
+    }
+
+    int cursor_visible = 0;
+    if (vui->active_textedit != -1) {
+        int64_t diff = get_time_us() - timeval_us(&vui->active_textedit_time);
+        cursor_visible = (diff % (CURSOR_BLINK_US * 2)) < CURSOR_BLINK_US;
+    }
+    if (vui->active_textedit != sdl_ctx->drawn_active_textedit || cursor_visible != sdl_ctx->drawn_cursor_visible) {
+        if (sdl_ctx->drawn_active_textedit >= 0 && sdl_ctx->drawn_active_textedit < vui->textedit_count) {
+            vui_mark_dirty(vui, vui->textedits[sdl_ctx->drawn_active_textedit].layer);
+        }
+        if (vui->active_textedit >= 0) {
+            vui_mark_dirty(vui, vui->textedits[vui->active_textedit].layer);
+        }
+        sdl_ctx->drawn_active_textedit = vui->active_textedit;
+        sdl_ctx->drawn_cursor_visible = cursor_visible;
+    }
+}
+
+static void rect_union(SDL_Rect *r, int x, int y, int w, int h)
+{
+    SDL_Rect add = {x, y, w, h};
+    if (r->w <= 0 || r->h <= 0) {
+        *r = add;
+    } else {
+        SDL_UnionRect(r, &add, r);
+    }
+}
+
+// Area of the screen a layer draws to. Returns 0 if it draws nothing at all.
+static int vui_sdl_layer_bounds(vui_context_t *vui, int layer, SDL_Rect *bounds)
+{
+    bounds->x = bounds->y = bounds->w = bounds->h = 0;
+
+    if (vui->layer_color[layer].a > 0 || (layer == 0 && vui->background_enabled)) {
+        bounds->w = vui->screen_width;
+        bounds->h = vui->screen_height;
+        return 1;
+    }
+
+    for (int i = 0; i < vui->button_count; i++) {
+        vui_button_t *b = &vui->buttons[i];
+        if (b->visible && b->layer == layer) rect_union(bounds, b->sx, b->sy, b->sw, b->sh);
+    }
+    for (int i = 0; i < vui->label_count; i++) {
+        vui_label_t *l = &vui->labels[i];
+        if (l->visible && l->text[0] && l->layer == layer) rect_union(bounds, l->x, l->y, l->w, l->h);
+    }
+    for (int i = 0; i < vui->rect_count; i++) {
+        vui_rect_priv_t *r = &vui->rects[i];
+        if (r->layer == layer) rect_union(bounds, r->x, r->y, r->w, r->h);
+    }
+    for (int i = 0; i < vui->textedit_count; i++) {
+        vui_textedit_t *e = &vui->textedits[i];
+        if (e->visible && e->layer == layer) {
+            // Background is padded, and password dots aren't clipped to the box
+            const int pad = 8;
+            int w = e->w;
+            if (e->password) {
+                w = intmax(w, strlen(e->text) * (PW_CHAR_SIZE + PW_CHAR_PAD));
+            }
+            rect_union(bounds, e->x - pad, e->y - pad, w + pad + pad, e->h + pad + pad);
+        }
+    }
+    for (int i = 0; i < MAX_BUTTON_COUNT; i++) {
+        vui_image_t *img = &vui->images[i];
+        if (img->valid && img->image[0] && img->layer == layer) rect_union(bounds, img->x, img->y, img->w, img->h);
+    }
+
+    return bounds->w > 0 && bounds->h > 0;
+}
+
+// Composite enabled layers from the top down. Every layer keeps its own
+// flattened copy, so only those at or below a damaged layer are redone.
+// Layers that draw nothing are left out, and the rest are only blended over
+// the area they actually cover.
+static SDL_Texture *vui_sdl_flatten_layers(vui_context_t *vui, vui_sdl_context_t *sdl_ctx)
+{
+    SDL_Renderer *renderer = sdl_ctx->renderer;
+
+    int el[MAX_BUTTON_COUNT];
+    SDL_Rect el_bounds[MAX_BUTTON_COUNT];
+    int el_count = 0;
+    for (int i = 0; i < vui->layers; i++) {
+        if (!vui->layer_enabled[i]) {
+            continue;
+        }
+
+        // The bottom layer is always the backdrop, anything above is skipped if invisible
+        int visible = vui_sdl_layer_bounds(vui, i, &el_bounds[el_count]);
+        if (el_count == 0 || (visible && vui->layer_opacity[i] * 0xFF >= 1)) {
+            el[el_count] = i;
+            el_count++;
+        }
+    }
+
+    if (el_count == 0) {
+        return sdl_ctx->layer_data[0];
+    }
+
+    // Layers above the top one may have just been hidden, disabled or destroyed
+    int damaged = 0;
+    for (int j = el[el_count - 1]; j < MAX_BUTTON_COUNT; j++) {
+        damaged |= vui->layer_dirty[j];
+    }
+
+    SDL_Texture *above = sdl_ctx->layer_data[el[el_count - 1]];
+    int above_layer = el[el_count - 1];
+    SDL_Rect above_bounds = el_bounds[el_count - 1];
+    for (int i = el_count - 2; i >= 0; i--) {
+        int layer = el[i];
+        for (int j = layer; j < el[i + 1]; j++) {
+            damaged |= vui->layer_dirty[j];
+        }
+
+        if (!sdl_ctx->flat_data[layer]) {
+            sdl_ctx->flat_data[layer] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, vui->screen_width, vui->screen_height);
+            SDL_SetTextureBlendMode(sdl_ctx->flat_data[layer], vui_sdl_layer_blend_mode());
+            damaged = 1;
+        }
+
+        SDL_Texture *flat = sdl_ctx->flat_data[layer];
+        if (damaged) {
+            SDL_Texture *base = sdl_ctx->layer_data[layer];
+
+            SDL_SetRenderTarget(renderer, flat);
+            SDL_SetTextureBlendMode(base, SDL_BLENDMODE_NONE);
+            SDL_SetTextureColorMod(base, 0xFF, 0xFF, 0xFF);
+            SDL_SetTextureAlphaMod(base, 0xFF);
+            SDL_RenderCopy(renderer, base, NULL, NULL);
+            SDL_SetTextureBlendMode(base, vui_sdl_layer_blend_mode());
+
+            float opacity = vui->layer_opacity[above_layer];
+            SDL_SetTextureColorMod(above, opacity * 0xFF, opacity * 0xFF, opacity * 0xFF);
+            SDL_SetTextureAlphaMod(above, opacity * 0xFF);
+            SDL_RenderCopy(renderer, above, &above_bounds, &above_bounds);
+        }
+
+        above = flat;
+        above_layer = layer;
+        rect_union(&above_bounds, el_bounds[i].x, el_bounds[i].y, el_bounds[i].w, el_bounds[i].h);
+    }
+
+    return above;
+}
+
+// How long an undamaged menu can sleep before something needs redrawing
+static int vui_sdl_idle_timeout_ms(vui_context_t *vui, vui_sdl_context_t *sdl_ctx)
+{
+    int64_t timeout = IDLE_MAX_WAIT_US;
+
+    if (vui->animation_enabled || vui->passive_animation_count) {
+        // Animations may change nothing visible for a while, but keep stepping them
+        timeout = sdl_ctx->refresh_us > 0 ? sdl_ctx->refresh_us : CONSOLE_FRAME_US;
+    }
+
+    int64_t now = get_time_us();
+
+    if (vui->active_textedit != -1) {
+        int64_t diff = now - timeval_us(&vui->active_textedit_time);
+        int64_t next_blink = CURSOR_BLINK_US - (diff % CURSOR_BLINK_US);
+        if (next_blink < timeout) timeout = next_blink;
+    }
+
+    if (sdl_ctx->toast_tex) {
+        int64_t until_expiry = timeval_us(&sdl_ctx->toast_expiry) - now;
+        if (until_expiry < timeout) timeout = until_expiry;
+    }
+
+    return timeout > 1000 ? (timeout + 999) / 1000 : 1;
+}
+
 // Rendering/main thread
 int vui_update_sdl(vui_context_t *vui)
 {
     vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) vui->platform_data;
 
+    if (vui->game_mode) {
+        vui_sdl_schedule_present(sdl_ctx);
+    } else {
+        // Menus are always vsynced, no need to spin
+        vui_sdl_set_vsync(sdl_ctx, 1);
+        sdl_ctx->last_vblank_us = 0;
+        sdl_ctx->last_frame_present_us = 0;
+
+#ifdef VANILLA_HAS_EGL
+        // Decoder's surface pool is gone, don't keep its buffers alive
+        clear_egl_image_cache(sdl_ctx);
+#endif
+    }
+
+    int64_t render_start = av_gettime_relative();
+    int64_t decoded_time = 0;
+    int new_frame = 0;
+
     SDL_LockMutex(sdl_ctx->display_mutex);
 
     SDL_Rect *dst_rect = &sdl_ctx->dst_rect;
@@ -1569,11 +2505,19 @@ int vui_update_sdl(vui_context_t *vui)
     vui_update(vui);
 
     SDL_Texture *main_tex;
+    SDL_Rect *src_rect = NULL;
 
 #ifdef VANILLA_DRM_AVAILABLE
     static vanilla_drm_ctx_t *drm_ctx = NULL;
 #endif // VANILLA_DRM_AVAILABLE
 
+    // Toasts can be shown from any thread, so they're polled rather than flagged
+    const int TOAST_PADDING = 12;
+    int cur_toast;
+    vpi_get_toast(&cur_toast, 0, 0, 0);
+    int toast_changed = cur_toast != sdl_ctx->last_shown_toast
+        || (sdl_ctx->toast_tex && get_time_us() >= timeval_us(&sdl_ctx->toast_expiry));
+
     int handle_final_blit = 1;
     if (!vui->game_mode) {
 
@@ -1583,37 +2527,40 @@ int vui_update_sdl(vui_context_t *vui)
         }
 #endif // VANILLA_DRM_AVAILABLE
 
-        // Draw vui to a custom texture
-        vui_draw_sdl(vui, renderer);
+        vui_sdl_check_damage(vui, sdl_ctx);
 
-        // Flatten layers
-		int el[MAX_BUTTON_COUNT];
-		int el_count = 0;
-		for (int i = 0; i < vui->layers; i++) {
-			if (vui->layer_enabled[i]) {
-				el[el_count] = i;
-				el_count++;
-			}
-		}
+        int damaged = !sdl_ctx->menu_tex;
+        for (int i = 0; i < MAX_BUTTON_COUNT; i++) {
+            damaged |= vui->layer_dirty[i];
+        }
 
-        for (int i = el_count - 1; i > 0; i--) {
-            SDL_Texture *bg = sdl_ctx->layer_data[el[i-1]];
-            SDL_Texture *fg = sdl_ctx->layer_data[el[i]];
+        if (!damaged && !toast_changed && !sdl_ctx->needs_present) {
+            // Nothing has changed, so sleep until there's input or something is due
+            SDL_CondWaitTimeout(sdl_ctx->redraw_cond, sdl_ctx->display_mutex, vui_sdl_idle_timeout_ms(vui, sdl_ctx));
+            SDL_UnlockMutex(sdl_ctx->display_mutex);
+            return !vui->quit;
+        }
 
-            SDL_SetRenderTarget(renderer, bg);
-            SDL_SetTextureColorMod(fg, vui->layer_opacity[i] * 0xFF, vui->layer_opacity[i] * 0xFF, vui->layer_opacity[i] * 0xFF);
-            SDL_SetTextureAlphaMod(fg, vui->layer_opacity[i] * 0xFF);
-            SDL_RenderCopy(renderer, fg, NULL, NULL);
+        if (damaged) {
+            // Redraw damaged layers and composite them
+            vui_draw_sdl(vui, renderer);
+            sdl_ctx->menu_tex = vui_sdl_flatten_layers(vui, sdl_ctx);
+            memset(vui->layer_dirty, 0, sizeof(vui->layer_dirty));
         }
 
-        main_tex = sdl_ctx->layer_data[0];
+        main_tex = sdl_ctx->menu_tex;
     } else {
-        pthread_mutex_lock(&vpi_present_frame_mutex);
-		if (vpi_present_frame && vpi_present_frame->format != -1) {
-			av_frame_move_ref(sdl_ctx->frame, vpi_present_frame);
-            sdl_ctx->frame->pts = vpi_present_frame->pts;
+        // Smooth mode takes frames at the console's cadence even if the display refreshes faster
+        AVFrame *present_frame = 0;
+        if (sdl_ctx->present_mode != VUI_PRESENT_MODE_SMOOTH
+            || !sdl_ctx->last_frame_present_us
+            || render_start - sdl_ctx->last_frame_present_us >= CONSOLE_FRAME_US - sdl_ctx->refresh_us / 2) {
+            present_frame = vpi_present_frame_acquire(&decoded_time);
+        }
+		if (present_frame && present_frame->format != -1) {
+			av_frame_move_ref(sdl_ctx->frame, present_frame);
+            new_frame = 1;
 		}
-        pthread_mutex_unlock(&vpi_present_frame_mutex);
 
 		if (sdl_ctx->frame->format != -1) {
             switch (sdl_ctx->frame->format) {
@@ -1632,18 +2579,16 @@ int vui_update_sdl(vui_context_t *vui)
             }
             case AV_PIX_FMT_VAAPI:
 			{
-				AVFrame *drm = av_frame_alloc();
-				if (drm) {
-					drm->format = AV_PIX_FMT_DRM_PRIME;
-					if (av_hwframe_map(drm, sdl_ctx->frame, 0) >= 0) {
-						get_texture_from_drm_prime_frame(sdl_ctx, drm);
-					} else {
-						vpilog("Failed to map DRM PRIME frame from VAAPI\n");
-					}
-					av_frame_free(&drm);
+				// Mapping still exports the surface every frame, but the EGLImages
+				// behind it come from the cache
+				AVFrame *drm = sdl_ctx->drm_map_frame;
+				drm->format = AV_PIX_FMT_DRM_PRIME;
+				if (av_hwframe_map(drm, sdl_ctx->frame, 0) >= 0) {
+					get_texture_from_drm_prime_frame(sdl_ctx, drm);
 				} else {
-					vpilog("Failed to allocate DRM PRIME frame from VAAPI\n");
+					vpilog("Failed to map DRM PRIME frame from VAAPI\n");
 				}
+				av_frame_unref(drm);
                 break;
 			}
             case AV_PIX_FMT_YUV420P:
@@ -1658,14 +2603,12 @@ int vui_update_sdl(vui_context_t *vui)
 			// SDL_SetRenderTarget(renderer, main_tex);
 			// SDL_RenderCopy(renderer, sdl_ctx->game_tex, 0, 0);
             main_tex = sdl_ctx->game_tex;
+            src_rect = &sdl_ctx->game_src;
 		}
     }
 
     if (handle_final_blit) {
-        // Draw toast on screen if necessary
-        const int TOAST_PADDING = 12;
-        int cur_toast;
-        vpi_get_toast(&cur_toast, 0, 0, 0);
+        // Render new toast if necessary
         if (cur_toast != sdl_ctx->last_shown_toast) {
             // Get toast information
             char toast_str[VPI_TOAST_MAX_LEN];
@@ -1690,12 +2633,13 @@ int vui_update_sdl(vui_context_t *vui)
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
             SDL_RenderClear(renderer);
 
-            SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xF0);
             const int TOAST_BORDER_RADIUS = TOAST_PADDING;
-            for (int y = 0; y < toast_h; y++) {
-                const int x_inset = calculate_x_inset(y, toast_h, TOAST_BORDER_RADIUS);
-                SDL_RenderDrawLine(renderer, x_inset, y, toast_w - x_inset, y);
-            }
+            SDL_Rect toast_rect = {0, 0, toast_w, toast_h};
+            SDL_Color toast_bg = {0xFF, 0xFF, 0xFF, 0xF0};
+            vui_sdl_shape_t shape;
+            shape.valid = 0;
+            vui_sdl_shape_rounded_rect(&shape, &toast_rect, TOAST_BORDER_RADIUS, toast_bg);
+            SDL_RenderGeometry(renderer, NULL, shape.verts, shape.vert_count, shape.indices, shape.index_count);
 
             SDL_Rect dst_rect;
             dst_rect.x = dst_rect.y = TOAST_PADDING;
@@ -1705,31 +2649,10 @@ int vui_update_sdl(vui_context_t *vui)
 
             SDL_DestroyTexture(texture);
             SDL_FreeSurface(surface);
-        }
-        if (sdl_ctx->toast_tex) {
-            // Draw toast to screen
-            SDL_SetRenderTarget(renderer, main_tex);
-
-            // Get texture size
-            int toast_w, toast_h;
-            SDL_QueryTexture(sdl_ctx->toast_tex, 0, 0, &toast_w, &toast_h);
-
-            // Calculate dst rect
-            SDL_Rect dst_rect;
-            dst_rect.w = toast_w;
-            dst_rect.h = toast_h;
-            dst_rect.y = vui->screen_height - dst_rect.h - TOAST_PADDING - TOAST_PADDING;
-            dst_rect.x = vui->screen_width/2 - toast_w/2;
-
-            SDL_RenderCopy(renderer, sdl_ctx->toast_tex, 0, &dst_rect);
-
+        } else if (sdl_ctx->toast_tex && get_time_us() >= timeval_us(&sdl_ctx->toast_expiry)) {
             // Handle expiry
-            struct timeval now;
-            gettimeofday(&now, 0);
-            if (now.tv_sec*1000000+now.tv_usec >= sdl_ctx->toast_expiry.tv_sec*1000000+sdl_ctx->toast_expiry.tv_usec) {
-                SDL_DestroyTexture(sdl_ctx->toast_tex);
-                sdl_ctx->toast_tex = 0;
-            }
+            SDL_DestroyTexture(sdl_ctx->toast_tex);
+            sdl_ctx->toast_tex = 0;
         }
 
         // Calculate our destination rectangle
@@ -1753,6 +2676,23 @@ int vui_update_sdl(vui_context_t *vui)
             dst_rect->h = win_w * vui->screen_height / vui->screen_width;
             dst_rect->y = win_h / 2 - dst_rect->h / 2;
         }
+
+        vui_sdl_publish_input_rect(sdl_ctx, dst_rect);
+    }
+
+    int show_perf_hud = handle_final_blit && vui->game_mode && vui->perf_hud;
+    if (show_perf_hud) {
+        vui_sdl_perf_hud_update(sdl_ctx);
+    } else {
+        // Start from a fresh window next time it's shown
+        sdl_ctx->perf_hud.sample_us = 0;
+        sdl_ctx->perf_hud.line_count = 0;
+        sdl_ctx->perf_hud.latency_sum = 0;
+        sdl_ctx->perf_hud.latency_frames = 0;
+    }
+
+    if (handle_final_blit) {
+        sdl_ctx->needs_present = 0;
     }
 
     // We don't touch the struct anymore after this
@@ -1763,12 +2703,48 @@ int vui_update_sdl(vui_context_t *vui)
         SDL_SetRenderTarget(renderer, NULL);
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
         SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, main_tex, NULL, dst_rect);
+        SDL_RenderCopy(renderer, main_tex, src_rect, dst_rect);
+
+        // Draw toast over the top, so the menu's composite can be reused once it's gone
+        if (sdl_ctx->toast_tex) {
+            int toast_w, toast_h;
+            SDL_QueryTexture(sdl_ctx->toast_tex, 0, 0, &toast_w, &toast_h);
+
+            // Position in screen coordinates, then scale into the window
+            int tx = vui->screen_width/2 - toast_w/2;
+            int ty = vui->screen_height - toast_h - TOAST_PADDING - TOAST_PADDING;
+
+            SDL_Rect toast_rect;
+            toast_rect.x = dst_rect->x + tx * dst_rect->w / vui->screen_width;
+            toast_rect.y = dst_rect->y + ty * dst_rect->h / vui->screen_height;
+            toast_rect.w = toast_w * dst_rect->w / vui->screen_width;
+            toast_rect.h = toast_h * dst_rect->h / vui->screen_height;
+
+            SDL_RenderCopy(renderer, sdl_ctx->toast_tex, 0, &toast_rect);
+        }
+
+        if (show_perf_hud) {
+            vui_sdl_perf_hud_draw(renderer, sdl_ctx, dst_rect);
+        }
+
+        if (new_frame) {
+            int64_t cost = av_gettime_relative() - render_start;
+            sdl_ctx->render_cost_us = (sdl_ctx->render_cost_us * 7 + cost) / 8;
+        }
 
         // Flip surfaces
         SDL_RenderPresent(renderer);
     }
 
+    if (vui->game_mode) {
+        // With vsync on, RenderPresent returns right after the flip
+        sdl_ctx->last_vblank_us = sdl_ctx->vsync ? av_gettime_relative() : 0;
+
+        if (new_frame) {
+            vui_sdl_update_present_stats(sdl_ctx, decoded_time);
+        }
+    }
+
     return !vui->quit;
 }
 
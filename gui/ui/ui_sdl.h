@@ -18,4 +18,37 @@ void vui_close_sdl(vui_context_t *ctx);
  */
 int vui_update_sdl(vui_context_t *ctx);
 
+/**
+ * Presentation policy for game frames
+ *
+ * Adaptive keeps vsync but wakes just before vblank to show the newest frame.
+ * Low-latency presents as soon as a frame is decoded, allowing tearing.
+ * Smooth queues a couple of frames and paces them at the console's 60 Hz.
+ */
+enum VuiPresentMode
+{
+    VUI_PRESENT_MODE_ADAPTIVE,
+    VUI_PRESENT_MODE_LOW_LATENCY,
+    VUI_PRESENT_MODE_SMOOTH,
+    VUI_PRESENT_MODE_COUNT
+};
+
+void vui_sdl_set_present_mode(vui_context_t *ctx, int mode);
+
+/**
+ * Whether dma-bufs can be told apart by inode, so imports of them can be cached
+ *
+ * Shared by the EGL and DRM presentation paths.
+ */
+int check_dma_buf_has_unique_inode(int fd);
+
+/**
+ * How much audio to keep queued, in milliseconds
+ *
+ * 0 lets SDL pick its usual buffer size. Anything else also shrinks the device's buffer to match,
+ * for lower latency at the cost of more frequent callbacks. Reopens the audio device, so it must be
+ * called before any audio is pushed.
+ */
+void vui_sdl_set_audio_latency(vui_context_t *ctx, int latency_ms);
+
 #endif // VANILLA_PI_UI_SDL_H
\ No newline at end of file
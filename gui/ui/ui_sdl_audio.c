@@ -0,0 +1,231 @@
+#include "ui_sdl_audio.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Furthest the playback rate is bent to stay on target, too little to hear
+#define AUDIO_MAX_ADJUST 0.005f
+
+// Rate controller gains. Proportional is per unit of relative fill error, integral is per second.
+#define AUDIO_KP 0.005f
+#define AUDIO_KI 0.002f
+
+// Fill level is averaged over several callbacks, packets arriving in bursts make it saw up and down
+#define AUDIO_FILL_SMOOTHING 0.02f
+
+// Extra frames kept queued per frame of measured jitter
+#define AUDIO_JITTER_MULT 3
+
+// A gap this long means the stream stopped and restarted, not jitter
+#define AUDIO_RESYNC_US 250000
+
+#define PHASE_BITS 24
+#define PHASE_ONE ((uint64_t) 1 << PHASE_BITS)
+
+int vui_sdl_audio_ring_init(vui_sdl_audio_ring_t *ring, size_t target_frames)
+{
+    // Enough headroom for the target to grow with jitter and for bursts on top of that
+    size_t capacity = 4096;
+    while (capacity < target_frames * 8) {
+        capacity <<= 1;
+    }
+
+    ring->frames = calloc(capacity, VUI_SDL_AUDIO_FRAME_SIZE);
+    if (!ring->frames) {
+        return -1;
+    }
+
+    ring->capacity = capacity;
+    ring->base_target = target_frames;
+    atomic_init(&ring->write, 0);
+    atomic_init(&ring->read, 0);
+    atomic_init(&ring->target_frames, target_frames);
+    atomic_init(&ring->rebuffer, 0);
+
+    ring->media_frames = -1;
+    ring->last_transit_us = 0;
+    ring->jitter_us_q4 = 0;
+    ring->max_packet_frames = 0;
+
+    ring->buffering = 1;
+    ring->phase = 0;
+    ring->fill_avg = 0;
+    ring->integral = 0;
+
+    atomic_init(&ring->underruns, 0);
+    atomic_init(&ring->overrun_frames, 0);
+    atomic_init(&ring->skipped_frames, 0);
+    atomic_init(&ring->jitter_us, 0);
+    atomic_init(&ring->rate_ppm, 0);
+
+    return 0;
+}
+
+void vui_sdl_audio_ring_free(vui_sdl_audio_ring_t *ring)
+{
+    free(ring->frames);
+    ring->frames = NULL;
+}
+
+// Compare when the packet arrived with where it sits in the stream, and grow the target to cover
+// how much that varies
+static void audio_ring_track_jitter(vui_sdl_audio_ring_t *ring, size_t count, int64_t now_us)
+{
+    if (ring->media_frames < 0) {
+        ring->media_frames = 0;
+        ring->last_transit_us = now_us;
+    }
+
+    int64_t transit = now_us - ring->media_frames * 1000000 / VUI_SDL_AUDIO_RATE;
+    int64_t d = transit - ring->last_transit_us;
+    if (d < 0) d = -d;
+
+    if (d > AUDIO_RESYNC_US) {
+        // Start measuring again from here, and have the consumer build its cushion back up
+        ring->media_frames = 0;
+        transit = now_us;
+        atomic_store_explicit(&ring->rebuffer, 1, memory_order_relaxed);
+    } else {
+        ring->jitter_us_q4 += d - ((ring->jitter_us_q4 + 8) >> 4);
+    }
+
+    ring->last_transit_us = transit;
+    ring->media_frames += count;
+
+    // Each packet lands all at once, so just before the next one the queue is a whole packet lower
+    if (count > ring->max_packet_frames) {
+        ring->max_packet_frames = count;
+    }
+
+    int64_t jitter_us = ring->jitter_us_q4 >> 4;
+    size_t target = ring->base_target + ring->max_packet_frames
+        + (size_t) (jitter_us * VUI_SDL_AUDIO_RATE / 1000000) * AUDIO_JITTER_MULT;
+    if (target > ring->capacity / 2) {
+        target = ring->capacity / 2;
+    }
+
+    atomic_store_explicit(&ring->target_frames, target, memory_order_relaxed);
+    atomic_store_explicit(&ring->jitter_us, (int) jitter_us, memory_order_relaxed);
+}
+
+size_t vui_sdl_audio_ring_write(vui_sdl_audio_ring_t *ring, const void *data, size_t count, int64_t now_us)
+{
+    audio_ring_track_jitter(ring, count, now_us);
+
+    size_t w = atomic_load_explicit(&ring->write, memory_order_relaxed);
+    size_t r = atomic_load_explicit(&ring->read, memory_order_acquire);
+
+    size_t space = ring->capacity - (w - r);
+    if (count > space) {
+        atomic_fetch_add_explicit(&ring->overrun_frames, count - space, memory_order_relaxed);
+        count = space;
+    }
+
+    const uint8_t *src = (const uint8_t *) data;
+    for (size_t i = 0; i < count; ) {
+        size_t phys = (w + i) & (ring->capacity - 1);
+        size_t n = ring->capacity - phys;
+        if (n > count - i) n = count - i;
+        memcpy(ring->frames + phys, src + i * VUI_SDL_AUDIO_FRAME_SIZE, n * VUI_SDL_AUDIO_FRAME_SIZE);
+        i += n;
+    }
+
+    atomic_store_explicit(&ring->write, w + count, memory_order_release);
+
+    return count;
+}
+
+static inline int16_t lerp_s16(int16_t a, int16_t b, uint64_t frac)
+{
+    return (int16_t) (a + (((int64_t) (b - a) * (int64_t) frac) >> PHASE_BITS));
+}
+
+static inline uint32_t lerp_frame(uint32_t a, uint32_t b, uint64_t frac)
+{
+    uint16_t l = (uint16_t) lerp_s16((int16_t) (a & 0xFFFF), (int16_t) (b & 0xFFFF), frac);
+    uint16_t r = (uint16_t) lerp_s16((int16_t) (a >> 16), (int16_t) (b >> 16), frac);
+    return l | ((uint32_t) r << 16);
+}
+
+int vui_sdl_audio_ring_read(vui_sdl_audio_ring_t *ring, void *out, size_t count)
+{
+    size_t r = atomic_load_explicit(&ring->read, memory_order_relaxed);
+    size_t w = atomic_load_explicit(&ring->write, memory_order_acquire);
+    size_t avail = w - r;
+    size_t target = atomic_load_explicit(&ring->target_frames, memory_order_relaxed);
+    uint32_t *dst = (uint32_t *) out;
+    size_t mask = ring->capacity - 1;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    if (avail > target * 2 + count) {
+        // Way behind, e.g. after a stall. Jump back to target rather than spend seconds catching up.
+        size_t skip = avail - target;
+        r += skip;
+        avail = target;
+        ring->fill_avg = target;
+        ring->phase = 0;
+        atomic_fetch_add_explicit(&ring->skipped_frames, skip, memory_order_relaxed);
+    }
+
+    if (atomic_exchange_explicit(&ring->rebuffer, 0, memory_order_relaxed)) {
+        ring->buffering = 1;
+    }
+
+    if (ring->buffering) {
+        if (avail < target) {
+            memset(out, 0, count * VUI_SDL_AUDIO_FRAME_SIZE);
+            return 0;
+        }
+
+        // Enough queued to ride out a late packet, start playing
+        ring->buffering = 0;
+        ring->fill_avg = avail;
+        ring->phase = 0;
+    }
+
+    ring->fill_avg += ((float) avail - ring->fill_avg) * AUDIO_FILL_SMOOTHING;
+
+    // Play slightly faster when there's too much queued and slower when there's too little
+    float err = target ? (ring->fill_avg - (float) target) / (float) target : 0;
+    ring->integral += err * AUDIO_KI * count / VUI_SDL_AUDIO_RATE;
+    if (ring->integral > AUDIO_MAX_ADJUST) ring->integral = AUDIO_MAX_ADJUST;
+    if (ring->integral < -AUDIO_MAX_ADJUST) ring->integral = -AUDIO_MAX_ADJUST;
+
+    float adjust = AUDIO_KP * err + ring->integral;
+    if (adjust > AUDIO_MAX_ADJUST) adjust = AUDIO_MAX_ADJUST;
+    if (adjust < -AUDIO_MAX_ADJUST) adjust = -AUDIO_MAX_ADJUST;
+
+    uint64_t step = (uint64_t) ((1.0 + adjust) * PHASE_ONE + 0.5);
+
+    // Interpolating needs the frame after the last one we land on
+    uint64_t last = ring->phase + step * (count - 1);
+    if ((last >> PHASE_BITS) + 1 >= avail) {
+        // Ran dry. Leave what's there and refill to target, playing each scrap as it arrives
+        // would leave no cushion and crackle on every late packet after this.
+        memset(out, 0, count * VUI_SDL_AUDIO_FRAME_SIZE);
+        ring->buffering = 1;
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t pos = ring->phase + step * i;
+        size_t idx = r + (pos >> PHASE_BITS);
+        dst[i] = lerp_frame(ring->frames[idx & mask], ring->frames[(idx + 1) & mask], pos & (PHASE_ONE - 1));
+    }
+
+    uint64_t end = ring->phase + step * count;
+    ring->phase = end & (PHASE_ONE - 1);
+    atomic_store_explicit(&ring->read, r + (end >> PHASE_BITS), memory_order_release);
+    atomic_store_explicit(&ring->rate_ppm, (int) (adjust * 1000000), memory_order_relaxed);
+
+    return 1;
+}
+
+size_t vui_sdl_audio_ring_fill(vui_sdl_audio_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->write, memory_order_relaxed) - atomic_load_explicit(&ring->read, memory_order_relaxed);
+}
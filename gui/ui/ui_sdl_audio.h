@@ -0,0 +1,73 @@
+#ifndef VPI_UI_SDL_AUDIO_H
+#define VPI_UI_SDL_AUDIO_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Interleaved stereo S16, the only format the console sends
+#define VUI_SDL_AUDIO_FRAME_SIZE 4
+#define VUI_SDL_AUDIO_RATE 48000
+
+/**
+ * Jitter buffer between exactly one producer (the thread pushing audio from Vanilla) and one
+ * consumer (SDL's audio callback). Neither side ever blocks.
+ *
+ * The producer measures how unevenly packets arrive and raises the target fill level to cover it.
+ * The consumer resamples by up to +/-0.5% to hold the fill level on target, which absorbs the
+ * drift between the console's audio clock and ours without audible skips.
+ */
+typedef struct {
+    uint32_t *frames;
+    size_t capacity; // Power of two
+    size_t base_target;
+
+    atomic_size_t write;
+    atomic_size_t read;
+    atomic_size_t target_frames;
+    atomic_int rebuffer; // Set by the producer when the stream restarts
+
+    // Producer only
+    int64_t media_frames;
+    int64_t last_transit_us;
+    int64_t jitter_us_q4; // RFC 3550 style interarrival jitter, fixed point with 4 fractional bits
+    size_t max_packet_frames;
+
+    // Consumer only
+    int buffering; // Playing silence until the fill level is back up to target
+    uint64_t phase;   // Position between the frames at `read` and `read + 1`, in 1/2^24ths
+    float fill_avg;
+    float integral;
+
+    // Stats, readable from any thread
+    atomic_uint_fast64_t underruns;
+    atomic_uint_fast64_t overrun_frames;
+    atomic_uint_fast64_t skipped_frames;
+    atomic_int jitter_us;
+    atomic_int rate_ppm;
+} vui_sdl_audio_ring_t;
+
+/**
+ * Set up a ring that keeps at least `target_frames` queued, more if packets arrive unevenly
+ */
+int vui_sdl_audio_ring_init(vui_sdl_audio_ring_t *ring, size_t target_frames);
+void vui_sdl_audio_ring_free(vui_sdl_audio_ring_t *ring);
+
+/**
+ * Producer side, queue `count` frames that arrived at `now_us` (any monotonic clock)
+ *
+ * Frames that don't fit are dropped and counted in `overrun_frames`. Returns the number queued.
+ */
+size_t vui_sdl_audio_ring_write(vui_sdl_audio_ring_t *ring, const void *data, size_t count, int64_t now_us);
+
+/**
+ * Consumer side, fill `out` with exactly `count` frames
+ *
+ * Plays silence without consuming anything at first and after running dry, until the fill level is
+ * back up to target. Returns 0 whenever `out` is silence for that reason.
+ */
+int vui_sdl_audio_ring_read(vui_sdl_audio_ring_t *ring, void *out, size_t count);
+
+size_t vui_sdl_audio_ring_fill(vui_sdl_audio_ring_t *ring);
+
+#endif // VPI_UI_SDL_AUDIO_H
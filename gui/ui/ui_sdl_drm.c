@@ -1,35 +1,105 @@
 #include "ui_sdl_drm.h"
 
 #include <libavutil/hwcontext_drm.h>
+#include <poll.h>
 #include <stdint.h>
 #include <SDL2/SDL_syswm.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_mode.h>
 #include <drm_fourcc.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 
 #include "platform.h"
+#include "ui_sdl.h"
 
-#define MAX_HANDLE_CACHE 32
+// Decoders cycle through a small pool of surfaces, this is comfortably more
+// than any of them allocate
+#define MAX_FB_CACHE 32
+
+// How long to wait for an outstanding flip before giving up on it
+#define FLIP_TIMEOUT_MS 50
+
+// A framebuffer wrapping one of the decoder's buffers, imported exactly once.
+// Buffers are identified by their dma-buf inodes since fd numbers change
+// between frames.
 typedef struct {
-    int fd;
-    uint32_t handle;
-} vanilla_drm_handle_t;
+    dev_t dev[AV_DRM_MAX_PLANES];
+    ino_t ino[AV_DRM_MAX_PLANES];
+    int nb_objects;
+    uint32_t format;
+    int width;
+    int height;
+    uint32_t fb_id;
+    uint64_t last_used;
+} vanilla_drm_fb_t;
+
+typedef struct {
+    uint32_t fb_id;
+    uint32_t crtc_id;
+    uint32_t src_x;
+    uint32_t src_y;
+    uint32_t src_w;
+    uint32_t src_h;
+    uint32_t crtc_x;
+    uint32_t crtc_y;
+    uint32_t crtc_w;
+    uint32_t crtc_h;
+} vanilla_drm_plane_props_t;
 
 typedef struct vanilla_drm_ctx_t {
 	int fd;
+	int sdl_fd;
+	int lease_fd;
 	uint32_t crtc;
 	int crtc_index;
+	uint32_t connector;
 	uint32_t plane_id;
 	int got_plane;
-	uint32_t fb_id;
-	int got_fb;
-    vanilla_drm_handle_t handle_cache[MAX_HANDLE_CACHE];
-    size_t handle_cache_count;
+    int atomic;
+    vanilla_drm_plane_props_t props;
+
+    vanilla_drm_fb_t fb_cache[MAX_FB_CACHE];
+    size_t fb_cache_count;
+    uint64_t fb_clock;
+    int fb_cache_usable;
+
+    // Frames stay referenced while they're scanned out so the decoder can't
+    // reuse their buffers underneath the display
+    AVFrame *on_screen;
+    uint32_t on_screen_fb;
+    AVFrame *pending;
+    uint32_t pending_fb;
+    int flip_pending;
 } vanilla_drm_ctx_t;
 
+static int get_property_id(int drmfd, uint32_t object_id, uint32_t object_type, const char *name, uint64_t *value)
+{
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drmfd, object_id, object_type);
+    if (!props) {
+        return 0;
+    }
+
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < props->count_props && !id; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(drmfd, props->props[i]);
+        if (prop) {
+            if (!strcmp(prop->name, name)) {
+                id = prop->prop_id;
+                if (value) *value = props->prop_values[i];
+            }
+            drmModeFreeProperty(prop);
+        }
+    }
+
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
 static int find_plane(const int drmfd, const int crtcidx, const uint32_t format, uint32_t *const pplane_id)
 {
     drmModePlaneResPtr planes;
@@ -56,6 +126,13 @@ static int find_plane(const int drmfd, const int crtcidx, const uint32_t format,
             continue;
         }
 
+        // With universal planes we also see the primary and cursor planes, leave those to SDL
+        uint64_t type;
+        if (get_property_id(drmfd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) && type != DRM_PLANE_TYPE_OVERLAY) {
+            drmModeFreePlane(plane);
+            continue;
+        }
+
         for (j = 0; j < plane->count_formats; ++j) {
             if (plane->formats[j] == format) break;
         }
@@ -76,52 +153,61 @@ static int find_plane(const int drmfd, const int crtcidx, const uint32_t format,
     return ret;
 }
 
-int vui_sdl_drm_present(vanilla_drm_ctx_t *ctx, AVFrame *frame)
+static int init_plane_props(vanilla_drm_ctx_t *ctx)
 {
-    const AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *) frame->data[0];
-    const uint32_t format = desc->layers[0].format;
+    vanilla_drm_plane_props_t *p = &ctx->props;
+    const uint32_t type = DRM_MODE_OBJECT_PLANE;
+
+    p->fb_id = get_property_id(ctx->fd, ctx->plane_id, type, "FB_ID", 0);
+    p->crtc_id = get_property_id(ctx->fd, ctx->plane_id, type, "CRTC_ID", 0);
+    p->src_x = get_property_id(ctx->fd, ctx->plane_id, type, "SRC_X", 0);
+    p->src_y = get_property_id(ctx->fd, ctx->plane_id, type, "SRC_Y", 0);
+    p->src_w = get_property_id(ctx->fd, ctx->plane_id, type, "SRC_W", 0);
+    p->src_h = get_property_id(ctx->fd, ctx->plane_id, type, "SRC_H", 0);
+    p->crtc_x = get_property_id(ctx->fd, ctx->plane_id, type, "CRTC_X", 0);
+    p->crtc_y = get_property_id(ctx->fd, ctx->plane_id, type, "CRTC_Y", 0);
+    p->crtc_w = get_property_id(ctx->fd, ctx->plane_id, type, "CRTC_W", 0);
+    p->crtc_h = get_property_id(ctx->fd, ctx->plane_id, type, "CRTC_H", 0);
+
+    return p->fb_id && p->crtc_id && p->src_x && p->src_y && p->src_w && p->src_h
+        && p->crtc_x && p->crtc_y && p->crtc_w && p->crtc_h;
+}
 
-    if (!ctx->got_plane) {
-        if (find_plane(ctx->fd, ctx->crtc_index, format, &ctx->plane_id) < 0) {
-            vpilog("Failed to find plane for format: %x\n", format);
-            return 0;
-        } else {
-            ctx->got_plane = 1;
+static void close_handles(vanilla_drm_ctx_t *ctx, const uint32_t *handles, int count)
+{
+    struct drm_gem_close gem_close = {0};
+    for (int i = 0; i < count; i++) {
+        // Objects within one frame may share a buffer, only close each handle once
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            if (handles[j] == handles[i]) seen = 1;
+        }
+        if (handles[i] && !seen) {
+            gem_close.handle = handles[i];
+            drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
         }
     }
+}
+
+// The framebuffer keeps its own reference to the buffers, so the GEM handles
+// are closed again straight away
+static uint32_t create_fb(vanilla_drm_ctx_t *ctx, const AVFrame *frame)
+{
+    const AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *) frame->data[0];
+
+    uint32_t handles[AV_DRM_MAX_PLANES] = {0};
 
     uint32_t pitches[AV_DRM_MAX_PLANES] = {0};
     uint32_t offsets[AV_DRM_MAX_PLANES] = {0};
     uint32_t bo_handles[AV_DRM_MAX_PLANES] = {0};
     uint64_t modifiers[AV_DRM_MAX_PLANES] = {0};
-	uint32_t handles[AV_DRM_MAX_PLANES];
 
     for (int i = 0; i < desc->nb_objects; i++) {
-        int fd = desc->objects[i].fd;
-
-        uint32_t handle = 0;
-        for (size_t i = 0; i < ctx->handle_cache_count; i++) {
-            vanilla_drm_handle_t *h = &ctx->handle_cache[i];
-            if (h->fd == fd) {
-                handle = h->handle;
-                break;
-            }
-        }
-
-        if (!handle) {
-            vpilog("(re)opening DRM handle because fd 0x%x was not found\n", fd);
-
-            vanilla_drm_handle_t *h = &ctx->handle_cache[ctx->handle_cache_count];
-            if (drmPrimeFDToHandle(ctx->fd, fd, &handle) != 0) {
-                vpilog("Failed to get handle from file descriptor: %s\n", strerror(errno));
-                return 0;
-            }
-            h->handle = handle;
-            h->fd = fd;
-            ctx->handle_cache_count++;
+        if (drmPrimeFDToHandle(ctx->fd, desc->objects[i].fd, &handles[i]) != 0) {
+            vpilog("Failed to get handle from file descriptor: %s\n", strerror(errno));
+            close_handles(ctx, handles, i);
+            return 0;
         }
-
-        handles[i] = handle;
     }
 
     int n = 0;
@@ -140,28 +226,274 @@ int vui_sdl_drm_present(vanilla_drm_ctx_t *ctx, AVFrame *frame)
         }
     }
 
-    uint32_t new_fb;
+    uint32_t fb;
     if (drmModeAddFB2WithModifiers(ctx->fd,
                                    frame->width, frame->height, desc->layers[0].format,
                                    bo_handles, pitches, offsets, modifiers,
-                                   &new_fb, DRM_MODE_FB_MODIFIERS) != 0) {
+                                   &fb, DRM_MODE_FB_MODIFIERS) != 0) {
         vpilog("Failed to create framebuffer: %s\n", strerror(errno));
+        fb = 0;
+    }
+
+    close_handles(ctx, handles, desc->nb_objects);
+
+    return fb;
+}
+
+static uint32_t get_fb(vanilla_drm_ctx_t *ctx, const AVFrame *frame)
+{
+    const AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *) frame->data[0];
+
+    vanilla_drm_fb_t key = {0};
+    key.nb_objects = desc->nb_objects;
+    key.format = desc->layers[0].format;
+    key.width = frame->width;
+    key.height = frame->height;
+
+    int cacheable = ctx->fb_cache_usable;
+    for (int i = 0; i < desc->nb_objects && cacheable; i++) {
+        struct stat st;
+        if (fstat(desc->objects[i].fd, &st) != 0) {
+            cacheable = 0;
+        } else {
+            key.dev[i] = st.st_dev;
+            key.ino[i] = st.st_ino;
+        }
+    }
+
+    if (!cacheable) {
+        // Fall back to wrapping every frame, the previous one is removed once it's off screen
+        return create_fb(ctx, frame);
+    }
+
+    ctx->fb_clock++;
+
+    int lru = -1;
+    for (size_t i = 0; i < ctx->fb_cache_count; i++) {
+        vanilla_drm_fb_t *f = &ctx->fb_cache[i];
+        if (f->nb_objects == key.nb_objects && f->format == key.format && f->width == key.width && f->height == key.height
+            && !memcmp(f->dev, key.dev, sizeof(key.dev)) && !memcmp(f->ino, key.ino, sizeof(key.ino))) {
+            f->last_used = ctx->fb_clock;
+            return f->fb_id;
+        }
+
+        // Never evict anything that's on screen or about to be
+        if (f->fb_id != ctx->on_screen_fb && f->fb_id != ctx->pending_fb
+            && (lru == -1 || f->last_used < ctx->fb_cache[lru].last_used)) {
+            lru = i;
+        }
+    }
+
+    if (ctx->fb_cache_count == MAX_FB_CACHE) {
+        if (lru == -1) {
+            return 0;
+        }
+
+        // Decoder must have reallocated its pool, drop the oldest buffer
+        drmModeRmFB(ctx->fd, ctx->fb_cache[lru].fb_id);
+        ctx->fb_cache_count--;
+        ctx->fb_cache[lru] = ctx->fb_cache[ctx->fb_cache_count];
+    }
+
+    vanilla_drm_fb_t *f = &ctx->fb_cache[ctx->fb_cache_count];
+    *f = key;
+    f->fb_id = create_fb(ctx, frame);
+    if (!f->fb_id) {
+        return 0;
+    }
+
+    f->last_used = ctx->fb_clock;
+    ctx->fb_cache_count++;
+
+    vpilog("Imported decoder buffer as framebuffer %u (%zu cached)\n", f->fb_id, ctx->fb_cache_count);
+
+    return f->fb_id;
+}
+
+static void release_uncached_fb(vanilla_drm_ctx_t *ctx, uint32_t fb)
+{
+    if (fb && !ctx->fb_cache_usable) {
+        drmModeRmFB(ctx->fd, fb);
+    }
+}
+
+static void flip_done(vanilla_drm_ctx_t *ctx)
+{
+    // New frame is on screen, so the previous one's buffer can go back to the decoder
+    av_frame_unref(ctx->on_screen);
+    av_frame_move_ref(ctx->on_screen, ctx->pending);
+    release_uncached_fb(ctx, ctx->on_screen_fb);
+    ctx->on_screen_fb = ctx->pending_fb;
+    ctx->pending_fb = 0;
+    ctx->flip_pending = 0;
+}
+
+// Context currently waiting in drmHandleEvent, libdrm gives the handler no other way to reach it
+static vanilla_drm_ctx_t *flip_waiter;
+
+static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void *user_data)
+{
+    // Only our own commits carry the context, anything else isn't ours to handle
+    if (user_data != flip_waiter) {
+        return;
+    }
+
+    flip_done(flip_waiter);
+}
+
+static void wait_for_flip(vanilla_drm_ctx_t *ctx, int timeout_ms)
+{
+    drmEventContext evctx = {0};
+    evctx.version = 2;
+    evctx.page_flip_handler = page_flip_handler;
+
+    struct pollfd pfd;
+    pfd.fd = ctx->fd;
+    pfd.events = POLLIN;
+
+    while (ctx->flip_pending) {
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            break;
+        }
+        flip_waiter = ctx;
+        drmHandleEvent(ctx->fd, &evctx);
+        flip_waiter = NULL;
+    }
+}
+
+// Lease our CRTC, connector and plane from SDL so atomic commits and their flip events go through
+// an fd of our own. SDL's KMSDRM backend reads flip events off its fd with a handler that expects
+// its own user data, so sharing that fd would have each side consume the other's events.
+static int create_lease(vanilla_drm_ctx_t *ctx)
+{
+    uint32_t objects[] = {ctx->connector, ctx->crtc, ctx->plane_id};
+    uint32_t lessee_id;
+
+    int fd = drmModeCreateLease(ctx->sdl_fd, objects, sizeof(objects) / sizeof(objects[0]), O_CLOEXEC, &lessee_id);
+    if (fd < 0) {
+        vpilog("Failed to lease DRM plane: %s\n", strerror(-fd));
+        return 0;
+    }
+
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+        vpilog("DRM atomic modesetting unavailable: %s\n", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    ctx->lease_fd = fd;
+    ctx->fd = fd;
+
+    if (!init_plane_props(ctx)) {
+        vpilog("Plane is missing atomic properties\n");
+        ctx->fd = ctx->sdl_fd;
+        ctx->lease_fd = -1;
+        close(fd);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int commit_atomic(vanilla_drm_ctx_t *ctx, uint32_t fb, const AVFrame *frame)
+{
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    if (!req) {
+        return 0;
+    }
+
+    const vanilla_drm_plane_props_t *p = &ctx->props;
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->fb_id, fb);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->crtc_id, ctx->crtc);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->src_x, 0);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->src_y, 0);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->src_w, (uint64_t) frame->width << 16);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->src_h, (uint64_t) frame->height << 16);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->crtc_x, 0);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->crtc_y, 0);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->crtc_w, frame->width);
+    drmModeAtomicAddProperty(req, ctx->plane_id, p->crtc_h, frame->height);
+
+    int ret = drmModeAtomicCommit(ctx->fd, req, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, ctx);
+    drmModeAtomicFree(req);
+
+    if (ret != 0) {
+        vpilog("Atomic commit failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+int vui_sdl_drm_present(vanilla_drm_ctx_t *ctx, AVFrame *frame)
+{
+    const AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *) frame->data[0];
+    const uint32_t format = desc->layers[0].format;
+
+    if (!ctx->got_plane) {
+        if (find_plane(ctx->fd, ctx->crtc_index, format, &ctx->plane_id) < 0) {
+            vpilog("Failed to find plane for format: %x\n", format);
+            return 0;
+        } else {
+            ctx->got_plane = 1;
+        }
+
+        // Prefer atomic modesetting so flips don't block, fall back to legacy SetPlane if unavailable
+        ctx->atomic = create_lease(ctx);
+        if (!ctx->atomic) {
+            vpilog("Using legacy plane updates\n");
+        }
+
+        ctx->fb_cache_usable = check_dma_buf_has_unique_inode(desc->objects[0].fd);
+        if (!ctx->fb_cache_usable) {
+            vpilog("dma-bufs don't have unique inodes, framebuffers won't be cached\n");
+        }
+    }
+
+    // Only one flip can be outstanding at a time
+    if (ctx->flip_pending) {
+        wait_for_flip(ctx, FLIP_TIMEOUT_MS);
+        if (ctx->flip_pending) {
+            vpilog("Timed out waiting for page flip\n");
+            return 0;
+        }
+    }
+
+    uint32_t fb = get_fb(ctx, frame);
+    if (!fb) {
         return 0;
     }
 
-    if (drmModeSetPlane(ctx->fd, ctx->plane_id, ctx->crtc, new_fb, 0,
-                    0, 0, frame->width, frame->height,
-                    0, 0, frame->width << 16, frame->height << 16) != 0) {
-        vpilog("Failed to set plane: %s\n", strerror(errno));
+    // Take our own reference, the caller unrefs its frame as soon as we return
+    av_frame_unref(ctx->pending);
+    if (av_frame_ref(ctx->pending, frame) < 0) {
+        release_uncached_fb(ctx, fb);
         return 0;
     }
+    ctx->pending_fb = fb;
 
-    // Free old framebuffer
-    if (ctx->got_fb) {
-        drmModeRmFB(ctx->fd, ctx->fb_id);
+    if (ctx->atomic) {
+        if (!commit_atomic(ctx, fb, frame)) {
+            av_frame_unref(ctx->pending);
+            release_uncached_fb(ctx, fb);
+            ctx->pending_fb = 0;
+            return 0;
+        }
+        ctx->flip_pending = 1;
+    } else {
+        if (drmModeSetPlane(ctx->fd, ctx->plane_id, ctx->crtc, fb, 0,
+                        0, 0, frame->width, frame->height,
+                        0, 0, frame->width << 16, frame->height << 16) != 0) {
+            vpilog("Failed to set plane: %s\n", strerror(errno));
+            av_frame_unref(ctx->pending);
+            release_uncached_fb(ctx, fb);
+            ctx->pending_fb = 0;
+            return 0;
+        }
+
+        // Legacy SetPlane has latched by the time it returns
+        flip_done(ctx);
     }
-    ctx->fb_id = new_fb;
-    ctx->got_fb = 1;
 
     return 1;
 }
@@ -172,13 +504,20 @@ int vui_sdl_drm_initialize(vanilla_drm_ctx_t **c, SDL_Window *window)
     *c = ctx;
 
     memset(ctx, 0, sizeof(vanilla_drm_ctx_t));
+    ctx->fd = -1;
+    ctx->sdl_fd = -1;
+    ctx->lease_fd = -1;
+
+    ctx->on_screen = av_frame_alloc();
+    ctx->pending = av_frame_alloc();
 
     SDL_SysWMinfo wmi;
     SDL_VERSION(&wmi.version);
     if (!SDL_GetWindowWMInfo(window, &wmi)) return 0;
     if (wmi.subsystem != SDL_SYSWM_KMSDRM) return 0;
 
-    ctx->fd = wmi.info.kmsdrm.drm_fd;
+    ctx->sdl_fd = wmi.info.kmsdrm.drm_fd;
+    ctx->fd = ctx->sdl_fd;
 
 	int ret = 0;
 
@@ -194,6 +533,7 @@ int vui_sdl_drm_initialize(vanilla_drm_ctx_t **c, SDL_Window *window)
 
 				// Good! We can use this connector :)
 				ctx->crtc = crtc->crtc_id;
+				ctx->connector = c->connector_id;
 
                 for (int j = 0; j < res->count_crtcs; j++) {
                     if (res->crtcs[j] == crtc->crtc_id) {
@@ -214,13 +554,11 @@ int vui_sdl_drm_initialize(vanilla_drm_ctx_t **c, SDL_Window *window)
 	// Free DRM resources
 	drmModeFreeResources(res);
 
+    // Plane types are only visible with universal planes. This doesn't change anything else about
+    // SDL's fd, atomic is only enabled on the leased one.
+    drmSetClientCap(ctx->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
     ctx->got_plane = 0;
-    ctx->got_fb = 0;
-    for (size_t i = 0; i < MAX_HANDLE_CACHE; i++) {
-        vanilla_drm_handle_t *h = &ctx->handle_cache[i];
-        h->fd = -1;
-        h->handle = 0;
-    }
 
     return ret;
 }
@@ -230,24 +568,31 @@ int vui_sdl_drm_free(vanilla_drm_ctx_t **c)
     vanilla_drm_ctx_t *ctx = *c;
     *c = NULL;
 
-    struct drm_gem_close gem_close = {0};
-    for (size_t i = 0; i < ctx->handle_cache_count; i++) {
-        vanilla_drm_handle_t *h = &ctx->handle_cache[i];
-        gem_close.handle = h->handle;
-        drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
-        h->handle = 0;
-        h->fd = -1;
+    // Let any outstanding flip land before tearing down its framebuffer
+    if (ctx->flip_pending) {
+        wait_for_flip(ctx, FLIP_TIMEOUT_MS);
     }
 
-    if (ctx->got_fb) {
-        drmModeRmFB(ctx->fd, ctx->fb_id);
-        ctx->got_fb = 0;
+    for (size_t i = 0; i < ctx->fb_cache_count; i++) {
+        drmModeRmFB(ctx->fd, ctx->fb_cache[i].fb_id);
     }
+    ctx->fb_cache_count = 0;
+
+    release_uncached_fb(ctx, ctx->on_screen_fb);
+    release_uncached_fb(ctx, ctx->pending_fb);
+
+    av_frame_free(&ctx->on_screen);
+    av_frame_free(&ctx->pending);
 
     ctx->got_plane = 0;
 
+    // Closing the lessee revokes the lease
+    if (ctx->lease_fd >= 0) {
+        close(ctx->lease_fd);
+    }
+
 	// Close DRM (now owned by SDL so don't do this)
-	// drmClose(ctx->fd);
+	// drmClose(ctx->sdl_fd);
 
     free(ctx);
 
@@ -0,0 +1,150 @@
+#include "ui_sdl_geom.h"
+
+#include <math.h>
+#include <string.h>
+
+// Unit quarter circle, shared by every corner
+static float corner_cos[VUI_SDL_CORNER_SEGMENTS + 1];
+static float corner_sin[VUI_SDL_CORNER_SEGMENTS + 1];
+static int corner_ready = 0;
+
+static void init_corner_fan()
+{
+    if (corner_ready) {
+        return;
+    }
+
+    for (int i = 0; i <= VUI_SDL_CORNER_SEGMENTS; i++) {
+        float a = (float) M_PI_2 * i / VUI_SDL_CORNER_SEGMENTS;
+        corner_cos[i] = cosf(a);
+        corner_sin[i] = sinf(a);
+    }
+
+    corner_ready = 1;
+}
+
+static void set_vertex(SDL_Vertex *v, float x, float y, SDL_Color color)
+{
+    v->position.x = x;
+    v->position.y = y;
+    v->color = color;
+    v->tex_coord.x = 0;
+    v->tex_coord.y = 0;
+}
+
+static int shape_matches(const vui_sdl_shape_t *shape, const SDL_Rect *rect, int radius, SDL_Color color)
+{
+    return shape->valid
+        && !memcmp(&shape->rect, rect, sizeof(SDL_Rect))
+        && shape->radius == radius
+        && !memcmp(&shape->color, &color, sizeof(SDL_Color));
+}
+
+static void shape_set_key(vui_sdl_shape_t *shape, const SDL_Rect *rect, int radius, SDL_Color color)
+{
+    shape->valid = 1;
+    shape->rect = *rect;
+    shape->radius = radius;
+    shape->color = color;
+}
+
+static void shape_quad(vui_sdl_shape_t *shape, const SDL_Rect *rect, SDL_Color left, SDL_Color right)
+{
+    float x0 = rect->x;
+    float y0 = rect->y;
+    float x1 = rect->x + rect->w;
+    float y1 = rect->y + rect->h;
+
+    set_vertex(&shape->verts[0], x0, y0, left);
+    set_vertex(&shape->verts[1], x1, y0, right);
+    set_vertex(&shape->verts[2], x1, y1, right);
+    set_vertex(&shape->verts[3], x0, y1, left);
+    shape->vert_count = 4;
+
+    static const int quad_indices[] = {0, 1, 2, 0, 2, 3};
+    memcpy(shape->indices, quad_indices, sizeof(quad_indices));
+    shape->index_count = 6;
+}
+
+void vui_sdl_shape_rounded_rect(vui_sdl_shape_t *shape, const SDL_Rect *rect, int radius, SDL_Color color)
+{
+    if (shape_matches(shape, rect, radius, color)) {
+        return;
+    }
+    shape_set_key(shape, rect, radius, color);
+
+    float r = radius;
+    if (r > rect->w / 2.0f) r = rect->w / 2.0f;
+    if (r > rect->h / 2.0f) r = rect->h / 2.0f;
+
+    if (r <= 0) {
+        shape_quad(shape, rect, color, color);
+        return;
+    }
+
+    init_corner_fan();
+
+    // Corner centers, clockwise from the top left
+    const float cx[4] = {rect->x + r, rect->x + rect->w - r, rect->x + rect->w - r, rect->x + r};
+    const float cy[4] = {rect->y + r, rect->y + r, rect->y + rect->h - r, rect->y + rect->h - r};
+
+    // The shape is convex, so a fan around the middle covers it
+    set_vertex(&shape->verts[0], rect->x + rect->w / 2.0f, rect->y + rect->h / 2.0f, color);
+    int n = 1;
+    for (int c = 0; c < 4; c++) {
+        for (int i = 0; i <= VUI_SDL_CORNER_SEGMENTS; i++) {
+            // Each corner sweeps a quarter turn, starting where the last one ended
+            float dx, dy;
+            switch (c) {
+            case 0: dx = -corner_cos[i]; dy = -corner_sin[i]; break;
+            case 1: dx =  corner_sin[i]; dy = -corner_cos[i]; break;
+            case 2: dx =  corner_cos[i]; dy =  corner_sin[i]; break;
+            default: dx = -corner_sin[i]; dy =  corner_cos[i]; break;
+            }
+            set_vertex(&shape->verts[n], cx[c] + dx * r, cy[c] + dy * r, color);
+            n++;
+        }
+    }
+    shape->vert_count = n;
+
+    int outline = n - 1;
+    shape->index_count = 0;
+    for (int i = 0; i < outline; i++) {
+        shape->indices[shape->index_count++] = 0;
+        shape->indices[shape->index_count++] = 1 + i;
+        shape->indices[shape->index_count++] = 1 + (i + 1) % outline;
+    }
+}
+
+void vui_sdl_shape_gradient_rect(vui_sdl_shape_t *shape, const SDL_Rect *rect, SDL_Color left, SDL_Color right)
+{
+    if (shape_matches(shape, rect, 0, left) && !memcmp(&shape->verts[1].color, &right, sizeof(SDL_Color))) {
+        return;
+    }
+    shape_set_key(shape, rect, 0, left);
+    shape_quad(shape, rect, left, right);
+}
+
+void vui_sdl_batch_add(SDL_Renderer *renderer, vui_sdl_batch_t *batch, const vui_sdl_shape_t *shape)
+{
+    if (batch->vert_count + shape->vert_count > (int) (sizeof(batch->verts) / sizeof(SDL_Vertex))
+        || batch->index_count + shape->index_count > (int) (sizeof(batch->indices) / sizeof(int))) {
+        vui_sdl_batch_flush(renderer, batch);
+    }
+
+    memcpy(batch->verts + batch->vert_count, shape->verts, shape->vert_count * sizeof(SDL_Vertex));
+    for (int i = 0; i < shape->index_count; i++) {
+        batch->indices[batch->index_count + i] = shape->indices[i] + batch->vert_count;
+    }
+    batch->vert_count += shape->vert_count;
+    batch->index_count += shape->index_count;
+}
+
+void vui_sdl_batch_flush(SDL_Renderer *renderer, vui_sdl_batch_t *batch)
+{
+    if (batch->index_count) {
+        SDL_RenderGeometry(renderer, NULL, batch->verts, batch->vert_count, batch->indices, batch->index_count);
+    }
+    batch->vert_count = 0;
+    batch->index_count = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef VPI_UI_SDL_GEOM_H
+#define VPI_UI_SDL_GEOM_H
+
+#include <SDL2/SDL.h>
+
+// Segments used to approximate each quarter circle of a rounded corner
+#define VUI_SDL_CORNER_SEGMENTS 8
+
+#define VUI_SDL_SHAPE_MAX_VERTS (4 * (VUI_SDL_CORNER_SEGMENTS + 1) + 1)
+#define VUI_SDL_SHAPE_MAX_INDICES (4 * (VUI_SDL_CORNER_SEGMENTS + 1) * 3)
+
+// Triangles for one UI element, only rebuilt when its geometry or color changes
+typedef struct {
+    int valid;
+    SDL_Rect rect;
+    int radius;
+    SDL_Color color;
+
+    SDL_Vertex verts[VUI_SDL_SHAPE_MAX_VERTS];
+    int vert_count;
+    int indices[VUI_SDL_SHAPE_MAX_INDICES];
+    int index_count;
+} vui_sdl_shape_t;
+
+#define VUI_SDL_BATCH_SHAPES 32
+
+// Shapes collected for one render target and submitted as a single draw call
+typedef struct {
+    SDL_Vertex verts[VUI_SDL_BATCH_SHAPES * VUI_SDL_SHAPE_MAX_VERTS];
+    int vert_count;
+    int indices[VUI_SDL_BATCH_SHAPES * VUI_SDL_SHAPE_MAX_INDICES];
+    int index_count;
+} vui_sdl_batch_t;
+
+void vui_sdl_shape_rounded_rect(vui_sdl_shape_t *shape, const SDL_Rect *rect, int radius, SDL_Color color);
+void vui_sdl_shape_gradient_rect(vui_sdl_shape_t *shape, const SDL_Rect *rect, SDL_Color left, SDL_Color right);
+
+void vui_sdl_batch_add(SDL_Renderer *renderer, vui_sdl_batch_t *batch, const vui_sdl_shape_t *shape);
+void vui_sdl_batch_flush(SDL_Renderer *renderer, vui_sdl_batch_t *batch);
+
+#endif // VPI_UI_SDL_GEOM_H
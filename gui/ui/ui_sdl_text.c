@@ -0,0 +1,374 @@
+#include "ui_sdl_text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define ATLAS_WIDTH 1024
+#define ATLAS_HEIGHT 512
+#define ATLAS_PADDING 1
+#define GLYPH_TABLE_SIZE 1024 // Must be a power of two
+
+typedef struct {
+    uint32_t cp;
+    int used;
+    int valid;
+    SDL_Rect rect;
+    int advance;
+} vui_sdl_glyph_t;
+
+struct vui_sdl_glyph_atlas_t {
+    SDL_Renderer *renderer;
+    TTF_Font *font;
+    SDL_Texture *texture;
+    int line_skip;
+
+    int pen_x;
+    int pen_y;
+    int row_h;
+
+    // Bumped whenever the atlas is cleared, so layouts know to rebuild
+    unsigned int generation;
+
+    vui_sdl_glyph_t glyphs[GLYPH_TABLE_SIZE];
+    int glyph_count;
+};
+
+static uint32_t decode_utf8(const char **s)
+{
+    const uint8_t *p = (const uint8_t *) *s;
+    uint32_t cp;
+    int extra;
+
+    if (p[0] >= 0xF0) {
+        cp = p[0] & 0x07;
+        extra = 3;
+    } else if (p[0] >= 0xE0) {
+        cp = p[0] & 0x0F;
+        extra = 2;
+    } else if (p[0] >= 0xC0) {
+        cp = p[0] & 0x1F;
+        extra = 1;
+    } else {
+        cp = p[0];
+        extra = 0;
+    }
+
+    p++;
+    for (int i = 0; i < extra && (*p & 0xC0) == 0x80; i++) {
+        cp = (cp << 6) | (*p & 0x3F);
+        p++;
+    }
+
+    *s = (const char *) p;
+    return cp;
+}
+
+static void atlas_clear(vui_sdl_glyph_atlas_t *atlas)
+{
+    memset(atlas->glyphs, 0, sizeof(atlas->glyphs));
+    atlas->glyph_count = 0;
+    atlas->pen_x = 0;
+    atlas->pen_y = 0;
+    atlas->row_h = 0;
+    atlas->generation++;
+}
+
+vui_sdl_glyph_atlas_t *vui_sdl_atlas_create(SDL_Renderer *renderer, TTF_Font *font)
+{
+    vui_sdl_glyph_atlas_t *atlas = malloc(sizeof(vui_sdl_glyph_atlas_t));
+    if (!atlas) {
+        return NULL;
+    }
+
+    memset(atlas, 0, sizeof(vui_sdl_glyph_atlas_t));
+    atlas->renderer = renderer;
+    atlas->font = font;
+    atlas->line_skip = TTF_FontLineSkip(font);
+
+    // Glyphs are rendered white and tinted with the texture's color mod when drawn
+    atlas->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, ATLAS_WIDTH, ATLAS_HEIGHT);
+    if (!atlas->texture) {
+        vpilog("Failed to create glyph atlas: %s\n", SDL_GetError());
+        free(atlas);
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+
+    // Start out transparent
+    void *blank = calloc(ATLAS_WIDTH * ATLAS_HEIGHT, 4);
+    if (blank) {
+        SDL_UpdateTexture(atlas->texture, NULL, blank, ATLAS_WIDTH * 4);
+        free(blank);
+    }
+
+    return atlas;
+}
+
+void vui_sdl_atlas_free(vui_sdl_glyph_atlas_t *atlas)
+{
+    if (atlas) {
+        SDL_DestroyTexture(atlas->texture);
+        free(atlas);
+    }
+}
+
+static int atlas_insert(vui_sdl_glyph_atlas_t *atlas, vui_sdl_glyph_t *g)
+{
+    static const SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+
+    int minx, maxx, miny, maxy, advance;
+    if (TTF_GlyphMetrics32(atlas->font, g->cp, &minx, &maxx, &miny, &maxy, &advance) != 0) {
+        return 0;
+    }
+    g->advance = advance;
+
+    // Whitespace and the like have nothing to draw
+    SDL_Surface *surface = TTF_RenderGlyph32_Blended(atlas->font, g->cp, white);
+    if (!surface) {
+        return 1;
+    }
+
+    if (atlas->pen_x + surface->w > ATLAS_WIDTH) {
+        atlas->pen_x = 0;
+        atlas->pen_y += atlas->row_h + ATLAS_PADDING;
+        atlas->row_h = 0;
+    }
+
+    if (atlas->pen_y + surface->h > ATLAS_HEIGHT || surface->w > ATLAS_WIDTH) {
+        SDL_FreeSurface(surface);
+        return -1;
+    }
+
+    g->rect.x = atlas->pen_x;
+    g->rect.y = atlas->pen_y;
+    g->rect.w = surface->w;
+    g->rect.h = surface->h;
+
+    SDL_Surface *converted = surface;
+    if (surface->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    }
+    if (converted) {
+        SDL_UpdateTexture(atlas->texture, &g->rect, converted->pixels, converted->pitch);
+        if (converted != surface) {
+            SDL_FreeSurface(converted);
+        }
+    }
+    SDL_FreeSurface(surface);
+
+    atlas->pen_x += g->rect.w + ATLAS_PADDING;
+    if (g->rect.h > atlas->row_h) {
+        atlas->row_h = g->rect.h;
+    }
+
+    g->valid = 1;
+    return 1;
+}
+
+static vui_sdl_glyph_t *atlas_get(vui_sdl_glyph_atlas_t *atlas, uint32_t cp)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        uint32_t i = (cp * 2654435761u) & (GLYPH_TABLE_SIZE - 1);
+        while (atlas->glyphs[i].used) {
+            if (atlas->glyphs[i].cp == cp) {
+                return &atlas->glyphs[i];
+            }
+            i = (i + 1) & (GLYPH_TABLE_SIZE - 1);
+        }
+
+        // Keep the table at most 3/4 full
+        if (atlas->glyph_count < GLYPH_TABLE_SIZE * 3 / 4) {
+            vui_sdl_glyph_t *g = &atlas->glyphs[i];
+            g->cp = cp;
+            g->used = 1;
+            atlas->glyph_count++;
+
+            // A glyph the font can't provide, or one too big for even an empty
+            // atlas, is remembered as having nothing to draw
+            int r = atlas_insert(atlas, g);
+            if (r >= 0 || atlas->glyph_count == 1) {
+                return g;
+            }
+        }
+
+        // Out of space, start over. Anything laid out earlier gets rebuilt.
+        atlas_clear(atlas);
+    }
+
+    return NULL;
+}
+
+void vui_sdl_text_layout(vui_sdl_text_t *t, vui_sdl_glyph_atlas_t *atlas, const char *text, int wrap_w)
+{
+    if (t->atlas == atlas && t->generation == atlas->generation && t->wrap_w == wrap_w && !strcmp(t->text, text)) {
+        return;
+    }
+
+restart:
+    t->atlas = atlas;
+    t->generation = atlas->generation;
+    t->wrap_w = wrap_w;
+    strncpy(t->text, text, sizeof(t->text));
+    t->text[sizeof(t->text) - 1] = 0;
+
+    // Look up every glyph and its advance, including kerning with the one before
+    uint32_t cps[MAX_BUTTON_TEXT];
+    vui_sdl_glyph_t *glyphs[MAX_BUTTON_TEXT];
+    int advances[MAX_BUTTON_TEXT];
+    int count = 0;
+    const char *s = t->text;
+    while (*s && count < MAX_BUTTON_TEXT) {
+        cps[count] = decode_utf8(&s);
+        glyphs[count] = atlas_get(atlas, cps[count]);
+        if (t->generation != atlas->generation) {
+            // Atlas had to be cleared part way through
+            goto restart;
+        }
+        advances[count] = glyphs[count] ? glyphs[count]->advance : 0;
+        if (count > 0 && cps[count] != '\n' && cps[count - 1] != '\n') {
+            advances[count - 1] += TTF_GetFontKerningSizeGlyphs32(atlas->font, cps[count - 1], cps[count]);
+        }
+        count++;
+    }
+
+    // Break into lines, preferring to break at spaces
+    int line_start[MAX_BUTTON_TEXT + 1];
+    int line_end[MAX_BUTTON_TEXT + 1];
+    int line_w[MAX_BUTTON_TEXT + 1];
+    int lines = 0;
+
+    int start = 0;
+    while (start <= count && lines < MAX_BUTTON_TEXT) {
+        int width = 0;
+        int last_space = -1;
+        int i = start;
+        int next = count + 1;
+        int end = count;
+        for (; i < count; i++) {
+            if (cps[i] == '\n') {
+                end = i;
+                next = i + 1;
+                break;
+            }
+            if (cps[i] == ' ') {
+                last_space = i;
+            }
+            if (wrap_w > 0 && width + advances[i] > wrap_w && i > start) {
+                if (last_space > start) {
+                    end = last_space;
+                    next = last_space + 1;
+                } else {
+                    end = i;
+                    next = i;
+                }
+                break;
+            }
+            width += advances[i];
+        }
+
+        line_w[lines] = 0;
+        for (int j = start; j < end; j++) {
+            line_w[lines] += advances[j];
+        }
+        line_start[lines] = start;
+        line_end[lines] = end;
+        lines++;
+
+        if (next > count) {
+            break;
+        }
+        start = next;
+    }
+
+    // Place glyphs
+    int max_w = 0;
+    for (int l = 0; l < lines; l++) {
+        if (line_w[l] > max_w) max_w = line_w[l];
+    }
+    t->w = (lines > 1 && wrap_w > 0) ? wrap_w : max_w;
+    t->h = lines > 0 ? (lines - 1) * atlas->line_skip + TTF_FontHeight(atlas->font) : 0;
+
+    t->quad_count = 0;
+    t->offset_count = 0;
+    for (int l = 0; l < lines; l++) {
+        int pen_x = (lines > 1) ? (t->w - line_w[l]) / 2 : 0;
+        int pen_y = l * atlas->line_skip;
+
+        for (int i = line_start[l]; i < line_end[l]; i++) {
+            if (l == 0) {
+                t->offsets[t->offset_count++] = pen_x;
+            }
+
+            vui_sdl_glyph_t *g = glyphs[i];
+            if (g && g->valid) {
+                vui_sdl_glyph_quad_t *q = &t->quads[t->quad_count++];
+                q->src = g->rect;
+                q->dst.x = pen_x;
+                q->dst.y = pen_y;
+                q->dst.w = g->rect.w;
+                q->dst.h = g->rect.h;
+            }
+            pen_x += advances[i];
+        }
+
+        if (l == 0) {
+            t->offsets[t->offset_count++] = pen_x;
+        }
+    }
+}
+
+void vui_sdl_text_draw(SDL_Renderer *renderer, const vui_sdl_text_t *t, int x, int y, const SDL_Rect *clip, SDL_Color color)
+{
+    if (!t->atlas || !t->quad_count) {
+        return;
+    }
+
+    SDL_Texture *texture = t->atlas->texture;
+    SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+    SDL_SetTextureAlphaMod(texture, color.a);
+
+    if (clip) {
+        SDL_RenderSetClipRect(renderer, clip);
+    }
+
+    for (int i = 0; i < t->quad_count; i++) {
+        SDL_Rect dst = t->quads[i].dst;
+        dst.x += x;
+        dst.y += y;
+        SDL_RenderCopy(renderer, texture, &t->quads[i].src, &dst);
+    }
+
+    if (clip) {
+        SDL_RenderSetClipRect(renderer, NULL);
+    }
+}
+
+int vui_sdl_text_cursor_x(const vui_sdl_text_t *t, int cursor)
+{
+    if (t->offset_count == 0) {
+        return 0;
+    }
+    if (cursor >= t->offset_count) {
+        cursor = t->offset_count - 1;
+    }
+    if (cursor < 0) {
+        cursor = 0;
+    }
+    return t->offsets[cursor];
+}
+
+int vui_sdl_text_hit_test(const vui_sdl_text_t *t, int x)
+{
+    int best = 0;
+    int best_diff = abs(x);
+    for (int i = 0; i < t->offset_count; i++) {
+        int diff = abs(t->offsets[i] - x);
+        if (diff < best_diff) {
+            best_diff = diff;
+            best = i;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,48 @@
+#ifndef VPI_UI_SDL_TEXT_H
+#define VPI_UI_SDL_TEXT_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "ui_priv.h"
+
+typedef struct vui_sdl_glyph_atlas_t vui_sdl_glyph_atlas_t;
+
+typedef struct {
+    SDL_Rect src;
+    SDL_Rect dst;
+} vui_sdl_glyph_quad_t;
+
+// Text laid out against an atlas. Only rebuilt when the text, wrap width or
+// atlas contents change, drawing is then just a copy per glyph.
+typedef struct {
+    vui_sdl_glyph_atlas_t *atlas;
+    unsigned int generation;
+    char text[MAX_BUTTON_TEXT];
+    int wrap_w;
+
+    int w;
+    int h;
+    vui_sdl_glyph_quad_t quads[MAX_BUTTON_TEXT];
+    int quad_count;
+
+    // Pen position before each character of the first line, for cursor placement
+    int offsets[MAX_BUTTON_TEXT + 1];
+    int offset_count;
+} vui_sdl_text_t;
+
+vui_sdl_glyph_atlas_t *vui_sdl_atlas_create(SDL_Renderer *renderer, TTF_Font *font);
+void vui_sdl_atlas_free(vui_sdl_glyph_atlas_t *atlas);
+
+/**
+ * Lay out `text` with `atlas`, wrapping at `wrap_w` (0 for a single line)
+ *
+ * Multi-line text is centered within the wrap width, like TTF_WRAPPED_ALIGN_CENTER. Does nothing if
+ * the layout is already up to date.
+ */
+void vui_sdl_text_layout(vui_sdl_text_t *t, vui_sdl_glyph_atlas_t *atlas, const char *text, int wrap_w);
+void vui_sdl_text_draw(SDL_Renderer *renderer, const vui_sdl_text_t *t, int x, int y, const SDL_Rect *clip, SDL_Color color);
+int vui_sdl_text_cursor_x(const vui_sdl_text_t *t, int cursor);
+int vui_sdl_text_hit_test(const vui_sdl_text_t *t, int x);
+
+#endif // VPI_UI_SDL_TEXT_H
@@ -28,6 +28,9 @@ char wireless_interface[128];
 uint8_t *EVENT_BUFFER_ARENA[EVENT_BUFFER_ARENA_SIZE] = {0};
 pthread_mutex_t event_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Cleared once the arena is freed, buffers the frontend hands back after that are just freed
+static int event_buffer_arena_active = 0;
+
 static inline int skterr()
 {
 #ifdef _WIN32
@@ -355,7 +358,6 @@ void connect_as_gamepad_internal(thread_data_t *data)
                 }
             } else if (connected_state.control_code == VANILLA_PIPE_CC_CONNECTED) {
                 ret = VANILLA_SUCCESS;
-                sleep(1);
                 break;
             }
 
@@ -390,13 +392,31 @@ void connect_as_gamepad_internal(thread_data_t *data)
             if (read_size > 0) {
                 switch (pipe_state.control_code) {
                 case VANILLA_PIPE_CC_DISCONNECTED:
+                    // Sockets stay open across the drop, the pipe will let us
+                    // know when the link is back
+                    mark_video_link_lost();
                     cnn = VANILLA_ERR_DISCONNECTED;
                     push_event(data->event_loop, VANILLA_EVENT_ERROR, &cnn, sizeof(cnn));
                     break;
                 case VANILLA_PIPE_CC_CONNECTED:
+                    // Decoder state is stale after a drop, so ask for a fresh IDR right away
+                    request_idr();
                     cnn = VANILLA_ERR_CONNECTED;
                     push_event(data->event_loop, VANILLA_EVENT_ERROR, &cnn, sizeof(cnn));
                     break;
+                case VANILLA_PIPE_CC_LINK_STATS:
+                {
+                    vanilla_link_stats_t stats;
+                    stats.rssi = (int32_t) ntohl(pipe_state.link_stats.rssi);
+                    stats.noise = (int32_t) ntohl(pipe_state.link_stats.noise);
+                    stats.link_speed = (int32_t) ntohl(pipe_state.link_stats.link_speed);
+                    stats.frequency = (int32_t) ntohl(pipe_state.link_stats.frequency);
+                    stats.tx_good = ntohl(pipe_state.link_stats.tx_good);
+                    stats.tx_bad = ntohl(pipe_state.link_stats.tx_bad);
+                    stats.rx_good = ntohl(pipe_state.link_stats.rx_good);
+                    push_event(data->event_loop, VANILLA_EVENT_LINK_STATS, &stats, sizeof(stats));
+                    break;
+                }
                 }
             }
         }
@@ -449,6 +469,7 @@ int acquire_event(event_loop_t *loop, vanilla_event_t **event)
 		vanilla_free_event(&loop->events[loop->used_index % VANILLA_MAX_EVENT_COUNT]);
 		vanilla_log("SKIPPED EVENT TO PREVENT ROLLOVER (%lu > %lu + %lu)", loop->new_index, loop->used_index, VANILLA_MAX_EVENT_COUNT);
 		loop->used_index++;
+		atomic_fetch_sub_explicit(&loop->depth, 1, memory_order_relaxed);
 	}
 
 	vanilla_event_t *ev = &loop->events[loop->new_index % VANILLA_MAX_EVENT_COUNT];
@@ -468,7 +489,12 @@ int acquire_event(event_loop_t *loop, vanilla_event_t **event)
 
 int release_event(event_loop_t *loop)
 {
+    // Zero the tail so the data can be handed straight to decoders that read past the end
+    vanilla_event_t *ev = &loop->events[loop->new_index % VANILLA_MAX_EVENT_COUNT];
+    memset(ev->data + ev->size, 0, VANILLA_EVENT_BUFFER_PADDING);
+
 	loop->new_index++;
+	atomic_fetch_add_explicit(&loop->depth, 1, memory_order_relaxed);
 
     pthread_cond_broadcast(&loop->waitcond);
 
@@ -525,6 +551,7 @@ int get_event(event_loop_t *loop, vanilla_event_t *event, int wait)
             pull_event->data = NULL;
 
             loop->used_index++;
+            atomic_fetch_sub_explicit(&loop->depth, 1, memory_order_relaxed);
             ret = 1;
         }
     }
@@ -548,40 +575,66 @@ void *get_event_buffer()
         }
     pthread_mutex_unlock(&event_buffer_mutex);
 
+    // Frontends may hold on to buffers (e.g. inside a decoder or muxer queue),
+    // so don't fail if the arena is temporarily exhausted
+    if (!buf) {
+        buf = malloc(EVENT_BUFFER_SIZE + VANILLA_EVENT_BUFFER_PADDING);
+    }
+
     return buf;
 }
 
 void release_event_buffer(void *buffer)
 {
     pthread_mutex_lock(&event_buffer_mutex);
-    for (size_t i = 0; i < EVENT_BUFFER_ARENA_SIZE; i++) {
+    for (size_t i = 0; event_buffer_arena_active && i < EVENT_BUFFER_ARENA_SIZE; i++) {
         if (!EVENT_BUFFER_ARENA[i]) {
             EVENT_BUFFER_ARENA[i] = buffer;
+            buffer = NULL;
             break;
         }
     }
     pthread_mutex_unlock(&event_buffer_mutex);
+
+    // Arena is full or gone, this must have been an overflow allocation or outlived the session
+    if (buffer) {
+        free(buffer);
+    }
 }
 
 void init_event_buffer_arena()
 {
+    pthread_mutex_lock(&event_buffer_mutex);
     for (size_t i = 0; i < EVENT_BUFFER_ARENA_SIZE; i++) {
         if (!EVENT_BUFFER_ARENA[i]) {
-            EVENT_BUFFER_ARENA[i] = malloc(EVENT_BUFFER_SIZE);
+            EVENT_BUFFER_ARENA[i] = malloc(EVENT_BUFFER_SIZE + VANILLA_EVENT_BUFFER_PADDING);
         } else {
             vanilla_log("CRITICAL: Buffer wasn't returned to the arena");
         }
     }
+    event_buffer_arena_active = 1;
+    pthread_mutex_unlock(&event_buffer_mutex);
 }
 
 void free_event_buffer_arena()
 {
+    // Decoders may still reference some buffers, e.g. FFmpeg packets wrapping them. Those can't
+    // be waited for from here, so whatever is still out gets freed on release instead.
+    size_t outstanding = 0;
+
+    pthread_mutex_lock(&event_buffer_mutex);
+    event_buffer_arena_active = 0;
     for (size_t i = 0; i < EVENT_BUFFER_ARENA_SIZE; i++) {
         if (EVENT_BUFFER_ARENA[i]) {
             free(EVENT_BUFFER_ARENA[i]);
             EVENT_BUFFER_ARENA[i] = NULL;
         } else {
-            vanilla_log("CRITICAL: Buffer wasn't returned to the arena");
+            outstanding++;
         }
     }
+    pthread_mutex_unlock(&event_buffer_mutex);
+
+    if (outstanding) {
+        vanilla_log("%zu event buffers still held by the frontend, they'll be freed when released", outstanding);
+    }
 }
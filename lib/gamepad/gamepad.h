@@ -2,6 +2,7 @@
 #define VANILLA_GAMEPAD_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -28,6 +29,7 @@ typedef struct
     vanilla_event_t events[VANILLA_MAX_EVENT_COUNT];
     size_t new_index;
     size_t used_index;
+    atomic_size_t depth; // new_index - used_index, readable without the mutex
     int active;
     pthread_mutex_t mutex;
     pthread_cond_t waitcond;
@@ -88,6 +88,18 @@ void set_button_state(int button, int32_t value)
     pthread_mutex_unlock(&button_mtx);
 }
 
+void set_button_states(const int *buttons, const int32_t *values, size_t count)
+{
+    // One lock for the lot, so the next input packet sees all of them or none
+    pthread_mutex_lock(&button_mtx);
+    for (size_t i = 0; i < count; i++) {
+        if (buttons[i] >= 0 && buttons[i] < VANILLA_BTN_COUNT) {
+            current_buttons[buttons[i]] = values[i];
+        }
+    }
+    pthread_mutex_unlock(&button_mtx);
+}
+
 void set_touch_state(int x, int y)
 {
     pthread_mutex_lock(&button_mtx);
@@ -1,10 +1,12 @@
 #ifndef GAMEPAD_INPUT_H
 #define GAMEPAD_INPUT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 void *listen_input(void *x);
 void set_button_state(int button, int32_t value);
+void set_button_states(const int *buttons, const int32_t *values, size_t count);
 void set_touch_state(int x, int y);
 void set_battery_status(int status);
 
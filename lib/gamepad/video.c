@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,15 @@ typedef struct
 static pthread_mutex_t idr_mutex;
 static int idr_is_queued = 0;
 
+static pthread_mutex_t link_lost_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t link_lost_time = 0;
+
+// Cumulative, read by the frontend through vanilla_get_stream_stats()
+static atomic_uint_fast64_t stats_frames_received = 0;
+static atomic_uint_fast64_t stats_frames_incomplete = 0;
+static atomic_uint_fast64_t stats_frames_dropped = 0;
+static atomic_uint_fast64_t stats_idr_requests = 0;
+
 #define VIDEO_PACKET_QUEUE_MAX 1024
 static VideoPacket video_packet_queue[VIDEO_PACKET_QUEUE_MAX];
 static size_t video_packet_min = 0;
@@ -63,11 +73,29 @@ void request_idr()
     pthread_mutex_unlock(&idr_mutex);
 }
 
+void mark_video_link_lost()
+{
+    pthread_mutex_lock(&link_lost_mutex);
+    link_lost_time = get_millis();
+    pthread_mutex_unlock(&link_lost_mutex);
+}
+
+static void report_link_recovery()
+{
+    pthread_mutex_lock(&link_lost_mutex);
+    if (link_lost_time) {
+        vanilla_log("RECOVERED FROM LINK LOSS: FIRST FRAME AFTER %zu MS", get_millis() - link_lost_time);
+        link_lost_time = 0;
+    }
+    pthread_mutex_unlock(&link_lost_mutex);
+}
+
 void send_idr_request_to_console(int socket_msg)
 {
     // Make an IDR request to the Wii U?
     unsigned char idr_request[] = {1, 0, 0, 0}; // Undocumented
     vanilla_log("SENDING IDR");
+    atomic_fetch_add_explicit(&stats_idr_requests, 1, memory_order_relaxed);
     send_to_console(socket_msg, idr_request, sizeof(idr_request), PORT_MSG);
 }
 
@@ -177,10 +205,17 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
     static int video_packet_seq = -1;
     static int video_packet_seq_end = -1;
     static int video_complete_frame = 0;
+    static int video_frame_open = 0; // Begun but not yet reassembled
 
 	static uint8_t frame_decode_num = 0;
 
     if (vp->frame_begin) {
+        // Packets can arrive out of order, so a frame only counts as incomplete once the next one starts
+        if (video_frame_open) {
+            atomic_fetch_add_explicit(&stats_frames_incomplete, 1, memory_order_relaxed);
+        }
+        video_frame_open = 0;
+
         video_packet_seq = vp->seq_id;
         video_packet_seq_end = -1;
 
@@ -189,11 +224,14 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 		frame_decode_num++;
 
         if (!video_complete_frame && !is_idr) {
+            // Can't decode anything until the next IDR
+            atomic_fetch_add_explicit(&stats_frames_dropped, 1, memory_order_relaxed);
             send_idr_request_to_console(ctx->socket_msg);
             return;
         }
 
         video_complete_frame = 0;
+        video_frame_open = 1;
     }
 
     pthread_mutex_lock(&idr_mutex);
@@ -230,6 +268,7 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 
         if (complete_frame) {
             video_complete_frame = 1;
+            video_frame_open = 0;
 
 			// Encapsulate packet data into NAL unit
 			vanilla_event_t *event;
@@ -344,12 +383,23 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 			// vanilla_log_no_newline("\n");
 
 			release_event(ctx->event_loop);
+            atomic_fetch_add_explicit(&stats_frames_received, 1, memory_order_relaxed);
+
+            report_link_recovery();
         } else {
             // We didn't receive the complete frame so we'll skip it here
         }
     }
 }
 
+void get_video_stats(uint64_t *received, uint64_t *incomplete, uint64_t *dropped, uint64_t *idr_requests)
+{
+    *received = atomic_load_explicit(&stats_frames_received, memory_order_relaxed);
+    *incomplete = atomic_load_explicit(&stats_frames_incomplete, memory_order_relaxed);
+    *dropped = atomic_load_explicit(&stats_frames_dropped, memory_order_relaxed);
+    *idr_requests = atomic_load_explicit(&stats_idr_requests, memory_order_relaxed);
+}
+
 void *consume_video_packets(void *data)
 {
     gamepad_context_t *ctx = (gamepad_context_t *) data;
@@ -6,6 +6,8 @@
 
 void *listen_video(void *x);
 void request_idr();
+void mark_video_link_lost();
+void get_video_stats(uint64_t *received, uint64_t *incomplete, uint64_t *dropped, uint64_t *idr_requests);
 size_t generate_sps_params(void *data, size_t size);
 size_t generate_pps_params(void *data, size_t size);
 size_t generate_h264_header(void *data, size_t size);
@@ -22,7 +22,7 @@
 
 pthread_mutex_t main_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t gamepad_mutex = PTHREAD_MUTEX_INITIALIZER;
-event_loop_t event_loop = {{0}, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+event_loop_t event_loop = {{0}, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
 
 void *start_event_loop(void *arg)
 {
@@ -46,6 +46,7 @@ void *start_event_loop(void *arg)
     event_loop.active = 1;
     event_loop.new_index = 0;
     event_loop.used_index = 0;
+    atomic_store_explicit(&event_loop.depth, 0, memory_order_relaxed);
     for (int i = 0; i < VANILLA_MAX_EVENT_COUNT; i++) {
         event_loop.events[i].data = NULL;
     }
@@ -68,6 +69,7 @@ void *start_event_loop(void *arg)
         vanilla_free_event(pull_event);
         event_loop.used_index++;
     }
+    atomic_store_explicit(&event_loop.depth, 0, memory_order_relaxed);
 
     free_event_buffer_arena();
     pthread_cond_broadcast(&event_loop.waitcond);
@@ -137,6 +139,11 @@ void vanilla_set_button(int button, int32_t value)
     set_button_state(button, value);
 }
 
+void vanilla_set_buttons(const int *buttons, const int32_t *values, size_t count)
+{
+    set_button_states(buttons, values, count);
+}
+
 void vanilla_set_touch(int x, int y)
 {
     set_touch_state(x, y);
@@ -236,6 +243,13 @@ int vanilla_free_event(vanilla_event_t *event)
     return VANILLA_SUCCESS;
 }
 
+void vanilla_release_event_data(uint8_t *data)
+{
+    if (data) {
+        release_event_buffer(data);
+    }
+}
+
 size_t vanilla_generate_sps_params(void *data, size_t data_size)
 {
     return generate_sps_params(data, data_size);
@@ -256,6 +270,13 @@ void vanilla_send_audio(const void *data, size_t size)
     send_audio_packet(data, size);
 }
 
+void vanilla_get_stream_stats(vanilla_stream_stats_t *stats)
+{
+    get_video_stats(&stats->frames_received, &stats->frames_incomplete, &stats->frames_dropped, &stats->idr_requests);
+
+    stats->event_queue_depth = atomic_load_explicit(&event_loop.depth, memory_order_relaxed);
+}
+
 void vanilla_set_wireless_interface(const char *intf)
 {
     strcpy(wireless_interface, intf);
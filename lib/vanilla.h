@@ -22,6 +22,8 @@ extern "C" {
 #define VANILLA_ERR_CONNECTED           -10
 #define VANILLA_ERR_DISCONNECTED        -11
 
+#define VANILLA_EVENT_BUFFER_PADDING    64
+
 static const uint32_t VANILLA_ADDRESS_LOCAL = 0xFFFFFFFF;
 
 enum VanillaGamepadButtons
@@ -74,7 +76,8 @@ enum VanillaEvent
     VANILLA_EVENT_VIBRATE,
     VANILLA_EVENT_SYNC,
     VANILLA_EVENT_ERROR,
-	VANILLA_EVENT_MIC
+	VANILLA_EVENT_MIC,
+    VANILLA_EVENT_LINK_STATS
 };
 
 enum VanillaRegion
@@ -116,8 +119,25 @@ typedef struct {
     int status;
     vanilla_connection_t data;
 } vanilla_sync_event_t;
+typedef struct {
+    int32_t rssi;       // dBm
+    int32_t noise;      // dBm, 9999 if the driver doesn't report it
+    int32_t link_speed; // Mbps
+    int32_t frequency;  // MHz
+    uint32_t tx_good;   // Cumulative packet counters since association
+    uint32_t tx_bad;
+    uint32_t rx_good;
+} vanilla_link_stats_t;
 #pragma pack(pop)
 
+typedef struct {
+    uint64_t frames_received;   // Complete frames handed to the frontend
+    uint64_t frames_incomplete; // Frames with packets missing
+    uint64_t frames_dropped;    // Frames thrown away while waiting for an IDR
+    uint64_t idr_requests;      // IDR requests sent to the console
+    size_t event_queue_depth;   // Events waiting for vanilla_poll_event()/vanilla_wait_event()
+} vanilla_stream_stats_t;
+
 /**
  * Start listening for gamepad commands
  */
@@ -133,6 +153,17 @@ int vanilla_poll_event(vanilla_event_t *event);
 int vanilla_wait_event(vanilla_event_t *event);
 int vanilla_free_event(vanilla_event_t *event);
 
+/**
+ * Return an event's data buffer to libvanilla
+ *
+ * Ownership of `event->data` passes to the caller when an event is retrieved. Instead of calling
+ * vanilla_free_event(), the caller may take the buffer (setting `event->data` to NULL) and release
+ * it later with this function, e.g. from an AVBuffer free callback, to avoid copying it.
+ *
+ * Event data is always followed by VANILLA_EVENT_BUFFER_PADDING zeroed bytes.
+ */
+void vanilla_release_event_data(uint8_t *data);
+
 /**
  * Attempt to stop the current action
  */
@@ -150,6 +181,14 @@ void vanilla_stop();
  */
 void vanilla_set_button(int button, int32_t value);
 
+/**
+ * Set several button/axis states at once
+ *
+ * Same as calling vanilla_set_button() for each of the `count` pairs in `buttons` and `values`, except
+ * they're applied together, e.g. all three axes of a sensor reading end up in the same input packet.
+ */
+void vanilla_set_buttons(const int *buttons, const int32_t *values, size_t count);
+
 /**
  * Set touch screen coordinates to `x` and `y`
  *
@@ -203,6 +242,14 @@ size_t vanilla_generate_h264_header(void *data, size_t size);
  */
 void vanilla_send_audio(const void *data, size_t size);
 
+/**
+ * Get counters describing how the stream is doing
+ *
+ * The frame counters are cumulative since the library was loaded, so callers interested in rates
+ * should diff them between calls. Cheap enough to call every frame.
+ */
+void vanilla_get_stream_stats(vanilla_stream_stats_t *stats);
+
 #if defined(__cplusplus)
 }
 #endif
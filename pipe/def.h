@@ -18,6 +18,7 @@
 #define VANILLA_PIPE_CC_DISCONNECTED 0x89
 #define VANILLA_PIPE_CC_INSTALL_POLKIT 0x8A
 #define VANILLA_PIPE_CC_UNINSTALL_POLKIT 0x8B
+#define VANILLA_PIPE_CC_LINK_STATS 0x8C
 #define VANILLA_PIPE_CC_QUIT 0x90
 
 #define VANILLA_PIPE_LOCAL_SOCKET "/tmp/vanilla-pipe_%i.sock"
@@ -40,6 +41,7 @@ typedef struct {
         vanilla_pipe_sync_info_t sync;
         vanilla_connection_t connection;
         vanilla_pipe_status_info_t status;
+        vanilla_link_stats_t link_stats;
     };
 } vanilla_pipe_command_t;
 #pragma pack(pop)
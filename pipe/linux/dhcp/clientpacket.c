@@ -138,6 +138,26 @@ int send_selecting(unsigned long xid, unsigned long server, unsigned long reques
 }
 
 
+/* Broadcasts a DHCP request for a previously held address (RFC 2131 INIT-REBOOT) */
+int send_init_reboot(unsigned long xid, unsigned long requested)
+{
+	struct dhcpMessage packet;
+	struct in_addr addr;
+
+	init_packet(&packet, DHCPREQUEST);
+	packet.xid = xid;
+
+	/* No server id here, any server that knows our lease may answer */
+	add_simple_option(packet.options, DHCP_REQUESTED_IP, requested);
+
+	add_requests(&packet);
+	addr.s_addr = requested;
+	LOG(LOG_DEBUG, "Sending init-reboot request for %s...", inet_ntoa(addr));
+	return raw_packet(&packet, INADDR_ANY, CLIENT_PORT, INADDR_BROADCAST,
+				SERVER_PORT, MAC_BCAST_ADDR, client_config.ifindex);
+}
+
+
 /* Unicasts or broadcasts a DHCP renew message */
 int send_renew(unsigned long xid, unsigned long server, unsigned long ciaddr)
 {
@@ -70,6 +70,7 @@ struct client_config_t client_config = {
 	fqdn: NULL,
 	ifindex: 0,
 	arp: "\0\0\0\0\0\0",		/* appease gcc-3.0 */
+	init_reboot_ip: 0,
 };
 
 #ifndef IN_BUSYBOX
@@ -300,8 +301,16 @@ int udhcpc_main()
 	/* setup the signal pipe */
 	udhcp_sp_setup();
 
-	state = INIT_SELECTING;
-	run_script(NULL, "deconfig");
+	packet_num = 0;
+	if (client_config.init_reboot_ip) {
+		/* Address is presumably already configured, keep it while we confirm it */
+		state = INIT_REBOOT;
+		requested_ip = client_config.init_reboot_ip;
+	} else {
+		state = INIT_SELECTING;
+		requested_ip = 0;
+		run_script(NULL, "deconfig");
+	}
 	change_mode(LISTEN_RAW);
 
 	timeout = 0;
@@ -356,6 +365,33 @@ int udhcpc_main()
 					timeout = now + 60;
 				}
 				break;
+			case INIT_REBOOT:
+				if (packet_num < 2) {
+					if (packet_num == 0)
+						xid = random_xid();
+
+					send_init_reboot(xid, requested_ip); /* broadcast */
+
+					timeout = now + 1;
+					packet_num++;
+				} else {
+					/* Silence is not a NAK, so the old lease may still be good
+					 * (RFC 2131 3.2). Keep the address and renew it at T1 like
+					 * any other lease; only a NAK sends us back to init. */
+					LOG(LOG_INFO, "No reply to init-reboot, keeping previous lease");
+					lease = 60 * 60;
+					t1 = lease / 2;
+					t2 = (lease * 0x7) >> 3;
+					start = now;
+					timeout = t1 + start;
+					state = BOUND;
+					change_mode(LISTEN_NONE);
+					if (client_config.quit_after_lease)
+						return 0;
+					if (!client_config.foreground)
+						client_background();
+				}
+				break;
 			case RENEW_REQUESTED:
 			case REQUESTING:
 				if (packet_num < 3) {
@@ -461,11 +497,16 @@ int udhcpc_main()
 					}
 				}
 				break;
+			case INIT_REBOOT:
 			case RENEW_REQUESTED:
 			case REQUESTING:
 			case RENEWING:
 			case REBINDING:
 				if (*message == DHCPACK) {
+					/* we never saw an offer, so learn the server from the ack */
+					if (state == INIT_REBOOT && (temp = get_option(&packet, DHCP_SERVER_ID)))
+						memcpy(&server_addr, temp, 4);
+
 					if (!(temp = get_option(&packet, DHCP_LEASE_TIME))) {
 						LOG(LOG_ERR, "No lease time with ACK, using 1 hour lease");
 						lease = 60 * 60;
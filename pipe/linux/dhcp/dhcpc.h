@@ -32,6 +32,7 @@ struct client_config_t {
 	uint8_t *fqdn;			/* Optional fully qualified domain name to use */
 	int ifindex;			/* Index number of the interface to use */
 	uint8_t arp[6];			/* Our arp address */
+	unsigned long init_reboot_ip;	/* Previous lease to confirm with INIT-REBOOT, 0 for none */
 };
 
 extern struct client_config_t client_config;
@@ -17,7 +17,7 @@ int main(int argc, const char **argv)
         nlprint("vanilla-pipe - brokers a connection between Vanilla and the Wii U");
         nlprint("--------------------------------------------------------------------------------");
         nlprint("");
-        nlprint("Usage: %s <-local | -udp> <wireless-interface>", argv[0]);
+        nlprint("Usage: %s <-local | -udp> [-warm] <wireless-interface>", argv[0]);
         nlprint("");
         nlprint("Connecting to the Wii U as a gamepad requires some modifications to the 802.11n");
         nlprint("protocol, and not all platforms allow such modifications to be made.");
@@ -39,12 +39,18 @@ int main(int argc, const char **argv)
         nlprint("");
         nlprint("External logging can be enabled with '-log <log-file>'.");
         nlprint("");
+        nlprint("'-warm' keeps wpa_supplicant and the wireless interface up for as long as");
+        nlprint("`vanilla-pipe` runs, rather than only during a session. This makes repeat");
+        nlprint("connections much faster, but the interface can't be used for anything else");
+        nlprint("in the meantime.");
+        nlprint("");
 
         return 1;
     }
 
     int udp_mode = 0;
     int local_mode = 0;
+    int warm_mode = 0;
     const char *wireless_interface = 0;
     const char *log_file = 0;
 
@@ -53,6 +59,8 @@ int main(int argc, const char **argv)
             udp_mode = 1;
         } else if (!strcmp(argv[i], "-local")) {
             local_mode = 1;
+        } else if (!strcmp(argv[i], "-warm")) {
+            warm_mode = 1;
         } else if (!strcmp(argv[i], "-log")) {
             // Increment index
             i++;
@@ -77,7 +85,7 @@ int main(int argc, const char **argv)
         return 1;
     }
 
-    pipe_listen(local_mode, wireless_interface, log_file);
+    pipe_listen(local_mode, warm_mode, wireless_interface, log_file);
 
     return 0;
 }
\ No newline at end of file
@@ -15,6 +15,7 @@
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -38,6 +39,13 @@
 
 static const char *wpa_ctrl_interface = "/var/run/wpa_supplicant_drc";
 
+// How long to look for the console on its cached frequency before scanning every channel
+#define CACHED_FREQ_TIMEOUT_MS 5000
+
+// How many scans to limit to the cached frequency while syncing
+#define MAX_TARGETED_SCANS 3
+#define LINK_STATS_INTERVAL_MS 1000
+
 static pthread_mutex_t running_mutex;
 static pthread_mutex_t main_loop_mutex;
 static pthread_mutex_t action_mutex;
@@ -64,14 +72,37 @@ struct sync_args {
     uint16_t code;
     unsigned char bssid[6];
     unsigned char psk[32];
+    int freq;
     void *(*start_routine)(void *);
+    int (*prepare_routine)(struct sync_args *);
     struct wpa_ctrl *ctrl;
+    struct wpa_ctrl *cmd_ctrl;
     int local;
     int skt;
     sockaddr_u client;
     size_t client_size;
 };
 
+struct wpa_env {
+    int sd_wifi_backend_changed;
+#ifdef USE_LIBNM
+    NMClient *nmcli;
+    NMDevice *nmdev;
+    gboolean is_managed;
+#endif
+    struct wpa_global *wpa;
+    pthread_t wpa_thread;
+    struct wpa_ctrl *ctrl;
+
+    // Requests on the attached ctrl throw away any event that arrives while
+    // waiting for the reply, so anything issued while we care about events
+    // goes through this unattached one instead
+    struct wpa_ctrl *cmd_ctrl;
+};
+
+static struct wpa_env warm_env;
+static int warm_env_active = 0;
+
 struct relay_info {
     const char *wireless_interface;
     int local;
@@ -116,6 +147,14 @@ int is_interrupted()
     return r;
 }
 
+int is_quitting()
+{
+    pthread_mutex_lock(&main_loop_mutex);
+    int r = !main_loop;
+    pthread_mutex_unlock(&main_loop_mutex);
+    return r;
+}
+
 int are_relays_running()
 {
     pthread_mutex_lock(&relay_mutex);
@@ -134,6 +173,30 @@ void wpa_ctrl_command(struct wpa_ctrl *ctrl, const char *cmd, char *buf, size_t
     wpa_ctrl_request(ctrl, cmd, strlen(cmd), buf, buf_len, NULL /*vanilla_pipe_wpa_msg*/);
 }
 
+uint64_t get_monotonic_millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int wait_for_ctrl_event(struct wpa_ctrl *ctrl, int timeout_ms)
+{
+    // Block on the control socket instead of polling so events are handled as
+    // soon as wpa_supplicant sends them
+    int fd = wpa_ctrl_get_fd(ctrl);
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return select(fd + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
 void quit_loop()
 {
     pthread_mutex_lock(&running_mutex);
@@ -294,20 +357,19 @@ void set_signals()
 	sigaction(SIGTERM, &sa, NULL);
 }
 
-void *wpa_setup_environment(void *data)
+int wpa_env_start(struct wpa_env *env, const char *wireless_interface, const char *wireless_config, int (*interrupted)())
 {
-    void *ret = THREADRESULT(VANILLA_ERR_GENERIC);
+    int ret = VANILLA_ERR_GENERIC;
 
-    struct sync_args *args = (struct sync_args *) data;
+    memset(env, 0, sizeof(*env));
 
 	// If this is the Steam Deck, we must switch the backend from `iwd` to `wpa_supplicant`
-	int sd_wifi_backend_changed = 0;
 	{
 		char sd_wifi_backend_buf[100] = {0};
 		ssize_t ret = run_process_and_read_stdout((const char *[]) {"steamos-wifi-set-backend", "--check", NULL}, sd_wifi_backend_buf, sizeof(sd_wifi_backend_buf));
 		if (ret > 0 && !strcmp("iwd\n", sd_wifi_backend_buf)) {
 			nlprint("STEAM DECK: SETTING WIFI BACKEND TO WPA_SUPPLICANT");
-			sd_wifi_backend_changed = 1;
+			env->sd_wifi_backend_changed = 1;
 			run_process_and_read_stdout((const char *[]) {"steamos-wifi-set-backend", "wpa_supplicant", NULL}, 0, 0);
 		}
 	}
@@ -315,17 +377,15 @@ void *wpa_setup_environment(void *data)
 #ifdef USE_LIBNM
     // Check status of interface with NetworkManager
     GError *nm_err;
-    NMClient *nmcli = nm_client_new(NULL, &nm_err);
-    NMDevice *nmdev = NULL;
-    gboolean is_managed = 0;
-    if (nmcli) {
-        nmdev = nm_client_get_device_by_iface(nmcli, args->wireless_interface);
-        if (!nmdev) {
-            nlprint("FAILED TO GET STATUS OF DEVICE %s", args->wireless_interface);
+    env->nmcli = nm_client_new(NULL, &nm_err);
+    if (env->nmcli) {
+        env->nmdev = nm_client_get_device_by_iface(env->nmcli, wireless_interface);
+        if (!env->nmdev) {
+            nlprint("FAILED TO GET STATUS OF DEVICE %s", wireless_interface);
         } else {
-			if ((is_managed = nm_device_get_managed(nmdev))) {
-				nm_device_set_managed(nmdev, FALSE);
-				nlprint("TEMPORARILY SET %s TO UNMANAGED", args->wireless_interface);
+			if ((env->is_managed = nm_device_get_managed(env->nmdev))) {
+				nm_device_set_managed(env->nmdev, FALSE);
+				nlprint("TEMPORARILY SET %s TO UNMANAGED", wireless_interface);
 			}
 		}
     } else {
@@ -341,11 +401,11 @@ void *wpa_setup_environment(void *data)
 
     struct wpa_interface interface = {0};
     interface.driver = "nl80211";
-    interface.ifname = args->wireless_interface;
-    interface.confname = args->wireless_config;
+    interface.ifname = wireless_interface;
+    interface.confname = wireless_config;
 
-    struct wpa_global *wpa = wpa_supplicant_init(&params);
-    if (!wpa) {
+    env->wpa = wpa_supplicant_init(&params);
+    if (!env->wpa) {
         nlprint("FAILED TO INIT WPA SUPPLICANT");
         goto die_and_reenable_managed;
     }
@@ -353,64 +413,153 @@ void *wpa_setup_environment(void *data)
 	// wpa_supplicant may have replaced our signals, so lets re-set them
 	set_signals();
 
-    struct wpa_supplicant *wpa_s = wpa_supplicant_add_iface(wpa, &interface, NULL);
+    struct wpa_supplicant *wpa_s = wpa_supplicant_add_iface(env->wpa, &interface, NULL);
     if (!wpa_s) {
         nlprint("FAILED TO ADD WPA IFACE");
-        goto die_and_kill;
+        goto die_and_deinit;
     }
 
-    pthread_t wpa_thread;
-    pthread_create(&wpa_thread, NULL, start_wpa, wpa);
+    pthread_create(&env->wpa_thread, NULL, start_wpa, env->wpa);
 
-    // Get control interface
+    // Get control interface, this usually only takes a few milliseconds
     char buf[128];
-    snprintf(buf, sizeof(buf), "%s/%s", wpa_ctrl_interface, args->wireless_interface);
-    struct wpa_ctrl *ctrl;
-    while (!(ctrl = wpa_ctrl_open(buf))) {
-        if (is_interrupted()) goto die_and_kill;
-        nlprint("WAITING FOR CTRL INTERFACE");
-        sleep(1);
+    snprintf(buf, sizeof(buf), "%s/%s", wpa_ctrl_interface, wireless_interface);
+    nlprint("WAITING FOR CTRL INTERFACE");
+    while (!(env->ctrl = wpa_ctrl_open(buf))) {
+        if (interrupted()) goto die_and_kill;
+        usleep(50000);
     }
 
-    if (is_interrupted() || wpa_ctrl_attach(ctrl) < 0) {
+    if (interrupted() || wpa_ctrl_attach(env->ctrl) < 0) {
         nlprint("FAILED TO ATTACH TO WPA");
         goto die_and_close;
     }
 
-    args->ctrl = ctrl;
-    ret = args->start_routine(args);
+    if (!(env->cmd_ctrl = wpa_ctrl_open(buf))) {
+        nlprint("FAILED TO OPEN WPA COMMAND INTERFACE");
+        goto die_and_detach;
+    }
+
+    return VANILLA_SUCCESS;
 
 die_and_detach:
-    wpa_ctrl_detach(ctrl);
+    wpa_ctrl_detach(env->ctrl);
 
 die_and_close:
-    wpa_ctrl_close(ctrl);
+    wpa_ctrl_close(env->ctrl);
 
 die_and_kill:
-    pthread_cancel(wpa_thread);
-    pthread_join(wpa_thread, NULL);
-    wpa_supplicant_deinit(wpa);
+    pthread_cancel(env->wpa_thread);
+    pthread_join(env->wpa_thread, NULL);
+
+die_and_deinit:
+    wpa_supplicant_deinit(env->wpa);
 
 die_and_reenable_managed:
 #ifdef USE_LIBNM
-    if (is_managed) {
-        nlprint("SETTING %s BACK TO MANAGED", args->wireless_interface);
-        nm_device_set_managed(nmdev, TRUE);
+    if (env->is_managed) {
+        nlprint("SETTING %s BACK TO MANAGED", wireless_interface);
+        nm_device_set_managed(env->nmdev, TRUE);
+    }
+
+    if (env->nmcli) {
+        g_object_unref(env->nmcli);
+    }
+#endif
+
+	if (env->sd_wifi_backend_changed) {
+		// Restore iwd
+		nlprint("STEAM DECK: SETTING WIFI BACKEND TO IWD");
+		run_process_and_read_stdout((const char *[]) {"steamos-wifi-set-backend", "iwd", NULL}, 0, 0);
+	}
+
+    return ret;
+}
+
+void wpa_env_stop(struct wpa_env *env, const char *wireless_interface)
+{
+    wpa_ctrl_close(env->cmd_ctrl);
+    wpa_ctrl_detach(env->ctrl);
+    wpa_ctrl_close(env->ctrl);
+
+    pthread_cancel(env->wpa_thread);
+    pthread_join(env->wpa_thread, NULL);
+    wpa_supplicant_deinit(env->wpa);
+
+#ifdef USE_LIBNM
+    if (env->is_managed) {
+        nlprint("SETTING %s BACK TO MANAGED", wireless_interface);
+        nm_device_set_managed(env->nmdev, TRUE);
     }
 
-die_and_close_nmcli:
-    if (nmcli) {
-        g_object_unref(nmcli);
+    if (env->nmcli) {
+        g_object_unref(env->nmcli);
     }
 #endif
 
-	if (sd_wifi_backend_changed) {
+	if (env->sd_wifi_backend_changed) {
 		// Restore iwd
 		nlprint("STEAM DECK: SETTING WIFI BACKEND TO IWD");
 		run_process_and_read_stdout((const char *[]) {"steamos-wifi-set-backend", "iwd", NULL}, 0, 0);
 	}
+}
+
+void drain_ctrl_events(struct wpa_ctrl *ctrl)
+{
+    char buf[1024];
+    while (wpa_ctrl_pending(ctrl) > 0) {
+        size_t buf_len = sizeof(buf);
+        if (wpa_ctrl_recv(ctrl, buf, &buf_len) != 0) {
+            break;
+        }
+    }
+}
+
+void reset_warm_networks(struct wpa_ctrl *ctrl)
+{
+    char buf[64];
+    size_t buf_len;
+
+    buf_len = sizeof(buf);
+    wpa_ctrl_command(ctrl, "DISCONNECT", buf, &buf_len);
+
+    buf_len = sizeof(buf);
+    wpa_ctrl_command(ctrl, "REMOVE_NETWORK all", buf, &buf_len);
+}
+
+void *wpa_setup_environment(void *data)
+{
+    struct sync_args *args = (struct sync_args *) data;
+
+    void *ret;
+
+    if (warm_env_active) {
+        // Supplicant is already up, just make sure nothing from a previous
+        // session is lingering before handing it over
+        drain_ctrl_events(warm_env.ctrl);
+
+        args->ctrl = warm_env.ctrl;
+        args->cmd_ctrl = warm_env.cmd_ctrl;
+        if (args->prepare_routine && args->prepare_routine(args) != VANILLA_SUCCESS) {
+            ret = THREADRESULT(VANILLA_ERR_GENERIC);
+        } else {
+            ret = args->start_routine(args);
+        }
+
+        reset_warm_networks(warm_env.ctrl);
+    } else {
+        struct wpa_env env;
+        if (wpa_env_start(&env, args->wireless_interface, args->wireless_config, is_interrupted) != VANILLA_SUCCESS) {
+            return THREADRESULT(VANILLA_ERR_GENERIC);
+        }
+
+        args->ctrl = env.ctrl;
+        args->cmd_ctrl = env.cmd_ctrl;
+        ret = args->start_routine(args);
+
+        wpa_env_stop(&env, args->wireless_interface);
+    }
 
-die:
     return ret;
 }
 
@@ -429,11 +578,48 @@ const char *get_dhcp_value(char **env, const char *key)
     return 0;
 }
 
+void save_console_lease(const unsigned char *bssid, const char *ip, int prefix);
+
+struct dhcp_context {
+    struct nl_sock *nl;
+    const unsigned char *bssid;
+};
+
+void add_interface_address(struct nl_sock *nl, const char *interface, const char *ip, int prefix)
+{
+    // Create IP address object from DHCP data
+    struct nl_addr *ip_addr;
+    nl_addr_parse(ip, AF_INET, &ip_addr);
+    nl_addr_set_prefixlen(ip_addr, prefix);
+
+    // Create route object
+    struct rtnl_addr *ra = rtnl_addr_alloc();
+    rtnl_addr_set_ifindex(ra, if_nametoindex(interface));
+    rtnl_addr_set_local(ra, ip_addr);
+
+    // Create build request
+    struct nl_msg *msg;
+    rtnl_addr_build_add_request(ra, 0, &msg);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,00)
+    // Make this route the lowest possible priority so the system doesn't favor it over other connections
+    nla_put_u32(msg, IFA_RT_PRIORITY, UINT32_MAX);
+#endif
+
+    // Send request
+    nl_send_auto_complete(nl, msg);
+
+    // Cleanup
+    nlmsg_free(msg);
+    rtnl_addr_put(ra);
+    nl_addr_put(ip_addr);
+}
+
 void dhcp_callback(const char *type, char **env, void *data)
 {
-    struct nl_sock *nl = (struct nl_sock *) data;
+    struct dhcp_context *ctx = (struct dhcp_context *) data;
 
-    if (!strcmp(type, "bound")) {
+    if (!strcmp(type, "bound") || !strcmp(type, "renew")) {
         // Add address to interface
         const char *ip = get_dhcp_value(env, "ip");
         // const char *subnet = get_dhcp_value(env, "subnet");
@@ -441,38 +627,18 @@ void dhcp_callback(const char *type, char **env, void *data)
         // const char *serverid = get_dhcp_value(env, "serverid");
         const char *mask = get_dhcp_value(env, "mask");
 
-        // Create IP address object from DHCP data
-        struct nl_addr *ip_addr;
-        nl_addr_parse(ip, AF_INET, &ip_addr);
-        nl_addr_set_prefixlen(ip_addr, atoi(mask));
+        add_interface_address(ctx->nl, get_dhcp_value(env, "interface"), ip, atoi(mask));
 
-        // Create route object
-        struct rtnl_addr *ra = rtnl_addr_alloc();
-        rtnl_addr_set_ifindex(ra, if_nametoindex(get_dhcp_value(env, "interface")));
-        rtnl_addr_set_local(ra, ip_addr);
-
-        // Create build request
-        struct nl_msg *msg;
-        rtnl_addr_build_add_request(ra, 0, &msg);
-
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,00)
-        // Make this route the lowest possible priority so the system doesn't favor it over other connections
-        nla_put_u32(msg, IFA_RT_PRIORITY, UINT32_MAX);
-#endif
-
-        // Send request
-        nl_send_auto_complete(nl, msg);
-
-        // Cleanup
-        nlmsg_free(msg);
-        rtnl_addr_put(ra);
-        nl_addr_put(ip_addr);
+        // Remember this lease so we can skip the full exchange next time
+        if (ctx->bssid) {
+            save_console_lease(ctx->bssid, ip, atoi(mask));
+        }
     } else if (!strcmp(type, "deconfig")) {
         // Remove address from interface
         struct rtnl_addr *ra = rtnl_addr_alloc();
         rtnl_addr_set_ifindex(ra, if_nametoindex(get_dhcp_value(env, "interface")));
         rtnl_addr_set_family(ra, AF_INET);
-        rtnl_addr_delete(nl, ra, 0);
+        rtnl_addr_delete(ctx->nl, ra, 0);
         rtnl_addr_put(ra);
     }
     // nlprint("GOT DHCP EVENT: %s", type);
@@ -483,7 +649,7 @@ void dhcp_callback(const char *type, char **env, void *data)
     // }
 }
 
-int call_dhcp(const char *network_interface)
+int call_dhcp(const char *network_interface, const unsigned char *bssid, const char *cached_ip, int cached_prefix, int abort_if_no_lease)
 {
     int ret = VANILLA_ERR_GENERIC;
 
@@ -499,11 +665,26 @@ int call_dhcp(const char *network_interface)
         goto free_socket_and_exit;
     }
 
+    struct dhcp_context ctx;
+    ctx.nl = nl;
+    ctx.bssid = bssid;
+
     client_config.foreground = 1;
     client_config.quit_after_lease = 1;
     client_config.interface = (char *) network_interface;
     client_config.callback = dhcp_callback;
-    client_config.callback_data = nl;
+    client_config.callback_data = &ctx;
+    client_config.init_reboot_ip = 0;
+    client_config.abort_if_no_lease = abort_if_no_lease;
+
+    if (cached_ip) {
+        // Use the old lease right away and have udhcpc confirm it with an
+        // INIT-REBOOT request. If the server refuses, udhcpc removes the
+        // address and falls back to the full exchange. If nobody answers,
+        // the address is kept and renewed later.
+        add_interface_address(nl, network_interface, cached_ip, cached_prefix);
+        client_config.init_reboot_ip = inet_addr(cached_ip);
+    }
 
     if (udhcpc_main() == 0) {
         ret = VANILLA_SUCCESS;
@@ -519,6 +700,50 @@ exit:
     return ret;
 }
 
+struct dhcp_rebind_args {
+    struct sync_args *sync;
+    const char *wireless_interface;
+    const unsigned char *bssid;
+    char lease_ip[INET_ADDRSTRLEN];
+    int lease_prefix;
+};
+
+void *dhcp_rebind_thread(void *data)
+{
+    struct dhcp_rebind_args *args = (struct dhcp_rebind_args *) data;
+
+    struct sync_args *sync = args->sync;
+
+    // We run in the background during a session, so don't retry forever
+    int r = call_dhcp(args->wireless_interface, args->bssid, args->lease_ip, args->lease_prefix, 1);
+    if (r == VANILLA_SUCCESS) {
+        nlprint("DHCP LEASE CONFIRMED");
+        return THREADRESULT(r);
+    }
+
+    nlprint("FAILED TO CONFIRM DHCP LEASE ON %s, REQUESTING A NEW ONE", args->wireless_interface);
+
+    // The relays are up but nothing can reach the console without an address,
+    // so tell the frontend until we have one again
+    vanilla_pipe_command_t cmd;
+    cmd.control_code = VANILLA_PIPE_CC_DISCONNECTED;
+    sendto(sync->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &sync->client, sync->client_size);
+
+    // Each attempt gives up after a few discovers so we notice the session ending
+    while (!is_interrupted()) {
+        r = call_dhcp(args->wireless_interface, args->bssid, NULL, 0, 1);
+        if (r == VANILLA_SUCCESS) {
+            nlprint("DHCP ESTABLISHED");
+
+            cmd.control_code = VANILLA_PIPE_CC_CONNECTED;
+            sendto(sync->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &sync->client, sync->client_size);
+            break;
+        }
+    }
+
+    return THREADRESULT(r);
+}
+
 void *do_relay(void *data)
 {
     relay_ports *ports = (relay_ports *) data;
@@ -663,6 +888,75 @@ close:
     return THREADRESULT(ret);
 }
 
+int poll_link_stats(struct wpa_ctrl *ctrl, vanilla_link_stats_t *stats)
+{
+    char buf[1024];
+    size_t buf_len;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->noise = 9999;
+
+    buf_len = sizeof(buf) - 1;
+    wpa_ctrl_command(ctrl, "SIGNAL_POLL", buf, &buf_len);
+    buf[buf_len] = 0;
+    if (!memcmp(buf, "FAIL", 4)) {
+        return 0;
+    }
+
+    const char *line = strtok(buf, "\n");
+    while (line) {
+        if (!memcmp(line, "RSSI=", 5)) {
+            stats->rssi = atoi(line + 5);
+        } else if (!memcmp(line, "NOISE=", 6)) {
+            stats->noise = atoi(line + 6);
+        } else if (!memcmp(line, "LINKSPEED=", 10)) {
+            stats->link_speed = atoi(line + 10);
+        } else if (!memcmp(line, "FREQUENCY=", 10)) {
+            stats->frequency = atoi(line + 10);
+        }
+        line = strtok(NULL, "\n");
+    }
+
+    // Packet counters aren't supported by every driver, leave them at 0 if not
+    buf_len = sizeof(buf) - 1;
+    wpa_ctrl_command(ctrl, "PKTCNT_POLL", buf, &buf_len);
+    buf[buf_len] = 0;
+    if (memcmp(buf, "FAIL", 4)) {
+        line = strtok(buf, "\n");
+        while (line) {
+            if (!memcmp(line, "TXGOOD=", 7)) {
+                stats->tx_good = strtoul(line + 7, NULL, 10);
+            } else if (!memcmp(line, "TXBAD=", 6)) {
+                stats->tx_bad = strtoul(line + 6, NULL, 10);
+            } else if (!memcmp(line, "RXGOOD=", 7)) {
+                stats->rx_good = strtoul(line + 7, NULL, 10);
+            }
+            line = strtok(NULL, "\n");
+        }
+    }
+
+    return 1;
+}
+
+void send_link_stats(struct sync_args *args)
+{
+    vanilla_link_stats_t stats;
+    if (!poll_link_stats(args->cmd_ctrl, &stats)) {
+        return;
+    }
+
+    vanilla_pipe_command_t cmd;
+    cmd.control_code = VANILLA_PIPE_CC_LINK_STATS;
+    cmd.link_stats.rssi = htonl(stats.rssi);
+    cmd.link_stats.noise = htonl(stats.noise);
+    cmd.link_stats.link_speed = htonl(stats.link_speed);
+    cmd.link_stats.frequency = htonl(stats.frequency);
+    cmd.link_stats.tx_good = htonl(stats.tx_good);
+    cmd.link_stats.tx_bad = htonl(stats.tx_bad);
+    cmd.link_stats.rx_good = htonl(stats.rx_good);
+    sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.link_stats), 0, (const struct sockaddr *) &args->client, args->client_size);
+}
+
 void create_all_relays(struct sync_args *args)
 {
     pthread_t vid_thread, aud_thread, msg_thread, cmd_thread, hid_thread;
@@ -697,23 +991,48 @@ void create_all_relays(struct sync_args *args)
     cmd.control_code = VANILLA_PIPE_CC_CONNECTED;
     sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
 
+    // Sockets, relays and the DHCP lease all survive a link drop, so we only
+    // need to wait for wpa_supplicant to re-associate and tell the frontend
+    int link_up = 1;
+    uint64_t link_lost_time = 0;
+    uint64_t last_stats_time = 0;
+
     while (!is_interrupted()) {
+        // Report radio conditions about once a second while associated
+        uint64_t now = get_monotonic_millis();
+        if (link_up && now - last_stats_time >= LINK_STATS_INTERVAL_MS) {
+            send_link_stats(args);
+            last_stats_time = now;
+        }
+
+        if (!wait_for_ctrl_event(args->ctrl, 250)) {
+            continue;
+        }
+
         char buf[1024];
         size_t buf_len = sizeof(buf);
-        if (wpa_ctrl_recv(args->ctrl, buf, &buf_len) == 0) {
-            if (!memcmp(buf, "<3>CTRL-EVENT-DISCONNECTED", 26)) {
-                nlprint("Wii U disconnected, attempting to re-connect...");
+        if (wpa_ctrl_recv(args->ctrl, buf, &buf_len) != 0) {
+            continue;
+        }
 
-                // Let client know we lost connection
-                cmd.control_code = VANILLA_PIPE_CC_DISCONNECTED;
-                sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
+        if (link_up && !memcmp(buf, "<3>CTRL-EVENT-DISCONNECTED", 26)) {
+            nlprint("Wii U disconnected, attempting to re-connect...");
 
-                break;
-            }
-        }
+            link_up = 0;
+            link_lost_time = get_monotonic_millis();
 
-        // wpa_ctrl_recv is non-blocking, so reduce thrashing by sleeping here
-        sleep(1);
+            // Let client know we lost connection
+            cmd.control_code = VANILLA_PIPE_CC_DISCONNECTED;
+            sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
+        } else if (!link_up && !memcmp(buf, "<3>CTRL-EVENT-CONNECTED", 23)) {
+            nlprint("RE-CONNECTED TO CONSOLE AFTER %llu MS", (unsigned long long) (get_monotonic_millis() - link_lost_time));
+
+            link_up = 1;
+
+            // Let client know we're back
+            cmd.control_code = VANILLA_PIPE_CC_CONNECTED;
+            sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
+        }
     }
 
     if (!args->local) {
@@ -819,48 +1138,234 @@ void bytes_to_str(unsigned char *data, size_t data_size, const char *separator,
     }
 }
 
-int create_connect_config(const char *filename, unsigned char *bssid, unsigned char *psk)
+struct console_cache {
+    int freq;
+    char lease_ip[INET_ADDRSTRLEN];
+    int lease_prefix;
+};
+
+size_t get_console_cache_filename(const unsigned char *bssid, char *buf, size_t buf_size)
 {
+    char name[64];
+    if (bssid) {
+        char bssid_str[13];
+        bytes_to_str((unsigned char *) bssid, sizeof(vanilla_bssid_t), 0, bssid_str);
+        snprintf(name, sizeof(name), "vanilla_console_%s.conf", bssid_str);
+    } else {
+        // Remembers whichever console we saw most recently, used when we don't know the BSSID yet
+        snprintf(name, sizeof(name), "vanilla_console_last.conf");
+    }
+    return get_home_directory_file(name, buf, buf_size);
+}
+
+void read_console_cache(const unsigned char *bssid, struct console_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    char filename[1024];
+    get_console_cache_filename(bssid, filename, sizeof(filename));
+
+    FILE *in_file = fopen(filename, "r");
+    if (!in_file) {
+        return;
+    }
+
+    char buf[150];
+    while (read_line_from_file(in_file, buf, sizeof(buf))) {
+        if (!memcmp(buf, "freq=", 5)) {
+            cache->freq = atoi(buf + 5);
+        } else if (!memcmp(buf, "lease=", 6)) {
+            // Strip newline
+            buf[strcspn(buf, "\n")] = 0;
+            strncpy(cache->lease_ip, buf + 6, sizeof(cache->lease_ip) - 1);
+        } else if (!memcmp(buf, "prefix=", 7)) {
+            cache->lease_prefix = atoi(buf + 7);
+        }
+    }
+
+    fclose(in_file);
+}
+
+void write_console_cache(const unsigned char *bssid, const struct console_cache *cache)
+{
+    char filename[1024];
+    get_console_cache_filename(bssid, filename, sizeof(filename));
+
     FILE *out_file = fopen(filename, "w");
     if (!out_file) {
-        nlprint("FAILED TO OPEN OUTPUT CONFIG FILE");
-        return VANILLA_ERR_GENERIC;
+        nlprint("FAILED TO WRITE CONSOLE CACHE: %s", filename);
+        return;
+    }
+
+    fprintf(out_file, "freq=%i\n", cache->freq);
+    if (cache->lease_ip[0]) {
+        fprintf(out_file, "lease=%s\nprefix=%i\n", cache->lease_ip, cache->lease_prefix);
     }
 
-    static const char *template =
-        "ctrl_interface=/var/run/wpa_supplicant_drc\n"
-        "ap_scan=1\n"
-        "\n"
-        "network={\n"
-        "	scan_ssid=1\n"
-        "	bssid=%s\n"
-        "	ssid=\"%s\"\n"
-        "	psk=%s\n"
-        "	proto=RSN\n"
-        "	key_mgmt=WPA-PSK\n"
-        "	pairwise=CCMP GCMP\n"
-        "	group=CCMP GCMP TKIP\n"
-        "	auth_alg=OPEN\n"
-        "	pbss=2\n"
-        "}\n"
-        "\n";
+    fclose(out_file);
+}
+
+void save_console_freq(const unsigned char *bssid, int freq)
+{
+    struct console_cache cache;
+
+    read_console_cache(bssid, &cache);
+    if (cache.freq != freq) {
+        cache.freq = freq;
+        write_console_cache(bssid, &cache);
+        nlprint("SAVED CONSOLE FREQUENCY %i MHZ", freq);
+    }
 
+    read_console_cache(NULL, &cache);
+    if (cache.freq != freq) {
+        cache.freq = freq;
+        write_console_cache(NULL, &cache);
+    }
+}
+
+void save_console_lease(const unsigned char *bssid, const char *ip, int prefix)
+{
+    struct console_cache cache;
+
+    read_console_cache(bssid, &cache);
+    if (strcmp(cache.lease_ip, ip) || cache.lease_prefix != prefix) {
+        memset(cache.lease_ip, 0, sizeof(cache.lease_ip));
+        strncpy(cache.lease_ip, ip, sizeof(cache.lease_ip) - 1);
+        cache.lease_prefix = prefix;
+        write_console_cache(bssid, &cache);
+    }
+}
+
+int get_connected_freq(struct wpa_ctrl *ctrl)
+{
+    char buf[2048];
+    size_t buf_len = sizeof(buf) - 1;
+    wpa_ctrl_command(ctrl, "STATUS", buf, &buf_len);
+    buf[buf_len] = 0;
+
+    const char *line = strtok(buf, "\n");
+    while (line) {
+        if (!memcmp(line, "freq=", 5)) {
+            return atoi(line + 5);
+        }
+        line = strtok(NULL, "\n");
+    }
+
+    return 0;
+}
+
+typedef void (*network_field_callback_t)(const char *key, const char *value, void *userdata);
+
+void get_connect_network_fields(unsigned char *bssid, unsigned char *psk, int freq, network_field_callback_t callback, void *userdata)
+{
     char bssid_str[18];
-    char ssid_str[17];
+    char ssid_str[19];
     char psk_str[65];
 
-    memcpy(ssid_str, "WiiU", 4);
+    ssid_str[0] = '"';
+    memcpy(ssid_str + 1, "WiiU", 4);
+    bytes_to_str(bssid, sizeof(vanilla_bssid_t), 0, ssid_str + 5);
+    memcpy(ssid_str + 17, "\"", 2);
 
-    bytes_to_str(bssid, sizeof(vanilla_bssid_t), 0, ssid_str + 4);
     bytes_to_str(bssid, sizeof(vanilla_bssid_t), ":", bssid_str);
     bytes_to_str(psk, sizeof(vanilla_psk_t), 0, psk_str);
 
-    fprintf(out_file, template, bssid_str, ssid_str, psk_str);
+    callback("scan_ssid", "1", userdata);
+    callback("bssid", bssid_str, userdata);
+    callback("ssid", ssid_str, userdata);
+    callback("psk", psk_str, userdata);
+    callback("proto", "RSN", userdata);
+    callback("key_mgmt", "WPA-PSK", userdata);
+    callback("pairwise", "CCMP GCMP", userdata);
+    callback("group", "CCMP GCMP TKIP", userdata);
+    callback("auth_alg", "OPEN", userdata);
+    callback("pbss", "2", userdata);
+
+    if (freq > 0) {
+        // Only scan and associate on the channel we last saw the console on
+        char freq_str[12];
+        snprintf(freq_str, sizeof(freq_str), "%i", freq);
+        callback("scan_freq", freq_str, userdata);
+        callback("freq_list", freq_str, userdata);
+    }
+}
+
+static void write_network_field_to_file(const char *key, const char *value, void *userdata)
+{
+    fprintf((FILE *) userdata, "\t%s=%s\n", key, value);
+}
+
+int create_connect_config(const char *filename, unsigned char *bssid, unsigned char *psk, int freq)
+{
+    FILE *out_file = fopen(filename, "w");
+    if (!out_file) {
+        nlprint("FAILED TO OPEN OUTPUT CONFIG FILE");
+        return VANILLA_ERR_GENERIC;
+    }
+
+    fprintf(out_file, "ctrl_interface=%s\nap_scan=1\n\nnetwork={\n", wpa_ctrl_interface);
+    get_connect_network_fields(bssid, psk, freq, write_network_field_to_file, out_file);
+    fprintf(out_file, "}\n\n");
+
     fclose(out_file);
 
     return VANILLA_SUCCESS;
 }
 
+struct network_field_ctrl {
+    struct wpa_ctrl *ctrl;
+    int id;
+    int failed;
+};
+
+static void set_network_field_over_ctrl(const char *key, const char *value, void *userdata)
+{
+    struct network_field_ctrl *n = (struct network_field_ctrl *) userdata;
+
+    char cmd[128];
+    char buf[64];
+    size_t buf_len = sizeof(buf);
+
+    snprintf(cmd, sizeof(cmd), "SET_NETWORK %i %s %s", n->id, key, value);
+    wpa_ctrl_command(n->ctrl, cmd, buf, &buf_len);
+
+    if (buf_len < 2 || memcmp(buf, "OK", 2)) {
+        nlprint("FAILED TO SET NETWORK FIELD %s", key);
+        n->failed = 1;
+    }
+}
+
+int add_connect_network(struct sync_args *args)
+{
+    char buf[64];
+    size_t buf_len = sizeof(buf) - 1;
+
+    // Swap in the console's network block on the already running supplicant
+    wpa_ctrl_command(args->cmd_ctrl, "ADD_NETWORK", buf, &buf_len);
+    buf[buf_len] = 0;
+
+    struct network_field_ctrl n;
+    n.ctrl = args->cmd_ctrl;
+    n.id = atoi(buf);
+    n.failed = (buf_len == 0 || !memcmp(buf, "FAIL", 4));
+    if (n.failed) {
+        nlprint("FAILED TO ADD NETWORK");
+        return VANILLA_ERR_GENERIC;
+    }
+
+    get_connect_network_fields(args->bssid, args->psk, args->freq, set_network_field_over_ctrl, &n);
+    if (n.failed) {
+        return VANILLA_ERR_GENERIC;
+    }
+
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "SELECT_NETWORK %i", n.id);
+    buf_len = sizeof(buf);
+    wpa_ctrl_command(args->cmd_ctrl, cmd, buf, &buf_len);
+
+    return VANILLA_SUCCESS;
+}
+
 ssize_t send_ping_to_client(struct sync_args *args)
 {
     vanilla_pipe_command_t cmd;
@@ -877,6 +1382,14 @@ void *sync_with_console_internal(void *data)
 
     int ret = VANILLA_ERR_GENERIC;
     char bssid[18];
+    int bssid_freq = 0;
+
+    // If we've seen a console before, it's very likely on the same channel, so
+    // try scanning only that for a few rounds before scanning everything
+    struct console_cache cache;
+    read_console_cache(NULL, &cache);
+    int targeted_scans = cache.freq ? MAX_TARGETED_SCANS : 0;
+
     while (1) {
         size_t actual_buf_len;
 
@@ -893,8 +1406,16 @@ void *sync_with_console_internal(void *data)
             }
 
             // nlprint("SCANNING");
+            char scan_cmd[32];
+            if (targeted_scans > 0) {
+                snprintf(scan_cmd, sizeof(scan_cmd), "SCAN freq=%i", cache.freq);
+                targeted_scans--;
+            } else {
+                strcpy(scan_cmd, "SCAN");
+            }
+
             actual_buf_len = buf_len;
-            wpa_ctrl_command(args->ctrl, "SCAN", buf, &actual_buf_len);
+            wpa_ctrl_command(args->ctrl, scan_cmd, buf, &actual_buf_len);
 
             if (!memcmp(buf, "FAIL-BUSY", 9)) {
                 //nlprint("DEVICE BUSY, RETRYING");
@@ -923,6 +1444,9 @@ void *sync_with_console_internal(void *data)
                 strncpy(bssid, line, sizeof(bssid));
                 bssid[17] = '\0';
 
+                // Frequency follows the BSSID in scan results
+                bssid_freq = atoi(line + 18);
+
                 char wps_buf[100];
                 snprintf(wps_buf, sizeof(wps_buf), "WPS_PIN %.*s %04d5678", 17, bssid, args->code);
 
@@ -996,6 +1520,10 @@ void *sync_with_console_internal(void *data)
                         // Convert BSSID from string to bytes
                         str_to_bytes(bssid, 1, cmd.connection.bssid.bssid, sizeof(cmd.connection.bssid.bssid));
 
+                        if (bssid_freq) {
+                            save_console_freq(cmd.connection.bssid.bssid, bssid_freq);
+                        }
+
                         sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.connection), 0, (const struct sockaddr *) &args->client, args->client_size);
 
                         ret = VANILLA_SUCCESS;
@@ -1019,13 +1547,30 @@ void *do_connect(void *data)
 {
     struct sync_args *args = (struct sync_args *) data;
 
+    uint64_t connect_start = get_monotonic_millis();
+
     while (!is_interrupted()) {
         while (1) {
-            while (!wpa_ctrl_pending(args->ctrl)) {
-                sleep(2);
-                nlprint("WAITING FOR CONNECTION");
+            if (is_interrupted()) return THREADRESULT(VANILLA_ERR_GENERIC);
 
-                if (is_interrupted()) return THREADRESULT(VANILLA_ERR_GENERIC);
+            // Checked on every event too, scan events on the cached channel
+            // could otherwise keep the fallback from ever happening
+            if (args->freq && get_monotonic_millis() - connect_start > CACHED_FREQ_TIMEOUT_MS) {
+                // Console may have changed channel, go back to scanning everything
+                nlprint("CONSOLE NOT FOUND ON %i MHZ, FALLING BACK TO FULL SCAN", args->freq);
+                args->freq = 0;
+
+                char buf[64];
+                size_t buf_len = sizeof(buf);
+                wpa_ctrl_command(args->cmd_ctrl, "REMOVE_NETWORK all", buf, &buf_len);
+                if (add_connect_network(args) != VANILLA_SUCCESS) {
+                    return THREADRESULT(VANILLA_ERR_GENERIC);
+                }
+            }
+
+            if (!wait_for_ctrl_event(args->ctrl, 1000)) {
+                nlprint("WAITING FOR CONNECTION");
+                continue;
             }
 
             char buf[1024];
@@ -1039,45 +1584,82 @@ void *do_connect(void *data)
             if (memcmp(buf, "<3>CTRL-EVENT-CONNECTED", 23) == 0) {
                 break;
             }
-
-            if (is_interrupted()) return THREADRESULT(VANILLA_ERR_GENERIC);
         }
 
         nlprint("CONNECTED TO CONSOLE");
 
+        int freq = get_connected_freq(args->cmd_ctrl);
+        if (freq) {
+            save_console_freq(args->bssid, freq);
+        }
+
         // Use DHCP on interface
-        int r = call_dhcp(args->wireless_interface);
-        if (r != VANILLA_SUCCESS) {
-            nlprint("FAILED TO RUN DHCP ON %s", args->wireless_interface);
-            return THREADRESULT(r);
-        } else {
-            nlprint("DHCP ESTABLISHED");
+        struct console_cache cache;
+        read_console_cache(args->bssid, &cache);
+
+        pthread_t dhcp_thread;
+        struct dhcp_rebind_args rebind;
+        int rebinding = 0;
+
+        if (cache.lease_ip[0]) {
+            // The console hands out the same lease every time, so start using
+            // it immediately and confirm it in the background
+            nlprint("REUSING CACHED DHCP LEASE %s", cache.lease_ip);
+
+            rebind.sync = args;
+            rebind.wireless_interface = args->wireless_interface;
+            rebind.bssid = args->bssid;
+            memcpy(rebind.lease_ip, cache.lease_ip, sizeof(rebind.lease_ip));
+            rebind.lease_prefix = cache.lease_prefix;
+
+            rebinding = (pthread_create(&dhcp_thread, NULL, dhcp_rebind_thread, &rebind) == 0);
+        }
+
+        if (!rebinding) {
+            int r = call_dhcp(args->wireless_interface, args->bssid, NULL, 0, 0);
+            if (r != VANILLA_SUCCESS) {
+                nlprint("FAILED TO RUN DHCP ON %s", args->wireless_interface);
+                return THREADRESULT(r);
+            } else {
+                nlprint("DHCP ESTABLISHED");
+            }
         }
 
         create_all_relays(args);
+
+        if (rebinding) {
+            pthread_join(dhcp_thread, NULL);
+        }
     }
 
     return THREADRESULT(VANILLA_SUCCESS);
 }
 
+int create_authenticate_config(const char *filename)
+{
+    FILE *config = fopen(filename, "w");
+    if (!config) {
+        nlprint("FAILED TO WRITE TEMP CONFIG: %s", filename);
+        return VANILLA_ERR_GENERIC;
+    }
+
+    fprintf(config, "ctrl_interface=%s\nupdate_config=1\nap_scan=1\n", wpa_ctrl_interface);
+    fclose(config);
+
+    return VANILLA_SUCCESS;
+}
+
 void *vanilla_sync_with_console(void *data)
 {
     struct sync_args *args = (struct sync_args *) data;
 
-    const char *wireless_conf_file;
-
-    FILE *config;
-    wireless_conf_file = get_wireless_authenticate_config_filename();
-    config = fopen(wireless_conf_file, "w");
-    if (!config) {
-        nlprint("FAILED TO WRITE TEMP CONFIG: %s", wireless_conf_file);
+    const char *wireless_conf_file = get_wireless_authenticate_config_filename();
+    if (create_authenticate_config(wireless_conf_file) != VANILLA_SUCCESS) {
         return THREADRESULT(VANILLA_ERR_GENERIC);
     }
 
-    fprintf(config, "ctrl_interface=%s\nupdate_config=1\n", wpa_ctrl_interface);
-    fclose(config);
-
     args->start_routine = sync_with_console_internal;
+    args->prepare_routine = 0;
     args->wireless_config = wireless_conf_file;
 
     return wpa_setup_environment(args);
@@ -1088,9 +1670,18 @@ void *vanilla_connect_to_console(void *data)
     struct sync_args *args = (struct sync_args *) data;
 
     args->start_routine = do_connect;
+    args->prepare_routine = add_connect_network;
     args->wireless_config = get_wireless_connect_config_filename();
 
-    create_connect_config(args->wireless_config, args->bssid, args->psk);
+    // Try the channel the console was on last time first
+    struct console_cache cache;
+    read_console_cache(args->bssid, &cache);
+    args->freq = cache.freq;
+    if (args->freq) {
+        nlprint("USING CACHED CONSOLE FREQUENCY %i MHZ", args->freq);
+    }
+
+    create_connect_config(args->wireless_config, args->bssid, args->psk, args->freq);
 
     return wpa_setup_environment(args);
 }
@@ -1160,7 +1751,7 @@ int install_polkit()
 	return ret;
 }
 
-void pipe_listen(int local, const char *wireless_interface, const char *log_file)
+void pipe_listen(int local, int warm, const char *wireless_interface, const char *log_file)
 {
     // Store reference to log file
     ext_logfile = log_file;
@@ -1189,6 +1780,17 @@ void pipe_listen(int local, const char *wireless_interface, const char *log_file
 
     main_loop = 1;
 
+    if (warm) {
+        // Bring the supplicant up once now so sessions only need to swap the network block
+        const char *wireless_conf_file = get_wireless_authenticate_config_filename();
+        if (create_authenticate_config(wireless_conf_file) == VANILLA_SUCCESS
+            && wpa_env_start(&warm_env, wireless_interface, wireless_conf_file, is_quitting) == VANILLA_SUCCESS) {
+            warm_env_active = 1;
+        } else {
+            nlprint("FAILED TO START PERSISTENT SUPPLICANT, WILL START PER SESSION");
+        }
+    }
+
     pthread_mutex_lock(&main_loop_mutex);
 
     nlprint("READY");
@@ -1271,6 +1873,11 @@ repeat_loop:
     pthread_mutex_lock(&action_mutex);
     pthread_mutex_unlock(&action_mutex);
 
+    if (warm_env_active) {
+        wpa_env_stop(&warm_env, wireless_interface);
+        warm_env_active = 0;
+    }
+
 	// Wait for stdin thread
 	pthread_join(stdin_thread, NULL);
 